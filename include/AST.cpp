@@ -27,12 +27,6 @@ namespace DrTcc
 
     AstNode *AST::NewNode(AstNodeType type)
     {
-        if (nodes.Available() < 64)
-        {
-            printf("AST ERROR: 'nodes' out of memory\n");
-            throw std::exception();
-        }
-
         auto node = nodes.Alloc<AstNode>();
         memset(node, 0, sizeof(AstNode));
         node->flag = tok1_.ToUnderlying(type);
@@ -118,23 +112,20 @@ namespace DrTcc
         auto f = vars.find(str);
         if (f != vars.end())
         {
-            node->data._string = f->second;
+            node->data._id.name = names[f->second];
+            node->data._id.id = f->second;
         }
         else
-        {   // 没有就插入
+        {   // 没有就插入，编号按出现顺序分配
             SetStr(node, str);
-            vars.insert(std::make_pair(str, node->data._string));
+            node->data._id.id = (sint) names.size();
+            vars.insert(std::make_pair(str, node->data._id.id));
+            names.push_back(node->data._string);
         }
     }
 
     void AST::SetStr(AstNode *node, const std::string &str)
     {
-        if (strings.Available() < 64)
-        {
-            printf("AST ERROR: 'strings' out of memory\n");
-            throw std::exception();
-        }
-
         auto len = str.length();
         auto s = strings.AllocArray<char>(len + 1);
         memcpy(s, str.c_str(), len);
@@ -147,6 +138,7 @@ namespace DrTcc
         nodes.Clear();
         strings.Clear();
         vars.clear();
+        names.clear();
         Init();
     }
 
@@ -169,10 +161,71 @@ namespace DrTcc
         }
     }
 
-    std::string AST::DisplayStr(AstNode *node)
+    AstTree AST::Compact()
+    {
+        AstTree tree(root, names);
+        // 指针结点不再使用，字符串仍被紧凑AST引用
+        nodes.Clear();
+        root = NewNode(AstNodeType::AstRoot);
+        current = root;
+
+        return tree;
+    }
+
+    AstTree::AstTree(AstNode *root, const std::vector<const char *> &names) : names_(names)
+    {
+        if (root != nullptr)
+        { Flatten(root); }
+    }
+
+    void AstTree::Flatten(AstNode *node)
+    {
+        auto index = (AstIndex) nodes_.size();
+        nodes_.emplace_back();
+        nodes_[index].flag = node->flag;
+        nodes_[index].data = node->data;
+
+        if (node->child != nullptr)
+        {
+            auto i = node->child;
+            do
+            {
+                Flatten(i);
+                i = i->next;
+            } while(i != node->child);
+        }
+
+        auto size = nodes_.size() - index;
+        if (size >= (1U << 24))
+        {
+            printf("ast::compact: too many nodes\n");
+            throw std::exception();
+        }
+        nodes_[index].size = size;
+    }
+
+    AstIndex AstTree::Last(AstIndex i) const
+    {
+        auto last = AstNil;
+        for (auto c = Child(i); c != AstNil && c != End(i); c = Next(c))
+        { last = c; }
+
+        return last;
+    }
+
+    int AstTree::ChildrenSize(AstIndex i) const
+    {
+        auto count = 0;
+        for (auto c = Child(i); c != AstNil && c != End(i); c = Next(c))
+        { count++; }
+
+        return count;
+    }
+
+    std::string AST::DisplayStr(const char *str)
     {
         std::stringstream ss;
-        for (auto c = node->data._string; *c != 0; c++)
+        for (auto c = str; *c != 0; c++)
         {
             if (isprint(*c))
             { ss << *c; }
@@ -188,159 +241,157 @@ namespace DrTcc
         return ss.str();
     }
 
-    template<typename T>
-    static void AstRecursion(AstNode *node, int level, std::ostream &os, T f)
+    void AstTree::Print(AstIndex node, std::ostream &os) const
     {
-        if (node == nullptr)
-        { return; }
-
-        auto i = node;
-        if (i->next == i)
-        {
-            f(i, level, os);
-            return;
-        }
-        f(i, level, os);
-        i = i->next;
-        while(i != node)
-        {
-            f(i, level, os);
-            i = i->next;
-        }
+        if (node != AstNil)
+        { Print(node, AstNil, 0, os); }
     }
 
-    void AST::Print(AstNode *node, int level, std::ostream &os)
+    void AstTree::Print(AstIndex node, AstIndex parent, int level, std::ostream &os) const
     {
         Token tok_;
-        if (node == nullptr)
+        if (node == AstNil)
         { return; }
 
-        auto rec = [&](auto n, auto l, auto &os) { AST::Print(n, l, os); };
-        auto type = (AstNodeType) node->flag;
+        auto rec = [&](auto n, auto l, auto &os) { this->Print(n, node, l, os); };
+        auto recChildren = [&](auto l, auto &os) {
+            for (auto i = Child(node); i != AstNil && i != End(node); i = Next(i))
+            { rec(i, l, os); }
+        };
+        // 是否为父结点的最右儿子
+        auto last = [&]() { return parent == AstNil || Next(node) == End(parent); };
+        const auto &data = nodes_[node].data;
+        auto type = (AstNodeType) nodes_[node].flag;
 
         switch (type)
         {
             case AstNodeType::AstRoot:      // 根结点
-                AstRecursion(node->child, level, os, rec);
+                recChildren(level, os);
                 break;
             case AstNodeType::AstEnum:      // 枚举
                 os << "enum {" << std::endl;
-                AstRecursion(node->child, level + 1, os, rec);
+                recChildren(level + 1, os);
                 os << "};" << std::endl;
                 break;
             case AstNodeType::AstEnumUnit:
                 os << std::setw(level * 4);
-                rec(node->child, level, os);        // id
+                rec(Child(node), level, os);        // id
                 os << " = ";
-                rec(node->child->next, level, os);  // int
-                if (node->next != node->parent->child)
+                rec(Next(Child(node)), level, os);  // int
+                if (!last())
                 {
                     os << ',';
                 }
                 os << std::endl;
                 break;
             case AstNodeType::AstVarGlobal:
-                rec(node->child, level, os);        // type
+                rec(Child(node), level, os);        // type
                 os << ' ';
-                rec(node->child->next, level, os);  // id
+                rec(Next(Child(node)), level, os);  // id
                 os << ';' << std::endl;
                 break;
             case AstNodeType::AstVarParam:
-                rec(node->child, level, os);        // type
+                rec(Child(node), level, os);        // type
                 os << ' ';
-                rec(node->child->next, level, os);  // id
-                if (node->next != node->parent->child)
+                rec(Next(Child(node)), level, os);  // id
+                if (!last())
                 {
                     os << ", ";
                 }
                 break;
             case AstNodeType::AstVarLocal:
                 os << std::setfill(' ') << std::setw(level * 4) << "";
-                rec(node->child, level, os);        // type
+                rec(Child(node), level, os);        // type
                 os << ' ';
-                rec(node->child->next, level, os);  // id
+                rec(Next(Child(node)), level, os);  // id
                 os << ';' << std::endl;
                 break;
             case AstNodeType::AstFunc:
             {
-                auto _node = node->child;
+                auto _node = Child(node);
                 rec(_node, level, os); // Function return type
                 os << ' ';
-                _node = _node->next;
+                _node = Next(_node);
                 rec(_node, level, os); // function id
                 os << '(';
-                _node = _node->next;
+                _node = Next(_node);
                 rec(_node, level, os); // param
-                os << ')' << ' ';
-                _node = _node->next;
-                rec(_node, level, os); // block
+                os << ')';
+                if (ChildrenSize(node) > 3)
+                {
+                    os << ' ';
+                    _node = Next(_node);
+                    rec(_node, level, os); // block
+                }
+                else
+                { os << ';'; }     // 原型
                 os << std::endl;
             }
                 break;
 
             case AstNodeType::AstParam:
-                AstRecursion(node->child, level, os, rec);
+                recChildren(level, os);
                 break;
 
             case AstNodeType::AstBlock:
-                if (node->parent->flag == tok_.ToUnderlying(AstNodeType::AstBlock))
+                if (parent != AstNil && nodes_[parent].flag == tok_.ToUnderlying(AstNodeType::AstBlock))
                 {
                     os << std::setfill(' ') << std::setw(level * 4) << "";
                 }
                 os << '{' << std::endl;
-                AstRecursion(node->child, level + 1, os, rec); // statement
+                recChildren(level + 1, os); // statement
                 os << std::setfill(' ') << std::setw(level * 4) << "";
                 os << '}';
                 break;
 
             case AstNodeType::AstStmt:
                 os << std::setfill(' ') << std::setw(level * 4) << "";
-                AstRecursion(node->child, level, os, rec);
+                recChildren(level, os);
                 break;
             case AstNodeType::AstReturn:
                 os << "return";
-                if (node->child != nullptr)
+                if (Child(node) != AstNil)
                 {
                     os << ' ';
-                    rec(node->child, level, os);
+                    rec(Child(node), level, os);
                 }
                 os << ';' << std::endl;
                 break;
             case AstNodeType::AstExp:
-                rec(node->child, level, os);        // expression
+                rec(Child(node), level, os);        // expression
                 os << ';' << std::endl;
                 break;
             case AstNodeType::AstExpParam:
-                rec(node->child, level, os);        // param
-                if (node->next != node->parent->child)
+                rec(Child(node), level, os);        // param
+                if (!last())
                 { os << ", "; }
                 break;
             case AstNodeType::AstSinOp:
-                if (node->data._op.data == 0)
+                if (data._op.data == 0)
                 { // 前置
-                    os << tok_.OpStr(node->data._op.op);
-                    rec(node->child, level, os); // exp
+                    os << tok_.OpStr(data._op.op);
+                    rec(Child(node), level, os); // exp
                 }
                 else
                 { // 后置
-                    rec(node->child, level, os); // exp
-                    os << tok_.OpStr(node->data._op.op);
+                    rec(Child(node), level, os); // exp
+                    os << tok_.OpStr(data._op.op);
                 }
                 break;
 
             case AstNodeType::AstBinOp:
             {
                 bool paran = false;
-                switch ((AstNodeType) node->parent->flag)
+                switch (parent == AstNil ? AstNodeType::AstRoot : (AstNodeType) nodes_[parent].flag)
                 {
                     case AstNodeType::AstSinOp:
                     case AstNodeType::AstBinOp:
                     case AstNodeType::AstTriOp:
-                        if (node->parent->data._op.op == OperatorType::Lsquare)
+                        if (nodes_[parent].data._op.op == OperatorType::Lsquare)
                         {
                             paran = false;
                         }
-                        else if (node->data._op.op < node->parent->data._op.op)
+                        else if (data._op.op < nodes_[parent].data._op.op)
                         {
                             paran = true;
                         }
@@ -352,18 +403,18 @@ namespace DrTcc
                 {
                     os << '(';
                 }
-                if (node->data._op.op == OperatorType::Lsquare)
+                if (data._op.op == OperatorType::Lsquare)
                 {
-                    rec(node->child, level, os); // exp
+                    rec(Child(node), level, os); // exp
                     os << '[';
-                    rec(node->child->next, level, os);
+                    rec(Next(Child(node)), level, os);
                     os << ']'; // index
                 }
                 else
                 {
-                    rec(node->child, level, os); // exp1
-                    os << ' ' << tok_.OpStr(node->data._op.op) << ' ';
-                    rec(node->child->next, level, os); // exp2
+                    rec(Child(node), level, os); // exp1
+                    os << ' ' << tok_.OpStr(data._op.op) << ' ';
+                    rec(Next(Child(node)), level, os); // exp2
                 }
                 if (paran)
                 {
@@ -373,33 +424,33 @@ namespace DrTcc
                 break;
 
             case AstNodeType::AstTriOp:   // ? : true : false;
-                if (node->data._op.op == OperatorType::Query)
+                if (data._op.op == OperatorType::Query)
                 {
-                    rec(node->child, level, os);       // cond
+                    rec(Child(node), level, os);       // cond
                     os << " ? ";
-                    rec(node->child->next, level, os); // true
+                    rec(Next(Child(node)), level, os); // true
                     os << " : ";
-                    rec(node->child->prev, level, os); // false
+                    rec(Last(node), level, os); // false
                 }
                 break;
 
             case AstNodeType::AstIf:
             {
                 os << "if (";
-                rec(node->child, level, os);    // condition
+                rec(Child(node), level, os);    // condition
                 os << ')';
-                auto _block = node->child->next->flag == tok_.ToUnderlying(AstNodeType::AstBlock);
+                auto _block = nodes_[Next(Child(node))].flag == tok_.ToUnderlying(AstNodeType::AstBlock);
                 if (_block)
                 {
                     os << ' ';
-                    rec(node->child->next, level, os);
+                    rec(Next(Child(node)), level, os);
                 }
                 else
                 {
                     os << std::endl;
-                    rec(node->child->next, level + 1, os);
+                    rec(Next(Child(node)), level + 1, os);
                 }
-                if (node->child->next != node->child->prev)
+                if (ChildrenSize(node) > 2)
                 {
                     if (_block)
                     {
@@ -410,8 +461,8 @@ namespace DrTcc
                         os << std::setfill(' ') << std::setw(level * 4) << "";
                     }
                     os << "else";
-                    auto _else = node->child->prev;
-                    _block = _else->flag == tok_.ToUnderlying(AstNodeType::AstBlock);
+                    auto _else = Last(node);
+                    _block = nodes_[_else].flag == tok_.ToUnderlying(AstNodeType::AstBlock);
                     if (_block)
                     {
                         os << ' ';
@@ -420,10 +471,10 @@ namespace DrTcc
                     }
                     else
                     {
-                        if (_else->flag == tok_.ToUnderlying(AstNodeType::AstStmt))
+                        if (nodes_[_else].flag == tok_.ToUnderlying(AstNodeType::AstStmt))
                         {
                             os << ' ';
-                            rec(_else->child, level, os);
+                            rec(Child(_else), level, os);
                         }
                         else
                         {
@@ -444,85 +495,85 @@ namespace DrTcc
 
             case AstNodeType::AstWhile:
                 os << "while (";
-                rec(node->child, level, os);
+                rec(Child(node), level, os);
                 os << ") ";
-                rec(node->child->next, level, os);
+                rec(Next(Child(node)), level, os);
                 os << std::endl;
                 break;
 
             case AstNodeType::AstInvoke:
-                os << node->data._string << '('; // id
-                AstRecursion(node->child, level, os, rec); // param
+                os << data._string << '('; // id
+                recChildren(level, os); // param
                 os << ')';
                 break;
 
             case AstNodeType::AstEmpty:
                 break;
             case AstNodeType::AstId:
-                os << node->data._string;
+                os << data._string;
                 break;
 
             case AstNodeType::AstType:
-                os << tok_.LexerTypeStr(node->data._type.type);
-                if (node->data._type.ptr > 0)
+                os << tok_.LexerTypeStr(data._type.type);
+                if (data._type.ptr > 0)
                 {
-                    os << std::setfill('*') << std::setw(node->data._type.ptr) << "";
+                    os << std::setfill('*') << std::setw(data._type.ptr) << "";
                 }
                 break;
 
             case AstNodeType::AstCast:
                 os << '(';
-                os << tok_.LexerTypeStr(node->data._type.type);
-                if (node->data._type.ptr > 0)
+                os << tok_.LexerTypeStr(data._type.type);
+                if (data._type.ptr > 0)
                 {
-                    os << std::setfill('*') << std::setw(node->data._type.ptr) << "";
+                    os << std::setfill('*') << std::setw(data._type.ptr) << "";
                 }
                 os << ')';
-                rec(node->child, level, os);
+                rec(Child(node), level, os);
                 break;
 
             case AstNodeType::AstString:
             {
-                os << '"' << DisplayStr(node) << '"';
+                os << '"' << AST::DisplayStr(data._string) << '"';
             }
                 break;
             case AstNodeType::AstChar:
-                if (isprint(node->data._char))
-                { os << '\'' << node->data._char << '\''; }
-                else if (node->data._char == '\n')
+                if (isprint(data._char))
+                { os << '\'' << data._char << '\''; }
+                else if (data._char == '\n')
                 { os << "'\\n'"; }
                 else
                 {
                     os << "'\\x" << std::setiosflags(std::ios::uppercase) << std::hex << std::setfill('0')
-                       << std::setw(2) << (unsigned int) node->data._char << '\'';
+                       << std::setw(2) << (unsigned int) data._char << '\'';
                 }
                 break;
             case AstNodeType::AstUchar:
-                os << (unsigned int) node->data._uchar;
+                os << (unsigned int) data._uchar;
                 break;
             case AstNodeType::AstShort:
-                os << node->data._short;
+                os << data._short;
                 break;
             case AstNodeType::AstUshort:
-                os << node->data._ushort;
+                os << data._ushort;
                 break;
             case AstNodeType::AstInt:
-                os << node->data._int;
+                os << data._int;
                 break;
             case AstNodeType::AstUint:
-                os << node->data._uint;
+                os << data._uint;
                 break;
             case AstNodeType::AstLong:
-                os << node->data._long;
+                os << data._long;
                 break;
             case AstNodeType::AstUlong:
-                os << node->data._ulong;
+                os << data._ulong;
                 break;
             case AstNodeType::AstFloat:
-                os << node->data._float;
+                os << data._float;
                 break;
             case AstNodeType::AstDouble:
-                os << node->data._double;
+                os << data._double;
                 break;
         }
     }
@@ -8,8 +8,8 @@
 #include "MemoryPool.h"
 #include "Token.h"
 
-#define AST_NODE_MEM (32 * 1024)
-#define AST_STR_MEM (16 * 1024)
+#define AST_NODE_MEM (512 * 1024)    // 节点区每块的字节数
+#define AST_STR_MEM (64 * 1024)      // 字符串区每块的字节数
 
 namespace DrTcc
 {
@@ -19,41 +19,49 @@ namespace DrTcc
     };
 
 
-    struct AstNode
+    union AstData
     {
-        uint32_t flag;      // 节点类型
+        BaseType<TokenType::Char>::type _char;
+        BaseType<TokenType::Uchar>::type _uchar;
+        BaseType<TokenType::Short>::type _short;
+        BaseType<TokenType::Ushort>::type _ushort;
+        BaseType<TokenType::Int>::type _int;
+        BaseType<TokenType::Uint>::type _uint;
+        BaseType<TokenType::Long>::type _long;
+        BaseType<TokenType::Ulong>::type _ulong;
+        BaseType<TokenType::Float>::type _float;
+        BaseType<TokenType::Double>::type _double;
+        const char *_string;            // 存放identifier名
+
+        struct
+        {
+            const char *name;       // 与_string相同
+            sint id;                // 标识符编号，同名标识符编号相同
+        } _id;
+
+        struct
+        {
+            TokenType type;
+            sint ptr;
+        } _type;
 
-        union
+        struct
         {
-            BaseType<TokenType::Char>::type _char;
-            BaseType<TokenType::Uchar>::type _uchar;
-            BaseType<TokenType::Short>::type _short;
-            BaseType<TokenType::Ushort>::type _ushort;
-            BaseType<TokenType::Int>::type _int;
-            BaseType<TokenType::Uint>::type _uint;
-            BaseType<TokenType::Long>::type _long;
-            BaseType<TokenType::Ulong>::type _ulong;
-            BaseType<TokenType::Float>::type _float;
-            BaseType<TokenType::Double>::type _double;
-            const char *_string;            // 存放identifier名
-
-            struct
-            {
-                TokenType type;
-                sint ptr;
-            } _type;
-
-            struct
-            {
-                OperatorType op;        // 名称
-                sint data;              // 前置 后置
-            } _op;
-
-            struct
-            {
-                sint _1, _2;
-            } _ins;
-        } data;
+            OperatorType op;        // 名称
+            sint data;              // 前置 后置
+        } _op;
+
+        struct
+        {
+            sint _1, _2;
+        } _ins;
+    };
+
+    // 语法分析时使用的指针结点，便于插入和调整
+    struct AstNode
+    {
+        uint32_t flag;      // 节点类型
+        AstData data;
 
         // 广义表
         AstNode *parent;    // 父节点
@@ -62,6 +70,74 @@ namespace DrTcc
         AstNode *child;     // 最左儿子
     };
 
+    using AstIndex = uint32_t;
+
+    const AstIndex AstNil = 0xFFFFFFFFU;      // 空下标
+
+    // 紧凑结点: 按先序存放在连续数组中，用32位下标代替指针
+    // 第一个儿子紧跟在父结点之后，右兄弟 = 下标 + 子树大小，同一结点的儿子连续排列
+    struct AstCompact
+    {
+        uint32_t flag: 8;   // 节点类型
+        uint32_t size: 24;  // 子树结点数，包括自身
+        AstData data;
+    };
+
+    static_assert(sizeof(AstCompact) * 2 <= sizeof(AstNode), "compact node should halve node memory");
+
+    // 生成代码用的只读紧凑AST，由AST::Compact从指针树展开
+    class AstTree
+    {
+        public:
+            AstTree() = default;
+
+            AstTree(AstNode *root, const std::vector<const char *> &names);
+
+            const AstCompact &operator[](AstIndex i) const
+            { return nodes_[i]; }
+
+            AstIndex Root() const
+            { return nodes_.empty() ? AstNil : 0; }
+
+            // 最左儿子，没有则为AstNil
+            AstIndex Child(AstIndex i) const
+            { return nodes_[i].size > 1 ? i + 1 : AstNil; }
+
+            // 右兄弟，不检查是否越过父结点的子树
+            AstIndex Next(AstIndex i) const
+            { return i + nodes_[i].size; }
+
+            // 子树末尾(不含)，遍历儿子时作为结束条件
+            AstIndex End(AstIndex i) const
+            { return i + nodes_[i].size; }
+
+            // 最右儿子
+            AstIndex Last(AstIndex i) const;
+
+            int ChildrenSize(AstIndex i) const;
+
+            size_t Size() const
+            { return nodes_.size(); }
+
+            // 标识符编号 -> 名称
+            const char *Name(int id) const
+            { return names_[id]; }
+
+            int Names() const
+            { return (int) names_.size(); }
+
+            void Print(AstIndex node, std::ostream &os) const;
+
+        private:
+            void Flatten(AstNode *node);
+
+            void Print(AstIndex node, AstIndex parent, int level, std::ostream &os) const;
+
+        private:
+            std::vector<AstCompact> nodes_;
+            std::vector<const char *> names_;
+    };
+
     class AST
     {
         public:
@@ -89,11 +165,12 @@ namespace DrTcc
 
             void SetStr(AstNode *node, const std::string &str);
 
-            static std::string DisplayStr(AstNode *node);
+            static std::string DisplayStr(const char *str);
 
             void Convert(AstToType type);
 
-            static void Print(AstNode *node, int level, std::ostream &os);
+            // 展开为紧凑AST并释放指针结点，字符串区保留给紧凑AST引用
+            AstTree Compact();
 
             void Reset();
 
@@ -102,9 +179,10 @@ namespace DrTcc
 
         private:
             Token tok1_;
-            MemoryPool<AST_NODE_MEM> nodes;     // 全局ast节点管理
-            MemoryPool<AST_STR_MEM> strings;     // 全局字符串管理
-            std::unordered_map<std::string, const char *> vars;// 变量名查找
+            Arena<AST_NODE_MEM> nodes;      // 全局ast节点管理，按块增长，Reset时整体释放
+            Arena<AST_STR_MEM> strings;     // 全局字符串管理
+            std::unordered_map<std::string, int> vars;// 变量名查找 -> 标识符编号
+            std::vector<const char *> names;           // 标识符编号 -> 变量名
             AstNode *root;
             AstNode *current;
 
@@ -0,0 +1,378 @@
+//
+// Created by yw.
+//
+
+#include "Cache.h"
+#include "Image.h"
+#include "Source.h"
+#include <set>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#include <process.h>
+#include <sys/utime.h>
+#define getpid _getpid
+#else
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+#endif
+
+#define CACHE_DEBUG 0
+
+namespace DrTcc
+{
+    Cache::Cache(std::string dir, uint64_t limit) : dir_(std::move(dir)), limit_(limit)
+    {
+#ifdef _WIN32
+        _mkdir(dir_.c_str());
+#else
+        mkdir(dir_.c_str(), 0755);
+#endif
+    }
+
+    void Hasher::Feed(const void *p, size_t n)
+    {
+        auto q = (const char *) p;
+        for (size_t i = 0; i < n; ++i)
+        {
+            auto c = (uint8) q[i];
+            h1_ = (h1_ ^ c) * 1099511628211ULL;
+            h2_ = (h2_ + c) * 0xFF51AFD7ED558CCDULL;
+            h2_ ^= h2_ >> 29;
+        }
+    }
+
+    void Hasher::Part(const void *p, size_t n)
+    {
+        Feed(&n, sizeof(n));
+        Feed(p, n);
+    }
+
+    std::string Hasher::Hex() const
+    {
+        char key[33];
+        snprintf(key, sizeof(key), "%016llx%016llx", (unsigned long long) h1_, (unsigned long long) h2_);
+        return key;
+    }
+
+    std::string Cache::Key(StringView source, const std::string &options)
+    {
+        Hasher h;
+        uint32_t version[] = {CACHE_VERSION, IMAGE_VERSION};
+        h.Value(version);
+        h.Part(options.data(), options.size());
+        h.Part(source.data, source.size);
+        return h.Hex();
+    }
+
+    std::string Cache::FuncKey(const std::string &input)
+    {
+        // 按路径区分，同一文件的各个版本共用一个
+        Hasher h;
+        h.Part(CACHE_FUNCS, sizeof(CACHE_FUNCS) - 1);
+        h.Part(input.data(), input.size());
+        return h.Hex();
+    }
+
+    std::string Cache::Path(const std::string &key, const char *ext) const
+    {
+        return dir_ + "/" + key + ext;
+    }
+
+    std::string Cache::Find(const std::string &key)
+    {
+        auto path = Path(key);
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            misses_++;
+            return std::string();
+        }
+        file.close();
+
+        // 修改时间即最近使用时间
+        utime(path.c_str(), nullptr);
+        hits_++;
+#if CACHE_DEBUG
+        printf("[CACHE] hit %s\n", path.c_str());
+#endif
+        return path;
+    }
+
+    bool Cache::Store(const std::string &key, const std::function<void(std::ostream &)> &write, const char *ext)
+    {
+        auto path = Path(key, ext);
+        auto temp = path + "." + std::to_string(getpid()) + ".tmp";
+        {
+            std::ofstream file(temp, std::ios::binary);
+            write(file);
+            file.close();
+            if (!file)
+            {
+                remove(temp.c_str());
+                return false;
+            }
+        }
+
+        // 同一目录内改名是原子的，其他进程看不到写了一半的映像
+#ifdef _WIN32
+        if (!MoveFileExA(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+#else
+        if (rename(temp.c_str(), path.c_str()) != 0)
+#endif
+        {
+            remove(temp.c_str());
+            return false;
+        }
+#if CACHE_DEBUG
+        printf("[CACHE] store %s\n", path.c_str());
+#endif
+        Evict();
+        return true;
+    }
+
+    std::string Cache::ImageKey(const std::string &key, const std::vector<std::string> &includes)
+    {
+        Hasher h;
+        h.Part(key.data(), key.size());
+        for (const auto &path : includes)
+        {
+            Source file;
+            if (!file.Open(path))
+            { return std::string(); }
+            h.Part(path.data(), path.size());
+            h.Part(file.View().data, file.View().size);
+        }
+        return h.Hex();
+    }
+
+    std::string Cache::FindImage(const std::string &key)
+    {
+        std::ifstream list(Path(key, CACHE_INCLUDES));
+        if (!list)
+        {
+            misses_++;
+            return std::string();
+        }
+        std::vector<std::string> includes;
+        std::string line;
+        while(std::getline(list, line))
+        { includes.push_back(line); }
+
+        // 头文件被删除或改名时重新编译
+        auto image = ImageKey(key, includes);
+        if (image.empty())
+        {
+            misses_++;
+            return std::string();
+        }
+
+        // 清单与映像一同更新使用时间，否则淘汰时常用程序的清单最先被删
+        auto path = Find(image);
+        if (!path.empty())
+        { utime(Path(key, CACHE_INCLUDES).c_str(), nullptr); }
+        return path;
+    }
+
+    bool Cache::StoreImage(const std::string &key, const std::vector<std::string> &includes,
+                           const std::function<void(std::ostream &)> &write)
+    {
+        // 同一头文件可能被包含多次，清单中只记一次
+        std::vector<std::string> files;
+        std::set<std::string> seen;
+        for (const auto &path : includes)
+        {
+            if (seen.insert(path).second)
+            { files.push_back(path); }
+        }
+        auto image = ImageKey(key, files);
+        if (image.empty())
+        { return false; }
+
+        // 先写映像再写清单，读到清单时映像已经就绪
+        return Store(image, write) && Store(key, [&](std::ostream &os) {
+            for (const auto &path : files)
+            { os << path << '\n'; }
+        }, CACHE_INCLUDES);
+    }
+
+    // 以扩展名判断缓存文件
+    static bool IsCacheFile(const std::string &name)
+    {
+        auto ext = [&](const char *e) {
+            auto n = strlen(e);
+            return name.size() > n && name.compare(name.size() - n, n, e) == 0;
+        };
+        return ext(CACHE_IMAGE) || ext(CACHE_FUNCS) || ext(CACHE_INCLUDES);
+    }
+
+    void Cache::Evict()
+    {
+        struct Entry
+        {
+            std::string path;
+            uint64_t size;
+            time_t used;
+        };
+        std::vector<Entry> entries;
+        uint64_t total = 0;
+
+#ifdef _WIN32
+        WIN32_FIND_DATAA fd;
+        auto find = FindFirstFileA((dir_ + "/*").c_str(), &fd);
+        if (find == INVALID_HANDLE_VALUE)
+        { return; }
+        do
+        {
+            if (!IsCacheFile(fd.cFileName))
+            { continue; }
+            struct _stat st;
+            auto path = dir_ + "/" + fd.cFileName;
+            if (_stat(path.c_str(), &st) == 0)
+            {
+                entries.push_back(Entry{path, (uint64_t) st.st_size, st.st_mtime});
+                total += (uint64_t) st.st_size;
+            }
+        } while(FindNextFileA(find, &fd));
+        FindClose(find);
+#else
+        auto dir = opendir(dir_.c_str());
+        if (dir == nullptr)
+        { return; }
+        while(auto e = readdir(dir))
+        {
+            std::string name = e->d_name;
+            if (!IsCacheFile(name))
+            { continue; }
+            struct stat st;
+            auto path = dir_ + "/" + name;
+            if (stat(path.c_str(), &st) == 0)
+            {
+                entries.push_back(Entry{path, (uint64_t) st.st_size, st.st_mtime});
+                total += (uint64_t) st.st_size;
+            }
+        }
+        closedir(dir);
+#endif
+
+        if (total <= limit_)
+        { return; }
+
+        // 最久未使用的先淘汰
+        std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.used < b.used; });
+        for (const auto &e : entries)
+        {
+            if (total <= limit_)
+            { break; }
+            if (remove(e.path.c_str()) == 0)
+            { total -= e.size; }
+#if CACHE_DEBUG
+            printf("[CACHE] evict %s\n", e.path.c_str());
+#endif
+        }
+    }
+
+    // 函数缓存文件: 版本串 | 函数个数 | 各函数(指纹, 各段长度, 各段内容)，均为小端
+    bool FuncCache::Load(StringView view)
+    {
+        auto p = view.data, end = view.data + view.size;
+        auto read = [&](void *dst, size_t n) {
+            if ((size_t) (end - p) < n)
+            { return false; }
+            memcpy(dst, p, n);
+            p += n;
+            return true;
+        };
+        auto readString = [&](std::string &str) {
+            uint32_t n;
+            if (!read(&n, sizeof(n)) || (size_t) (end - p) < n)
+            { return false; }
+            str.assign(p, n);
+            p += n;
+            return true;
+        };
+        auto readArray = [&](auto &vec) {
+            uint32_t n;
+            if (!read(&n, sizeof(n)) || (size_t) (end - p) / sizeof(vec[0]) < n)
+            { return false; }
+            vec.resize(n);
+            return read(vec.data(), n * sizeof(vec[0]));
+        };
+
+        uint32_t version;
+        uint32_t count;
+        if (!read(&version, sizeof(version)) || version != CACHE_VERSION || !read(&count, sizeof(count)))
+        { return false; }
+
+        std::unordered_map<std::string, FuncCode> funcs;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            std::string fingerprint;
+            FuncCode code;
+            uint32_t calls;
+            if (!readString(fingerprint) || !readArray(code.text) || !readArray(code.data) ||
+                !readArray(code.strings) || !read(&calls, sizeof(calls)))
+            { return false; }
+            for (uint32_t k = 0; k < calls; ++k)
+            {
+                int offset;
+                std::string name;
+                if (!read(&offset, sizeof(offset)) || !readString(name))
+                { return false; }
+                code.calls.emplace_back(offset, name);
+            }
+            funcs[fingerprint] = std::move(code);
+        }
+        old_.swap(funcs);
+        return true;
+    }
+
+    void FuncCache::Write(std::ostream &os) const
+    {
+        auto write = [&](const void *p, size_t n) { os.write((const char *) p, (std::streamsize) n); };
+        auto writeString = [&](const std::string &str) {
+            auto n = (uint32_t) str.size();
+            write(&n, sizeof(n));
+            write(str.data(), n);
+        };
+        auto writeArray = [&](const auto &vec) {
+            auto n = (uint32_t) vec.size();
+            write(&n, sizeof(n));
+            write(vec.data(), n * sizeof(vec[0]));
+        };
+
+        uint32_t version = CACHE_VERSION;
+        write(&version, sizeof(version));
+        auto count = (uint32_t) new_.size();
+        write(&count, sizeof(count));
+        for (const auto &f : new_)
+        {
+            writeString(f.first);
+            writeArray(f.second.text);
+            writeArray(f.second.data);
+            writeArray(f.second.strings);
+            auto calls = (uint32_t) f.second.calls.size();
+            write(&calls, sizeof(calls));
+            for (const auto &c : f.second.calls)
+            {
+                write(&c.first, sizeof(c.first));
+                writeString(c.second);
+            }
+        }
+    }
+
+    const FuncCode *FuncCache::Find(const std::string &fingerprint) const
+    {
+        auto f = old_.find(fingerprint);
+        return f != old_.end() ? &f->second : nullptr;
+    }
+
+    void FuncCache::Keep(const std::string &fingerprint, FuncCode code, bool hit)
+    {
+        (hit ? hits_ : misses_)++;
+        new_[fingerprint] = std::move(code);
+    }
+}
@@ -0,0 +1,138 @@
+//
+// Created by yw.
+//
+
+#ifndef DRTCC_CACHE_H
+#define DRTCC_CACHE_H
+
+#include "Type.h"
+#include <functional>
+
+// 缓存内容的版本，键和函数缓存文件都带上它
+// 修改生成代码(GenCode、Optimizer)、指令集或缓存格式时加一，旧的缓存随之失效
+#define CACHE_VERSION 1
+
+#define CACHE_LIMIT (256 * 1024 * 1024)     // 缓存目录默认的大小上限(字节)
+#define CACHE_IMAGE ".dtc"                  // 整个程序的字节码映像
+#define CACHE_FUNCS ".dtf"                  // 一个源文件各函数的字节码
+#define CACHE_INCLUDES ".dti"               // 编译映像时包含的头文件清单
+
+namespace DrTcc
+{
+    // 128位散列，两个独立的64位散列拼成
+    class Hasher
+    {
+        public:
+            void Feed(const void *p, size_t n);
+
+            // 带上长度，避免拼接产生歧义
+            void Part(const void *p, size_t n);
+
+            template<class T>
+            void Value(const T &v)
+            { Feed(&v, sizeof(v)); }
+
+            std::string Hex() const;
+
+        private:
+            uint64_t h1_{14695981039346656037ULL};
+            uint64_t h2_{0x9E3779B97F4A7C15ULL};
+    };
+
+    // 按内容寻址的编译缓存: <目录>/<键>.dtc 存放字节码映像
+    // 键由编译器版本、编译选项和源码内容散列得到，源码不变时跳过前端
+    // 包含头文件的源码另记一份头文件清单，映像的键再加上这些头文件的内容
+    // 写入先写临时文件再原子改名，超过上限时按最近使用时间淘汰
+    class Cache
+    {
+        public:
+            explicit Cache(std::string dir, uint64_t limit = CACHE_LIMIT);
+
+            ~Cache() = default;
+
+            // options: 影响生成代码的编译选项
+            static std::string Key(StringView source, const std::string &options);
+
+            // 源文件对应的函数级缓存的键
+            static std::string FuncKey(const std::string &input);
+
+            std::string Path(const std::string &key, const char *ext = CACHE_IMAGE) const;
+
+            // 命中时返回映像路径并更新其使用时间，否则返回空串
+            std::string Find(const std::string &key);
+
+            // 写入缓存文件，失败时不影响编译运行
+            bool Store(const std::string &key, const std::function<void(std::ostream &)> &write,
+                       const char *ext = CACHE_IMAGE);
+
+            // 按源码的键查找映像: 先读头文件清单，再用清单中头文件的当前内容算出映像的键
+            std::string FindImage(const std::string &key);
+
+            // 写入映像和它的头文件清单，includes为编译时实际包含的文件
+            bool StoreImage(const std::string &key, const std::vector<std::string> &includes,
+                            const std::function<void(std::ostream &)> &write);
+
+            uint64_t Hits() const
+            { return hits_; }
+
+            uint64_t Misses() const
+            { return misses_; }
+
+        private:
+            // 映像的键，有头文件无法读取时返回空串
+            static std::string ImageKey(const std::string &key, const std::vector<std::string> &includes);
+
+            void Evict();
+
+        private:
+            std::string dir_;
+            uint64_t limit_;
+            uint64_t hits_{0};
+            uint64_t misses_{0};
+    };
+
+    // 一个函数未优化的字节码，地址均相对于函数自身
+    struct FuncCode
+    {
+        std::vector<int> text;
+        std::vector<char> data;                         // 字符串常量
+        std::vector<std::pair<int, std::string>> calls; // <CALL操作数地址, 函数名>
+        std::vector<int> strings;                       // 字符串地址操作数的位置
+    };
+
+    // 函数级增量编译缓存: 函数指纹 -> 字节码
+    // 指纹由函数体和它引用的全局符号得到，编辑一个函数时其余函数直接复用
+    class FuncCache
+    {
+        public:
+            FuncCache() = default;
+
+            ~FuncCache() = default;
+
+            // 编译器版本不同或文件损坏时视为空
+            bool Load(StringView view);
+
+            // 只写入本次编译用到的函数
+            void Write(std::ostream &os) const;
+
+            // 生成代码时并行查找，只读
+            const FuncCode *Find(const std::string &fingerprint) const;
+
+            // 记录本次编译的函数，hit表示复用了缓存
+            void Keep(const std::string &fingerprint, FuncCode code, bool hit);
+
+            uint64_t Hits() const
+            { return hits_; }
+
+            uint64_t Misses() const
+            { return misses_; }
+
+        private:
+            std::unordered_map<std::string, FuncCode> old_;
+            std::unordered_map<std::string, FuncCode> new_;
+            uint64_t hits_{0};
+            uint64_t misses_{0};
+    };
+}
+
+#endif //DRTCC_CACHE_H
@@ -3,8 +3,13 @@
 //
 
 #include "GenCode.h"
+#include "Optimizer.h"
+#include <thread>
+#include <atomic>
 
 #define GEN_DEBUG 0
+#define GEN_OPT 1
+#define GEN_FUNCS_PER_THREAD 32     // 每个线程至少分到的函数个数，函数少时不开线程
 
 namespace DrTcc
 {
@@ -17,7 +22,8 @@ namespace DrTcc
     }
 
 
-    GenCode::GenCode(AstNode *node) : root_(node)
+    GenCode::GenCode(const AstTree &tree, const Profile *profile, bool tier, bool object, FuncCache *funcs)
+            : tree_(tree), profile_(profile), tier_(tier || object), object_(object), funcs_(funcs)
     {
         MakeBuiltin();
         Gen();
@@ -25,7 +31,6 @@ namespace DrTcc
 
     void GenCode::MakeBuiltin()
     {
-        symbols_.emplace_back();
         BuiltinAdd("printf", PRTF);
         BuiltinAdd("memcmp", MCMP);
         BuiltinAdd("exit", EXIT);
@@ -36,34 +41,287 @@ namespace DrTcc
         BuiltinAdd("malloc", MALC);
         BuiltinAdd("trace", TRAC);
         BuiltinAdd("trans", TRAN);
+
+        // 按名称查一次，之后只用编号访问
+        symbols_.resize((size_t) tree_.Names(), SymbolType{AstNil, ClzNotFound, 0, -1, 0, 0});
+        for (auto id = 0; id < tree_.Names(); ++id)
+        {
+            auto f = builtins_.find(tree_.Name(id));
+            if (f != builtins_.end())
+            { symbols_[id] = f->second; }
+        }
     }
 
     void GenCode::BuiltinAdd(const std::string &name, Instrucitons ins)
     {
         SymbolType sym;
-        sym.node = nullptr;
+        sym.node = AstNil;
         sym.clazz = ClzBuiltin;
         sym.data = ins;
+        sym.level = 0;
+        sym.fixed = 1;
+        sym.order = -1;
         builtins_.insert(std::make_pair(name, sym));
     }
 
     void GenCode::Gen()
     {
-        GenRec(root_);
+        // 1. 按顺序登记全局声明，函数只登记符号，入口待定
+        std::vector<FuncDef> funcs;
+        std::vector<char> defined(symbols_.size(), 0);
+        for (auto i = tree_.Child(tree_.Root()); i != AstNil && i != tree_.End(tree_.Root()); i = tree_.Next(i))
+        {
+            Declare(i, funcs, defined);
+            order_++;
+        }
+
+        // 2. 各函数互不依赖，分别生成到自己的缓冲区
+        std::vector<Piece> pieces(funcs.size());
+        GenFuncs(funcs, pieces);
+
+        // 3. 按源码顺序拼接，修正地址
+        Concat(funcs, pieces);
+        ResolveCalls();
+        Optimize();
     }
 
-    template<typename T>
-    static void AstRecursion(AstNode *node, T func)
+    void GenCode::Declare(AstIndex node, std::vector<FuncDef> &funcs, std::vector<char> &defined)
     {
-        if (node == nullptr)
-        { return; }
+        if ((AstNodeType) tree_[node].flag != AstNodeType::AstFunc)
+        {   // 枚举和全局变量不生成代码
+            GenRec(node);
+            return;
+        }
+
+        auto _node = tree_.Next(tree_.Child(node));    // identifier
+        auto id = tree_[_node].data._id.id;
+        const auto &proto = symbols_[id];
+        if (!(Visible(proto) && proto.clazz == ClzFunc && proto.level == 0))
+        { AddSymbol(_node, ClzFunc, -1); }
+        if (tree_.ChildrenSize(node) > 3)
+        {   // 有函数体，重复定义时仍生成代码，入口取第一个
+            funcs.push_back(FuncDef{node, order_, id, !defined[id] && symbols_[id].clazz == ClzFunc});
+            defined[id] = 1;
+        }
+    }
+
+    void GenCode::GenFuncs(const std::vector<FuncDef> &funcs, std::vector<Piece> &pieces) const
+    {
+        auto threads = std::min<size_t>(std::max(1U, std::thread::hardware_concurrency()),
+                                        funcs.size() / GEN_FUNCS_PER_THREAD);
+        threads = std::max<size_t>(threads, 1);
+#if GEN_DEBUG
+        threads = 1;    // 调试输出保持源码顺序
+#endif
+
+        // 每个线程持有一份全局符号表的拷贝，函数生成结束时作用域已还原，可以接着生成下一个
+        // 有函数出错后不再领取新函数，序号更小的函数都已领取，会生成完毕
+        std::atomic<size_t> next{0};
+        std::atomic<bool> failed{false};
+        std::vector<std::exception_ptr> errors(funcs.size() + 1);      // 末项为不属于任何函数的错误
+        auto work = [&]() {
+            auto i = funcs.size();
+            try
+            {
+                GenCode worker(*this);
+                while(!failed && (i = next++) < funcs.size())
+                {
+                    worker.error_ = &pieces[i].error;
+                    worker.GenFunc(funcs[i], pieces[i]);
+                }
+            }
+            catch (...)
+            {
+                errors[std::min(i, funcs.size())] = std::current_exception();
+                failed = true;
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (size_t k = 1; k < threads; k++)
+        { workers.emplace_back(work); }
+        work();
+        for (auto &w : workers)
+        { w.join(); }
+
+        // 报告源码中最靠前的错误，与线程调度无关
+        for (size_t i = 0; i < errors.size(); ++i)
+        {
+            if (errors[i])
+            {
+                if (i < pieces.size())
+                { printf("%s", pieces[i].error.c_str()); }
+                std::rethrow_exception(errors[i]);
+            }
+        }
+    }
 
-        auto i = node;
-        do
+    void GenCode::GenFunc(const FuncDef &func, Piece &piece)
+    {
+        order_ = func.order;
+        if (funcs_ != nullptr)
         {
-            func(i);
-            i = i->next;
-        } while(i != node);
+            piece.fingerprint = Fingerprint(func);
+            piece.cached = funcs_->Find(piece.fingerprint);
+            if (piece.cached != nullptr)
+            { return; }
+        }
+        text_.clear();
+        data_.clear();
+        calls_.clear();
+        strings_.clear();
+        GenRec(func.node);
+        piece.text.swap(text_);
+        piece.data.swap(data_);
+        piece.calls.swap(calls_);
+        piece.strings.swap(strings_);
+    }
+
+    std::string GenCode::Fingerprint(const FuncDef &func) const
+    {
+        // 生成的代码只取决于函数的子树和其中引用的全局符号
+        // 名称按内容计入，全局符号计入此处可见的类别、地址(值)和类型
+        Hasher h;
+        for (auto i = func.node; i != tree_.End(func.node); ++i)
+        {
+            const auto &n = tree_[i];
+            auto type = (AstNodeType) n.flag;
+            uint32_t shape[] = {n.flag, n.size};
+            h.Value(shape);
+            if (type == AstNodeType::AstString)
+            { h.Part(n.data._string, strlen(n.data._string)); }
+            else if (type == AstNodeType::AstId || type == AstNodeType::AstInvoke)
+            {
+                h.Part(n.data._id.name, strlen(n.data._id.name));
+                const auto &sym = symbols_[n.data._id.id];
+                if (!Visible(sym))
+                {
+                    h.Value(ClzNotFound);
+                    continue;
+                }
+                h.Value(sym.clazz);
+                h.Value(sym.data);
+                h.Value(sym.level);
+                h.Value(sym.fixed);
+                if (sym.clazz == ClzVarGlobal || sym.clazz == ClzFunc)
+                {
+                    const auto &t = TypeNode(sym.node).data._type;
+                    h.Value(t.type);
+                    h.Value(t.ptr);
+                }
+            }
+            else
+            { h.Value(n.data); }
+        }
+        return h.Hex();
+    }
+
+    void GenCode::Concat(const std::vector<FuncDef> &funcs, std::vector<Piece> &pieces)
+    {
+        // 缓存中的调用点按函数名记录
+        std::unordered_map<std::string, int> ids;
+        if (funcs_ != nullptr)
+        {
+            for (auto id = 0; id < tree_.Names(); ++id)
+            { ids[tree_.Name(id)] = id; }
+        }
+
+        for (size_t i = 0; i < pieces.size(); ++i)
+        {
+            auto &piece = pieces[i];
+            if (funcs_ != nullptr)
+            {
+                FuncCode code;
+                if (piece.cached != nullptr)
+                {
+                    code = *piece.cached;
+                    piece.text = code.text;
+                    piece.data = code.data;
+                    piece.strings = code.strings;
+                    for (const auto &c : code.calls)
+                    { piece.calls.emplace_back(c.first, ids[c.second]); }
+                }
+                else
+                {
+                    code.text = piece.text;
+                    code.data = piece.data;
+                    code.strings = piece.strings;
+                    for (const auto &c : piece.calls)
+                    { code.calls.emplace_back(c.first, tree_.Name(c.second)); }
+                }
+                funcs_->Keep(piece.fingerprint, std::move(code), piece.cached != nullptr);
+            }
+            auto textBase = Index();
+            while(data_.size() % 4 != 0)
+            { data_.push_back(0); }
+            auto dataBase = (int) data_.size();
+
+            // 函数内的跳转目标和字符串地址加上基址，调用点留给ResolveCalls
+            for (size_t k = 0; k < piece.text.size(); k += Optimizer::InsLength(piece.text[k]))
+            {
+                auto op = piece.text[k];
+                if (op == JMP || op == JZ || op == JNZ)
+                { piece.text[k + 1] += textBase; }
+            }
+            for (auto s : piece.strings)
+            { piece.text[s] += dataBase; }
+            for (const auto &c : piece.calls)
+            { calls_.emplace_back(textBase + c.first, c.second); }
+            if (funcs[i].entry)
+            { symbols_[funcs[i].id].data = textBase; }
+
+            text_.insert(text_.end(), piece.text.begin(), piece.text.end());
+            data_.insert(data_.end(), piece.data.begin(), piece.data.end());
+            piece = Piece();
+        }
+    }
+
+    void GenCode::ResolveCalls()
+    {
+        for (const auto &c : calls_)
+        {
+            const auto &sym = symbols_[c.second];
+            if (sym.data >= 0)
+            { text_[c.first] = sym.data; }
+            else if (object_)
+            { imports_.emplace_back(c.first, tree_.Name(c.second)); }      // 由链接器修正
+            else
+            {
+                printf("undefined function: \"%s\"\n", tree_.Name(c.second));
+                throw std::exception();
+            }
+        }
+    }
+
+    void GenCode::Optimize()
+    {
+        Optimizer opt(text_, profile_);
+        for (auto id = 0; id < (int) symbols_.size(); ++id)
+        {
+            if (symbols_[id].clazz == ClzFunc && symbols_[id].data >= 0)
+            { opt.AddFunc(symbols_[id].data, profile_ != nullptr ? profile_->Func(tree_.Name(id)) : nullptr); }
+        }
+        opt.Number();
+#if GEN_OPT
+        if (!tier_)
+        { opt.Optimize(); }
+#endif
+        sites_ = opt.Sites();
+
+        // 函数地址随优化后的text段重定位
+        for (auto &sym : symbols_)
+        {
+            if (sym.clazz == ClzFunc && sym.data >= 0)
+            { sym.data = opt.Relocate(sym.data); }
+        }
+    }
+
+    // 依次访问node的儿子，儿子在数组中连续存放
+    template<typename T>
+    static void AstRecursion(const AstTree &tree, AstIndex node, T func)
+    {
+        for (auto i = tree.Child(node); i != AstNil && i != tree.End(node); i = tree.Next(i))
+        { func(i); }
     }
 
     static int SizeType(TokenType type)
@@ -105,16 +363,16 @@ namespace DrTcc
         return (n | 3) + 1;
     }
 
-    static int SizeId(AstNode *node)
+    static int SizeId(const AstCompact &type)
     {
         auto i = 0;
-        if (node->prev->data._type.ptr > 0)
+        if (type.data._type.ptr > 0)
         {
             i = BaseType<TokenType::Ptr>::size;
         }
         else
         {
-            return SizeType(node->prev->data._type.type);
+            return SizeType(type.data._type.type);
         }
         return i;
     }
@@ -132,12 +390,12 @@ namespace DrTcc
 
 #if GEN_DEBUG
 
-    static std::string TypeStr(AstNode *node)
+    static std::string TypeStr(const AstCompact &type)
     {
         static Token tk;
         std::stringstream ss;
-        ss << tk.LexerTypeStr(node->prev->data._type.type);
-        auto n = node->prev->data._type.ptr;
+        ss << tk.LexerTypeStr(type.data._type.type);
+        auto n = type.data._type.ptr;
         for (int i = 0; i < n; ++i)
         {
             ss << '*';
@@ -149,146 +407,147 @@ namespace DrTcc
 #endif
 
 
-    void GenCode::GenRec(AstNode *node)
+    void GenCode::GenRec(AstIndex node)
     {
-        if (node == nullptr)
+        if (node == AstNil)
         { return; }
 
         auto recFunc = [&](auto n) { this->GenRec(n); };
-        auto type = (AstNodeType) node->flag;
+        const auto &data = tree_[node].data;
+        auto type = (AstNodeType) tree_[node].flag;
 
-//        printf("AstNodeType [%d] : %s\n", node->flag, tok_.AstNodeStr(node->flag).c_str());
+//        printf("AstNodeType [%d] : %s\n", tree_[node].flag, tok_.AstNodeStr(tree_[node].flag).c_str());
         switch (type)
         {
             case AstNodeType::AstRoot:                  // 根结点，全局声明
-                AstRecursion(node->child, recFunc);
+                AstRecursion(tree_, node, recFunc);
                 break;
             case AstNodeType::AstEnum:
-                AstRecursion(node->child, recFunc);
+                AstRecursion(tree_, node, recFunc);
                 break;
             case AstNodeType::AstEnumUnit:
-                AddSymbol(node->child, ClzEnum, node->child->next->data._int);
+                AddSymbol(tree_.Child(node), ClzEnum, tree_[tree_.Next(tree_.Child(node))].data._int);
                 break;
             case AstNodeType::AstVarGlobal:
-                AddSymbol(node->child->next, ClzVarGlobal, 0);
+                AddSymbol(tree_.Next(tree_.Child(node)), ClzVarGlobal, 0);
                 break;
             case AstNodeType::AstVarParam:
-                AddSymbol(node->child->next, ClzVarParam, 0);
+                AddSymbol(tree_.Next(tree_.Child(node)), ClzVarParam, 0);
                 break;
             case AstNodeType::AstVarLocal:
-                AddSymbol(node->child->next, ClzVarLocal, 0);
+                AddSymbol(tree_.Next(tree_.Child(node)), ClzVarLocal, 0);
                 break;
             case AstNodeType::AstFunc:
             {
-                printf("---Gen Function %s---\n", node->child->next->data._string);
-                auto _node = node->child;        // return Type
-                _node = _node->next;             // identifier
-                AddSymbol(node->child->next, ClzFunc, Index());
-                symbols_.emplace_back();
+                // 函数符号已由Declare登记，这里只生成函数体
+                auto _node = tree_.Child(node);  // return Type
+                _node = tree_.Next(_node);       // identifier
+                EnterScope();
 #if GEN_DEBUG
-                auto id = _node->data._string;
+                printf("---Gen Function %s---\n", tree_[_node].data._string);
+                auto id = tree_[_node].data._string;
                 printf("[DEBUG] Func::enter(\"%s\")\n", id);
 #endif
                 ebp_ = 0;
-                _node = _node->next;             // param
+                _node = tree_.Next(_node);             // param
                 recFunc(_node);
                 ebp_ += 4;
                 ebpLocal_ = ebp_;
-                _node = _node->next;             // block
+                _node = tree_.Next(_node);             // block
                 recFunc(_node);
 #if GEN_DEBUG
                 printf("[DEBUG] Func::leave(\"%s\")\n", id);
 #endif
                 Emit(LEV);
-                symbols_.pop_back();
+                LeaveScope();
             }
                 break;
             case AstNodeType::AstParam:
-                AstRecursion(node->child, recFunc);
+                AstRecursion(tree_, node, recFunc);
                 break;
             case AstNodeType::AstBlock:
-                symbols_.emplace_back();
+                EnterScope();
 #if GEN_DEBUG
                 printf("[DEBUG] Block::enter\n");
 #endif
 
-                AstRecursion(node->child, recFunc);
+                AstRecursion(tree_, node, recFunc);
 
 #if GEN_DEBUG
                 printf("[DEBUG] Block::leave\n");
 #endif
-                symbols_.pop_back();
+                LeaveScope();
                 break;
             case AstNodeType::AstStmt:
-                AstRecursion(node->child, recFunc);
+                AstRecursion(tree_, node, recFunc);
                 break;
             case AstNodeType::AstReturn:
 #if GEN_DEBUG
                 printf("[DEBUG] Func::return\n");
 #endif
-                if (node->child != nullptr)
+                if (tree_.Child(node) != AstNil)
                 {
-                    recFunc(node->child);
+                    recFunc(tree_.Child(node));
                 }
                 Emit(LEV);
                 break;
             case AstNodeType::AstExp:
-                recFunc(node->child);
+                recFunc(tree_.Child(node));
                 break;
             case AstNodeType::AstExpParam:
-                recFunc(node->child);
+                recFunc(tree_.Child(node));
                 Emit(PUSH);
                 break;
             case AstNodeType::AstSinOp:
-                if (node->data._op.data == 0)           // 前置
+                if (data._op.data == 0)           // 前置
                 {
-                    switch (node->data._op.op)
+                    switch (data._op.op)
                     {
                         case OperatorType::Add:
-                            recFunc(node->child);
+                            recFunc(tree_.Child(node));
                             break;
                         case OperatorType::Minus:
                             Emit(IMM, -1);
                             Emit(PUSH);
-                            recFunc(node->child);
+                            recFunc(tree_.Child(node));
                             Emit(MUL);
                             break;
                         case OperatorType::Inc:
                         case OperatorType::Dec:
                         {
-                            recFunc(node->child);                       // lvalue
+                            recFunc(tree_.Child(node));                       // lvalue
                             auto _expr = exprLevel_;
                             auto _ptr = ptrLevel_;
                             auto i = text_.back();
-                            Expect(ExpectLvalue, node->child);      // 验证左值
+                            Expect(ExpectLvalue, tree_.Child(node));      // 验证左值
                             EmitTop(PUSH);                          // 改载入指令为压栈指令，将左值地址压栈
                             Emit(i);                                    // 取出左值
                             Emit(PUSH);                             // 压入左值
                             Emit(IMM, SizeInc(_expr, _ptr));
-                            Emit(tok_.Op2Ins(node->data._op.op));
+                            Emit(tok_.Op2Ins(data._op.op));
                             Emits((Instrucitons) i);                        // 存储指令
                         }
                             break;
                         case OperatorType::LogicalNot:
-                            recFunc(node->child);           // lvalue
+                            recFunc(tree_.Child(node));           // lvalue
                             Emit(PUSH);
                             Emit(IMM, 0);
                             Emit(EQ);
                             break;
                         case OperatorType::BitNot:
-                            recFunc(node->child);            // lvalue
+                            recFunc(tree_.Child(node));            // lvalue
                             Emit(PUSH);
                             Emit(IMM, -1);
                             Emit(XOR);
                             break;
                         case OperatorType::BitAnd:          // 取地址
-                            recFunc(node->child);           // lvalue
-                            Expect(ExpectLvalue, node->child); // 验证左值
+                            recFunc(tree_.Child(node));           // lvalue
+                            Expect(ExpectLvalue, tree_.Child(node)); // 验证左值
                             EmitPop();              // 去掉一个读取指令
                             ptrLevel_++;
                             break;
                         case OperatorType::Mul:         // 解引用
-                            recFunc(node->child); // exp
+                            recFunc(tree_.Child(node)); // exp
                             EmitDeref();
                             if (ptrLevel_ > 0)
                             {
@@ -296,27 +555,26 @@ namespace DrTcc
                             }
                             break;
                         default:
-                            printf("ast_sinop::unsupported prefix op \"%s\"\n", tok_.OpStr(node->data._op.op).c_str());
-                            throw std::exception();
+                            Error("ast_sinop::unsupported prefix op \"" + tok_.OpStr(data._op.op) + "\"");
                     }
                 }
                 else                                    // 后置
                 {
-                    switch (node->data._op.op)
+                    switch (data._op.op)
                     {
                         case OperatorType::Inc:
                         case OperatorType::Dec:
                         {
-                            recFunc(node->child); // lvalue
+                            recFunc(tree_.Child(node)); // lvalue
                             auto _expr = exprLevel_;
                             auto _ptr = ptrLevel_;
                             auto i = text_.back();
-                            Expect(ExpectLvalue, node->child); // 验证左值
+                            Expect(ExpectLvalue, tree_.Child(node)); // 验证左值
                             EmitTop(PUSH); // 改载入指令为压栈指令，将左值地址压栈
                             Emit(i); // 取出左值
                             Emit(PUSH); // 压入左值
                             Emit(IMM, SizeInc(_expr, _ptr)); // 增量到ax
-                            auto ins = tok_.Op2Ins(node->data._op.op);
+                            auto ins = tok_.Op2Ins(data._op.op);
                             Emit(ins);
                             Emits((Instrucitons) i); // 存储指令，变量未修改
                             Emit(PUSH); // 压入当前值
@@ -325,24 +583,23 @@ namespace DrTcc
                         }
                             break;
                         default:
-                            printf("AstSinOp::unsupported postfix op \"%s\"\n", tok_.OpStr(node->data._op.op).c_str());
-                            throw std::exception();
+                            Error("AstSinOp::unsupported postfix op \"" + tok_.OpStr(data._op.op) + "\"");
                     }
                 }
                 break;
             case AstNodeType::AstBinOp:
             {
-                if (node->data._op.op == OperatorType::Lsquare)
+                if (data._op.op == OperatorType::Lsquare)
                 {
-                    recFunc(node->child); // exp
+                    recFunc(tree_.Child(node)); // exp
                     auto _expr = exprLevel_;
                     auto _ptr = ptrLevel_;
                     if (_ptr == 0)
                     {
-                        Expect(ExpectPointer, node->child);
+                        Expect(ExpectPointer, tree_.Child(node));
                     }
                     Emit(PUSH); // 压入数组地址
-                    recFunc(node->child->next); // index
+                    recFunc(tree_.Next(tree_.Child(node))); // index
                     auto n = SizeInc(_expr, _ptr);
                     if (n > 1)
                     {
@@ -362,7 +619,7 @@ namespace DrTcc
                 }
                 else
                 { // 二元运算
-                    switch (node->data._op.op)
+                    switch (data._op.op)
                     {
                         case OperatorType::Equal:
                         case OperatorType::Mul:
@@ -379,14 +636,14 @@ namespace DrTcc
                         case OperatorType::LeftShift:
                         case OperatorType::RightShift:
                         {
-                            recFunc(node->child); // exp1
+                            recFunc(tree_.Child(node)); // exp1
                             auto _expr = exprLevel_;
                             auto _ptr = ptrLevel_;
                             Emit(PUSH);
-                            recFunc(node->child->next); // exp2
+                            recFunc(tree_.Next(tree_.Child(node))); // exp2
                             auto _expr2 = exprLevel_;
                             auto _ptr2 = ptrLevel_;
-                            Emit(tok_.Op2Ins(node->data._op.op));
+                            Emit(tok_.Op2Ins(data._op.op));
                             // 后面会详细做静态分析
                             exprLevel_ = std::max(_expr, _expr2);
                             ptrLevel_ = std::max(_ptr, _ptr2);
@@ -395,9 +652,9 @@ namespace DrTcc
                         case OperatorType::LogicalAnd:
                         case OperatorType::LogicalOr:
                         {
-                            recFunc(node->child); // exp1
-                            auto a = EmitOp(tok_.Op2Ins(node->data._op.op)); // 短路优化
-                            recFunc(node->child->next); // exp2
+                            recFunc(tree_.Child(node)); // exp1
+                            auto a = EmitOp(tok_.Op2Ins(data._op.op)); // 短路优化
+                            recFunc(tree_.Next(tree_.Child(node))); // exp2
                             EmitOp(Index(), a); // a = exit
                             exprLevel_ = 4;
                             ptrLevel_ = 0;
@@ -405,13 +662,13 @@ namespace DrTcc
                             break;
                         case OperatorType::Assign:
                         {
-                            recFunc(node->child); // lvalue
+                            recFunc(tree_.Child(node)); // lvalue
                             auto _expr = exprLevel_;
                             auto _ptr = ptrLevel_; // 保存静态分析类型
                             auto i = text_.back();
-                            Expect(ExpectLvalue, node->child); // 验证左值
+                            Expect(ExpectLvalue, tree_.Child(node)); // 验证左值
                             EmitTop(PUSH); // 改载入指令为压栈指令，将左值地址压栈
-                            recFunc(node->child->next); // rvalue
+                            recFunc(tree_.Next(tree_.Child(node))); // rvalue
                             Emits((Instrucitons) i); // 存储指令
                             exprLevel_ = _expr;
                             ptrLevel_ = _ptr; // 还原静态分析类型
@@ -420,11 +677,11 @@ namespace DrTcc
                         case OperatorType::Add:
                         case OperatorType::Minus:
                         {
-                            recFunc(node->child); // exp1
+                            recFunc(tree_.Child(node)); // exp1
                             auto _expr = exprLevel_;
                             auto _ptr = ptrLevel_;
                             Emit(PUSH);
-                            recFunc(node->child->next); // exp2
+                            recFunc(tree_.Next(tree_.Child(node))); // exp2
                             auto _expr2 = exprLevel_;
                             auto _ptr2 = ptrLevel_;
                             if (_ptr > 0 && _ptr2 == 0)
@@ -437,7 +694,7 @@ namespace DrTcc
                                     Emit(MUL);
                                 }
                             }
-                            Emit(tok_.Op2Ins(node->data._op.op));
+                            Emit(tok_.Op2Ins(data._op.op));
                             exprLevel_ = std::max(_expr, _expr2);
                             ptrLevel_ = std::max(_ptr, _ptr2);
                         }
@@ -453,37 +710,36 @@ namespace DrTcc
                         case OperatorType::LeftShiftAssign:
                         case OperatorType::RightShiftAssign:
                         {
-                            recFunc(node->child); // lvalue
+                            recFunc(tree_.Child(node)); // lvalue
                             auto _expr = exprLevel_;
                             auto _ptr = ptrLevel_; // 保存静态分析类型
                             auto i = text_.back();
-                            Expect(ExpectLvalue, node->child); // 验证左值
+                            Expect(ExpectLvalue, tree_.Child(node)); // 验证左值
                             EmitTop(PUSH); // 改载入指令为压栈指令，将左值地址压栈
                             Emit(i); // 取出左值
                             Emit(PUSH);
-                            recFunc(node->child->next); // rvalue
-                            Emit(tok_.Op2Ins(node->data._op.op)); // 进行二元操作
+                            recFunc(tree_.Next(tree_.Child(node))); // rvalue
+                            Emit(tok_.Op2Ins(data._op.op)); // 进行二元操作
                             Emits((Instrucitons) i); // 存储指令
                             exprLevel_ = _expr;
                             ptrLevel_ = _ptr; // 还原静态分析类型
                         }
                             break;
                         default:
-                            printf("ast_binop::unsupported op \"%s\"\n", tok_.OpStr(node->data._op.op).c_str());
-                            throw std::exception();
+                            Error("ast_binop::unsupported op \"" + tok_.OpStr(data._op.op) + "\"");
                     }
                 }
             }
                 break;
             case AstNodeType::AstTriOp:
-                if (node->data._op.op == OperatorType::Query)
+                if (data._op.op == OperatorType::Query)
                 {
-                    recFunc(node->child); // cond
+                    recFunc(tree_.Child(node)); // cond
                     auto a = EmitOp(JZ);
-                    recFunc(node->child->next); // true
+                    recFunc(tree_.Next(tree_.Child(node))); // true
                     auto b = EmitOp(JMP);
                     EmitOp(Index(), a);
-                    recFunc(node->child->prev); // false
+                    recFunc(tree_.Last(node)); // false
                     EmitOp(Index(), b);
                 }
                 break;
@@ -500,18 +756,18 @@ namespace DrTcc
                 //     <statement>      <statement>
                 // b:                   b:
                 //
-                recFunc(node->child); // if exp
-                if (node->child->next == node->child->prev)
+                recFunc(tree_.Child(node)); // if exp
+                if (tree_.ChildrenSize(node) == 2)
                 { // 没有else
                     auto b = EmitOp(JZ); // JZ b 条件不满足时跳转到出口
-                    recFunc(node->child->next); // if stmt
+                    recFunc(tree_.Next(tree_.Child(node))); // if stmt
                     EmitOp(Index(), b); // b = 出口
                 }
                 else
                 { // 有else
                     auto a = EmitOp(JZ); // JZ a 条件不满足时跳转到else块之前
-                    recFunc(node->child->next); // if stmt
-                    auto _else = node->child->prev;
+                    recFunc(tree_.Next(tree_.Child(node))); // if stmt
+                    auto _else = tree_.Last(node);
                     auto b = EmitOp(JMP); // b = true stmt，条件true时运行至此，到达出口
                     EmitOp(Index(), a); // JZ a 跳转至此，为else块之前
                     recFunc(_else); // else stmt
@@ -530,36 +786,39 @@ namespace DrTcc
                 // b:                     b:
                 //
                 auto a = Index(); // a = 循环起始
-                recFunc(node->child); // cond
+                recFunc(tree_.Child(node)); // cond
                 auto b = EmitOp(JZ); // JZ b
-                recFunc(node->child->next); // true stmt
+                recFunc(tree_.Next(tree_.Child(node))); // true stmt
                 Emit(JMP, a); // JMP a
                 EmitOp(Index(), b); // b = 出口
-                recFunc(node->child);
+                recFunc(tree_.Child(node));
             }
                 break;
             case AstNodeType::AstInvoke:
             {
-                printf("Gen Function Call: %s\n", node->data._string);
-                auto sym = FindSymbol(node->data._string);
+#if GEN_DEBUG
+                printf("Gen Function Call: %s\n", data._string);
+#endif
+                auto sym = FindSymbol(data._id.id);
 #if 0
-                printf("[DEBUG] Id::Invoke(\"%s\", %s)\n", node->data._string, ClassStr(sym.clazz).c_str());
+                printf("[DEBUG] Id::Invoke(\"%s\", %s)\n", data._string, ClassStr(sym.clazz).c_str());
 #endif
                 if (sym.clazz == ClzFunc)
                 { // 定义的函数
-                    AstRecursion(node->child, recFunc); // param
+                    AstRecursion(tree_, node, recFunc); // param
                     Emit(CALL, sym.data); // call func addr
+                    calls_.emplace_back(Index() - 1, data._id.id);     // 入口在拼接后修正
                 }
                 else if (sym.clazz == ClzBuiltin)
                 { // 内建函数
-                    AstRecursion(node->child, recFunc); // param
+                    AstRecursion(tree_, node, recFunc); // param
                     Emit((Instrucitons) sym.data); // builtin-inst
                 }
                 else
                 { // 非法
                     Expect(ExpectValidId, node);
                 }
-                auto n = AST::ChildrenSize(node); // param count
+                auto n = tree_.ChildrenSize(node); // param count
                 if (n > 0)
                 { // 清除参数
                     Emit(ADJ, n);
@@ -569,7 +828,7 @@ namespace DrTcc
 
             case AstNodeType::AstEmpty:
             {
-                if (node->data._int == 1)
+                if (data._int == 1)
                 {
 #if GEN_DEBUG
                     printf("[DEBUG] Func::----\n");
@@ -581,7 +840,7 @@ namespace DrTcc
 
             case AstNodeType::AstId:
             {
-                auto sym = FindSymbol(node->data._string);
+                auto sym = FindSymbol(data._id.id);
                 switch (sym.clazz)
                 {
                     case ClzEnum: // 枚举
@@ -589,7 +848,7 @@ namespace DrTcc
                         exprLevel_ = 4;
                         ptrLevel_ = 0;
 #if GEN_DEBUG
-                        printf("[DEBUG] Id::Enum(\"%s\", %s, IMM %d)\n", node->data._string,
+                        printf("[DEBUG] Id::Enum(\"%s\", %s, IMM %d)\n", data._string,
                                ClassStr(sym.clazz).c_str(), sym.data);
 #endif
                         break;
@@ -599,7 +858,7 @@ namespace DrTcc
                         Emitl(sym.node);
                         CalcLevel(sym.node); // 静态分析类型
 #if GEN_DEBUG
-                        printf("[DEBUG] Id::Global(\"%s\", %s, LOAD %d)\n", node->data._string,
+                        printf("[DEBUG] Id::Global(\"%s\", %s, LOAD %d)\n", data._string,
                                ClassStr(sym.clazz).c_str(), sym.data);
 #endif
                         break;
@@ -608,7 +867,7 @@ namespace DrTcc
                         Emitl(sym.node);
                         CalcLevel(sym.node); // 静态分析类型
 #if GEN_DEBUG
-                        printf("[DEBUG] Id::Param(\"%s\", %s, LEA %d)\n", node->data._string,
+                        printf("[DEBUG] Id::Param(\"%s\", %s, LEA %d)\n", data._string,
                                ClassStr(sym.clazz).c_str(), ebp_ - sym.data);
 #endif
                         break;
@@ -617,7 +876,7 @@ namespace DrTcc
                         Emitl(sym.node);
                         CalcLevel(sym.node); // 静态分析类型
 #if GEN_DEBUG
-                        printf("[DEBUG] Id::Local(\"%s\", %s, LEA %d)\n", node->data._string,
+                        printf("[DEBUG] Id::Local(\"%s\", %s, LEA %d)\n", data._string,
                                ClassStr(sym.clazz).c_str(), ebp_ - sym.data);
 #endif
                         break;
@@ -630,9 +889,9 @@ namespace DrTcc
             case AstNodeType::AstType:
                 break;
             case AstNodeType::AstCast:
-                recFunc(node->child);
-                exprLevel_ = SizeType(node->data._type.type); // 修正静态分析类型
-                ptrLevel_ = node->data._type.ptr;
+                recFunc(tree_.Child(node));
+                exprLevel_ = SizeType(data._type.type); // 修正静态分析类型
+                ptrLevel_ = data._type.ptr;
                 break;
             case AstNodeType::AstChar:
             case AstNodeType::AstUchar:
@@ -645,23 +904,24 @@ namespace DrTcc
             case AstNodeType::AstFloat:
             case AstNodeType::AstDouble:
             case AstNodeType::AstString:
-                Emit(node);
+                EmitConst(node);
                 break;
         }
 
     }
 
-    void GenCode::AddSymbol(AstNode *node, ClassT clazz, int addr)
+    void GenCode::AddSymbol(AstIndex node, ClassT clazz, int addr)
     {
+        const auto &data = tree_[node].data;
 
         Expect(ExpectNonConflictId, node);
-        SymbolType sym{.node = node, .clazz = clazz, .data = addr};
+        SymbolType sym{node, clazz, addr, Level(), 0, 0};
 
         switch (clazz)
         {
             case ClzEnum:
 #if GEN_DEBUG
-                printf("[DEBUG] Symbol::add(\"%s\", %s, %d)\n", node->data._string, ClassStr(clazz).c_str(), addr);
+                printf("[DEBUG] Symbol::add(\"%s\", %s, %d)\n", data._string, ClassStr(clazz).c_str(), addr);
 #endif
                 break;
             case ClzNumber:
@@ -671,7 +931,7 @@ namespace DrTcc
             case ClzVarGlobal:
             {
                 // 得到变量size
-                auto n = SizeId(node);
+                auto n = SizeId(TypeNode(node));
                 sym.data = (int) data_.size();
                 for (int i = 0; i < n; ++i)
                 {
@@ -679,7 +939,7 @@ namespace DrTcc
                 }
 
 #if GEN_DEBUG
-                printf("[DEBUG] Symbol::add(\"%s %s\", %s, %d)\n", TypeStr(node).c_str(), node->data._string,
+                printf("[DEBUG] Symbol::add(\"%s %s\", %s, %d)\n", TypeStr(TypeNode(node)).c_str(), data._string,
                        ClassStr(clazz).c_str(), addr);
                 printf("[DEBUG] Symbol::var_global(used: %d, now: %d)\n", n, data_.size());
 #endif
@@ -689,10 +949,10 @@ namespace DrTcc
             case ClzVarParam:           // 形参
             {
                 sym.data = ebp_;
-                auto n = Align4(SizeId(node));
+                auto n = Align4(SizeId(TypeNode(node)));
                 ebp_ += n;
 #if GEN_DEBUG
-                printf("[DEBUG] Symbol::add(\"%s %s\", %s, %d)\n", TypeStr(node).c_str(), node->data._string,
+                printf("[DEBUG] Symbol::add(\"%s %s\", %s, %d)\n", TypeStr(TypeNode(node)).c_str(), data._string,
                        ClassStr(clazz).c_str(), addr);
                 printf("[DEBUG] Symbol::var_param(used: %d, now: %d)\n", n, ebp_);
 #endif
@@ -700,11 +960,11 @@ namespace DrTcc
                 break;
             case ClzVarLocal:       // 局部变量 栈
             {
-                auto n = Align4(SizeId(node));
+                auto n = Align4(SizeId(TypeNode(node)));
                 ebpLocal_ += n;
                 sym.data = ebpLocal_;
 #if GEN_DEBUG
-                printf("[DEBUG] Symbol::add(\"%s %s\", %s, %d)\n", TypeStr(node).c_str(), node->data._string,
+                printf("[DEBUG] Symbol::add(\"%s %s\", %s, %d)\n", TypeStr(TypeNode(node)).c_str(), data._string,
                        ClassStr(clazz).c_str(), addr);
                 printf("[DEBUG] Symbol::var_local(used: %d, now: %d)\n", n, ebpLocal_);
 #endif
@@ -713,71 +973,93 @@ namespace DrTcc
             default:
                 break;
         }
-//        printf("-- Add Symbol-> %s--\n", node->data._string);
-        symbols_.back().insert(std::make_pair(node->data._string, sym));
+//        printf("-- Add Symbol-> %s--\n", data._string);
+        sym.order = order_;
+        auto &cur = symbols_[data._id.id];
+        auto visible = Visible(cur);
+        if (visible && cur.level == sym.level)
+        { return; }     // 同一作用域内重复声明，保留先前的符号
+
+        // 变量名允许覆盖，其他符号记入fixed供ConflictSymbol检查
+        auto fixed = clazz != ClzVarGlobal && clazz != ClzVarLocal;
+        sym.fixed = (visible ? cur.fixed : 0) + (fixed ? 1 : 0);
+        undo_.emplace_back(data._id.id, cur);
+        cur = sym;
+    }
+
+    void GenCode::EnterScope()
+    {
+        scopes_.push_back(undo_.size());
+    }
+
+    void GenCode::LeaveScope()
+    {
+        // 按相反顺序还原本层遮蔽的符号
+        while(undo_.size() > scopes_.back())
+        {
+            symbols_[undo_.back().first] = undo_.back().second;
+            undo_.pop_back();
+        }
+        scopes_.pop_back();
     }
 
-    void GenCode::Expect(ExpectType type, AstNode *node)
+    void GenCode::Expect(ExpectType type, AstIndex node)
     {
+        const auto &data = tree_[node].data;
         switch (type)
         {
             case ExpectNonConflictId:
-                if (ConflictSymbol(node->data._string))
-                {
-                    printf("duplicate id: \"%s\"\n", node->data._string);
-                    throw std::exception();
-                }
+                if (ConflictSymbol(data._id.id))
+                { Error("duplicate id: \"" + std::string(data._string) + "\""); }
                 break;
             case ExpectValidId:
-            {
-                printf("undefined id: \"%s\"\n", node->data._string);
-                throw std::exception();
-            }
+                Error("undefined id: \"" + std::string(data._string) + "\"");
             case ExpectLvalue:
                 if (text_.back() != LC && text_.back() != LI)
                 {
                     std::stringstream ss;
-                    AST::Print(node, 0, ss);
-                    printf("invalid lvalue: \"%s\"\n", ss.str().c_str());
-                    throw std::exception();
+                    tree_.Print(node, ss);
+                    Error("invalid lvalue: \"" + ss.str() + "\"");
                 }
                 break;
             case ExpectPointer:
             {
                 std::stringstream ss;
-                AST::Print(node, 0, ss);
-                printf("not a pointer: \"%s\"\n", ss.str().c_str());
-                throw std::exception();
+                tree_.Print(node, ss);
+                Error("not a pointer: \"" + ss.str() + "\"");
             }
         }
     }
 
-    bool GenCode::ConflictSymbol(const std::string &str)
+    void GenCode::Error(const std::string &info) const
+    {
+        if (error_ != nullptr)
+        { error_->append(info).append("\n"); }
+        else
+        { printf("%s\n", info.c_str()); }
+        throw std::exception();
+    }
+
+    bool GenCode::ConflictSymbol(int id)
     {
+        const auto &sym = symbols_[id];
         // 内建函数冲突
-        if (builtins_.find(str) != builtins_.end())
+        if (sym.clazz == ClzBuiltin)
         { return true; }
 
-        if (symbols_.back().find(str) != symbols_.back().end())
+        if (!Visible(sym))
+        { return false; }
+
+        if (sym.level == Level())
         {
+#if GEN_DEBUG
             printf("find\n");
+#endif
             return false;
         }
 
-        for (auto i = symbols_.rbegin() + 1; i != symbols_.rend(); i++)
-        {
-            auto f = i->find(str);
-            if (f != i->end())
-            {
-                // 允许变量名覆盖
-                if (f->second.clazz == ClzVarGlobal || f->second.clazz == ClzVarLocal)
-                { continue; }
-
-                return true;
-            }
-        }
-
-        return false;
+        // 外层有不允许覆盖的同名符号
+        return sym.fixed > 0;
     }
 
     void GenCode::Emit(GenCode::InsType ins)
@@ -814,42 +1096,43 @@ namespace DrTcc
         text_[index] = ins;
     }
 
-    void GenCode::Emit(AstNode *node)
+    void GenCode::EmitConst(AstIndex node)
     {
-        switch ((AstNodeType) node->flag)
+        const auto &data = tree_[node].data;
+        switch ((AstNodeType) tree_[node].flag)
         {
             case AstNodeType::AstChar:
-                Emit(IMM, (int) (node->data._char));
+                Emit(IMM, (int) (data._char));
                 exprLevel_ = BaseType<TokenType::Char>::size;
                 ptrLevel_ = 0;
                 break;
             case AstNodeType::AstUchar:
-                Emit(IMM, (int) (node->data._uchar));
+                Emit(IMM, (int) (data._uchar));
                 exprLevel_ = BaseType<TokenType::Uchar>::size;
                 ptrLevel_ = 0;
                 break;
             case AstNodeType::AstShort:
-                Emit(IMM, (int) (node->data._short));
+                Emit(IMM, (int) (data._short));
                 exprLevel_ = BaseType<TokenType::Short>::size;
                 ptrLevel_ = 0;
                 break;
             case AstNodeType::AstUshort:
-                Emit(IMM, (int) (node->data._ushort));
+                Emit(IMM, (int) (data._ushort));
                 exprLevel_ = BaseType<TokenType::Ushort>::size;
                 ptrLevel_ = 0;
                 break;
             case AstNodeType::AstInt:
-                Emit(IMM, (int) (node->data._int));
+                Emit(IMM, (int) (data._int));
                 exprLevel_ = BaseType<TokenType::Int>::size;
                 ptrLevel_ = 0;
                 break;
             case AstNodeType::AstUint:
-                Emit(IMM, (int) (node->data._uint));
+                Emit(IMM, (int) (data._uint));
                 exprLevel_ = BaseType<TokenType::Uint>::size;
                 ptrLevel_ = 0;
                 break;
             case AstNodeType::AstFloat:
-                Emit(IMM, (int) (node->data._float));
+                Emit(IMM, (int) (data._float));
                 exprLevel_ = BaseType<TokenType::Float>::size;
                 ptrLevel_ = 0;
                 break;
@@ -857,15 +1140,15 @@ namespace DrTcc
             case AstNodeType::AstUlong:
             case AstNodeType::AstDouble:
                 Emit(IMX); // 载入8字节
-                Emit(node->data._ins._1);
-                Emit(node->data._ins._2);
+                Emit(data._ins._1);
+                Emit(data._ins._2);
                 exprLevel_ = 8;
                 ptrLevel_ = 0;
                 break;
             case AstNodeType::AstString:
             {
                 auto addr = data_.size();
-                auto s = node->data._string;
+                auto s = data._string;
                 while(*s)
                 {
                     data_.push_back(*s++); // 拷贝字符串至data段
@@ -881,26 +1164,21 @@ namespace DrTcc
                     }
                 }
 #if GEN_DEBUG
-                printf("[DEBUG] Id::String(\"%s\", %d-%d)\n", AST::DisplayStr(node).c_str(), addr, data_.size() - 1);
+                printf("[DEBUG] Id::String(\"%s\", %d-%d)\n", AST::DisplayStr(data._string).c_str(), addr, data_.size() - 1);
 #endif
                 Emit(IMM, addr);
+                strings_.push_back(Index() - 1);    // 拼接时加上data段基址
                 Emit(LOAD); // 载入data段指令
                 exprLevel_ = 1;
                 ptrLevel_ = 1;
             }
                 break;
             default:
-                printf("Emit::unsupported type\n");
-                throw std::exception();
+                Error("Emit::unsupported type");
                 break;
         }
     }
 
-    void GenCode::Emit(AstNode *node, int ebp)
-    {
-        Emit(ebp - node->data._int);
-    }
-
     void GenCode::EmitDeref()
     {
         if (ptrLevel_ == 1)
@@ -914,8 +1192,7 @@ namespace DrTcc
                     Emit(LI);
                     break;
                 default:
-                    printf("emit_deref::unsupported type\n");
-                    throw std::exception();
+                    Error("emit_deref::unsupported type");
             }
         }
         else   // > 1 and ...
@@ -924,9 +1201,9 @@ namespace DrTcc
         }
     }
 
-    void GenCode::Emitl(AstNode *node)
+    void GenCode::Emitl(AstIndex node)
     {
-        auto n = SizeId(node);
+        auto n = SizeId(TypeNode(node));
         switch (n)
         {
             case 1:
@@ -957,30 +1234,32 @@ namespace DrTcc
         }
     }
 
-    SymbolType GenCode::FindSymbol(const std::string &str)
+    bool GenCode::Visible(const SymbolType &sym) const
     {
-        // 找内建函数
-        auto f = builtins_.find(str);
-        if (f != builtins_.end())
-        {
-            return f->second;
-        }
-        // 找符号表
-        for (auto i = symbols_.rbegin(); i != symbols_.rend(); i++)
-        {
-            f = i->find(str);
-            if (f != i->end())
-            {
-                return f->second;
-            }
-        }
-        return SymbolType{.node = nullptr, .clazz = ClzNotFound, .data = 0};
+        // 函数并行生成时全局符号已全部登记，按声明顺序过滤出此处可见的
+        return sym.clazz != ClzNotFound && !(sym.level == 0 && sym.order > order_);
+    }
+
+    SymbolType GenCode::FindSymbol(int id)
+    {
+        if (!Visible(symbols_[id]))
+        { return SymbolType{AstNil, ClzNotFound, 0, -1, 0, 0}; }
+        return symbols_[id];
+    }
+
+    const AstCompact &GenCode::TypeNode(AstIndex node) const
+    {
+        // 声明中类型结点是叶子，在先序数组里紧挨在标识符之前
+        const auto &type = tree_[node - 1];
+        assert(type.flag == static_cast<uint32_t>(AstNodeType::AstType));
+        return type;
     }
 
-    void GenCode::CalcLevel(AstNode *node)
+    void GenCode::CalcLevel(AstIndex node)
     {
-        ptrLevel_ = node->prev->data._type.ptr;
-        switch (node->prev->data._type.type)
+        const auto &type = TypeNode(node);
+        ptrLevel_ = type.data._type.ptr;
+        switch (type.data._type.type)
         {
             case TokenType::Char:
                 exprLevel_ = BaseType<TokenType::Char>::size;
@@ -1019,15 +1298,45 @@ namespace DrTcc
 
     }
 
-    void GenCode::Eval()
+    std::map<int, std::string> GenCode::Funcs() const
+    {
+        std::map<int, std::string> funcs;
+        for (auto id = 0; id < (int) symbols_.size(); ++id)
+        {
+            if (symbols_[id].clazz == ClzFunc && symbols_[id].data >= 0)
+            { funcs[symbols_[id].data] = tree_.Name(id); }
+        }
+        return funcs;
+    }
+
+    std::map<std::string, std::pair<int, int>> GenCode::Globals() const
+    {
+        std::map<std::string, std::pair<int, int>> globals;
+        for (auto id = 0; id < (int) symbols_.size(); ++id)
+        {
+            const auto &sym = symbols_[id];
+            if (sym.clazz == ClzVarGlobal && sym.level == 0)
+            { globals[tree_.Name(id)] = std::make_pair(sym.data, SizeId(TypeNode(sym.node))); }
+        }
+        return globals;
+    }
+
+    int GenCode::Entry() const
     {
         // find the main function that is start of execution.
-        auto entry = symbols_[0].find("main");
-        if (entry == symbols_[0].end())
+        for (auto id = 0; id < (int) symbols_.size(); ++id)
         {
-            printf("main() not defined\n");
-            throw std::exception();
+            const auto &sym = symbols_[id];
+            if (sym.level == 0 && sym.clazz != ClzNotFound && sym.clazz != ClzBuiltin && strcmp(tree_.Name(id), "main") == 0)
+            { return sym.data; }
         }
+        printf("main() not defined\n");
+        throw std::exception();
+    }
+
+    void GenCode::Eval(Profile *profile, const std::vector<std::string> &args)
+    {
+        auto entry = Entry();
 //        for (const auto& it : text_)
 //        {
 //            std::cout <<  it << " " ;
@@ -1039,6 +1348,47 @@ namespace DrTcc
 //        }
 //        std::cout << std::endl;
         VM vm(text_, data_);
-        vm.Exec(entry->second.data);
+        vm.Args(args);
+        vm.Profiling(profile != nullptr);
+        if (tier_)
+        {
+            std::vector<int> entries;
+            for (const auto &sym : symbols_)
+            {
+                if (sym.clazz == ClzFunc && sym.data >= 0)
+                { entries.push_back(sym.data); }
+            }
+            vm.Tiering(text_, entries);
+        }
+        if (vm.Exec(entry) != VmExit)
+        {
+            printf("%s\n", vm.Message().c_str());
+            throw std::exception();
+        }
+        if (profile == nullptr)
+        { return; }
+
+        // 按函数名和跳转点编号保存计数
+        auto funcs = Funcs();
+        const auto &counter = vm.Counters();
+        for (const auto &f : funcs)
+        { profile->Func(f.second).calls += counter[f.first].hits; }
+        for (const auto &s : sites_)
+        {
+            auto f = funcs.upper_bound(s.first);
+            if (f == funcs.begin())
+            { continue; }
+            auto &sites = profile->Func((--f)->second).sites;
+            if (sites.size() <= (size_t) s.second)
+            { sites.resize((size_t) s.second + 1, SiteCount{0, 0}); }
+            sites[s.second].hits += counter[s.first].hits;
+            sites[s.second].zero += counter[s.first].zero;
+        }
+        for (auto a = (int) NOP; a <= EXIT; ++a)
+        {
+            for (auto b = (int) NOP; b <= EXIT; ++b)
+            { profile->AddPair(a, b, vm.PairCount(a, b)); }
+        }
+        profile->SetTotal(profile->Total() + vm.Cycles());
     }
 }
\ No newline at end of file
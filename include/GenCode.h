@@ -10,6 +10,7 @@
 #include "MemoryPool.h"
 #include "AST.h"
 #include "VM.h"
+#include "Cache.h"
 
 namespace DrTcc
 {
@@ -29,29 +30,94 @@ namespace DrTcc
 
     struct SymbolType
     {
-        AstNode *node;
+        AstIndex node;      // 标识符结点，类型结点紧挨在它之前
         ClassT clazz;
         int data;
+        int level;          // 所在作用域的层数，全局为0
+        int fixed;          // 可见的和被遮蔽的同名符号中，不允许覆盖的个数
+        int order;          // 全局符号所在声明的序号，只对其后的声明可见
     };
 
     class GenCode
     {
+            using TextType = BaseType<TokenType::Int>::type;
+            using DataType = BaseType<TokenType::Char>::type;
         public:
-            explicit GenCode(AstNode *node);
+            // tier为true时不在编译期优化，运行时由VM分层优化热点函数
+            // object为true时生成可重定位的未优化字节码，只有原型的函数留给链接器解析
+            // funcs不为空时复用指纹未变的函数的字节码，并记下本次生成的函数
+            explicit GenCode(const AstTree &tree, const Profile *profile = nullptr, bool tier = false,
+                             bool object = false, FuncCache *funcs = nullptr);
 
             ~GenCode() = default;
 
-            void Eval();
+            // profile不为空时以剖析模式运行，结束后写入执行计数；args为main的参数
+            void Eval(Profile *profile = nullptr, const std::vector<std::string> &args = std::vector<std::string>());
+
+            const std::vector<TextType> &Text() const
+            { return text_; }
+
+            const std::vector<DataType> &Data() const
+            { return data_; }
+
+            // 函数入口 -> 函数名
+            std::map<int, std::string> Funcs() const;
+
+            // main函数的入口
+            int Entry() const;
+
+            // 全局变量: 名称 -> <data段偏移, 大小>
+            std::map<std::string, std::pair<int, int>> Globals() const;
+
+            // 未定义函数的调用点: <CALL操作数地址, 函数名>，仅object模式
+            const std::vector<std::pair<int, std::string>> &Imports() const
+            { return imports_; }
 
         private:
             using InsType = BaseType<TokenType::Int>::type;
             using OpType = BaseType<TokenType::Int>::type;
-            using TextType = BaseType<TokenType::Int>::type;
-            using DataType = BaseType<TokenType::Char>::type;
+
+            // 函数定义，第二阶段各自生成
+            struct FuncDef
+            {
+                AstIndex node;
+                int order;          // 在全局声明中的序号
+                int id;             // 函数名的标识符编号
+                bool entry;         // 是否为函数的入口，重复定义时只有第一个是
+            };
+
+            // 一个函数生成的字节码，地址均相对于自身
+            struct Piece
+            {
+                std::vector<TextType> text;
+                std::vector<DataType> data;                 // 字符串常量
+                std::vector<std::pair<int, int>> calls;     // <CALL操作数地址, 标识符编号>
+                std::vector<int> strings;                   // 字符串地址操作数的位置
+                std::string fingerprint;                    // 仅在使用函数缓存时计算
+                const FuncCode *cached{nullptr};            // 命中缓存时不生成，拼接时直接取用
+                std::string error;                          // 生成失败时的错误信息
+            };
 
             void Gen();
 
-            void GenRec(AstNode *node);
+            void Declare(AstIndex node, std::vector<FuncDef> &funcs, std::vector<char> &defined);
+
+            void GenFuncs(const std::vector<FuncDef> &funcs, std::vector<Piece> &pieces) const;
+
+            void GenFunc(const FuncDef &func, Piece &piece);
+
+            std::string Fingerprint(const FuncDef &func) const;
+
+            void Concat(const std::vector<FuncDef> &funcs, std::vector<Piece> &pieces);
+
+            void ResolveCalls();
+
+            void Optimize();
+
+            void GenRec(AstIndex node);
+
+            // 输出错误并抛出异常，生成函数时先记在error_中，由GenFuncs按源码顺序输出
+            [[noreturn]] void Error(const std::string &info) const;
 
             void Emit(InsType ins);
 
@@ -65,28 +131,37 @@ namespace DrTcc
 
             void EmitOp(InsType ins, int index);
 
-            void Emit(AstNode *node);
-
-            void Emit(AstNode *node, int ebp);
+            void EmitConst(AstIndex node);
 
             void EmitDeref();
 
-            void Emitl(AstNode *node);
+            void Emitl(AstIndex node);
 
             void Emits(Instrucitons ins);
 
             int Index() const
             { return text_.size(); }
 
-            void Expect(ExpectType type, AstNode *node);
+            void Expect(ExpectType type, AstIndex node);
+
+            bool Visible(const SymbolType &sym) const;
+
+            SymbolType FindSymbol(int id);
+
+            bool ConflictSymbol(int id);
+
+            void EnterScope();
+
+            void LeaveScope();
 
-            SymbolType FindSymbol(const std::string &str);
+            int Level() const
+            { return (int) scopes_.size(); }
 
-            bool ConflictSymbol(const std::string &str);
+            void AddSymbol(AstIndex node, ClassT clazz, int addr);
 
-            void AddSymbol(AstNode *node, ClassT clazz, int addr);
+            void CalcLevel(AstIndex node);
 
-            void CalcLevel(AstNode *node);
+            const AstCompact &TypeNode(AstIndex node) const;
 
             void MakeBuiltin();
 
@@ -94,17 +169,30 @@ namespace DrTcc
 
         private:
 
-            AstNode *root_;
+            const AstTree &tree_;
+            const Profile *profile_;
+            std::unordered_map<int, int> sites_;      // 跳转点: 地址 -> 函数内编号
+            bool tier_;
+            bool object_;
+            FuncCache *funcs_;
             Token tok_;
             int ebp_{0};
             int ebpLocal_{0};
             int exprLevel_{0};
             int ptrLevel_{0};
+            int order_{0};                                    // 正在处理的全局声明的序号
+            std::string *error_{nullptr};                     // 生成函数时的错误信息
 
             std::vector<TextType> text_;
             std::vector<DataType> data_;
-            std::vector<std::unordered_map<std::string, SymbolType>> symbols_;
+            // 扁平符号表: 标识符编号 -> 当前可见的符号，内建函数预先填入
+            std::vector<SymbolType> symbols_;
+            std::vector<std::pair<int, SymbolType>> undo_;    // 被遮蔽的符号，离开作用域时还原
+            std::vector<size_t> scopes_;                      // 进入各层作用域时undo_的大小
             std::unordered_map<std::string, SymbolType> builtins_;
+            std::vector<std::pair<int, int>> calls_;          // 函数调用点: <CALL操作数地址, 标识符编号>
+            std::vector<int> strings_;                        // 字符串地址操作数的位置
+            std::vector<std::pair<int, std::string>> imports_;
 
     };
 
@@ -0,0 +1,132 @@
+//
+// Created by yw.
+//
+
+#include "Image.h"
+
+namespace DrTcc
+{
+    static uint32_t AlignUp(uint32_t n, uint32_t align)
+    {
+        return (n + align - 1) / align * align;
+    }
+
+    template<class T>
+    static void WriteArray(std::ostream &os, const T *p, size_t n)
+    {
+        if (n > 0)
+        { os.write((const char *) p, (std::streamsize) (n * sizeof(T))); }
+    }
+
+    static void Pad(std::ostream &os, uint32_t from, uint32_t to)
+    {
+        static const char zero[IMAGE_ALIGN] = {0};
+        os.write(zero, to - from);
+    }
+
+    void Image::Write(std::ostream &os, const std::vector<TextType> &text, const std::vector<DataType> &data,
+                      const std::map<int, std::string> &funcs, int entry, uint32_t flags,
+                      const std::vector<ImageLine> &lines)
+    {
+        std::vector<ImageFunc> table;
+        std::string names;
+        for (const auto &f : funcs)
+        {
+            table.push_back(ImageFunc{f.first, (uint32_t) names.size()});
+            names += f.second;
+            names += '\0';
+        }
+
+        ImageHeader header{};
+        header.magic = IMAGE_MAGIC;
+        header.version = IMAGE_VERSION;
+        header.flags = flags;
+        header.entry = entry;
+        header.funcs = sizeof(ImageHeader);
+        header.funcCount = (uint32_t) table.size();
+        header.lines = header.funcs + header.funcCount * sizeof(ImageFunc);
+        header.lineCount = (uint32_t) lines.size();
+        header.names = header.lines + header.lineCount * sizeof(ImageLine);
+        header.namesSize = (uint32_t) names.size();
+        header.text = AlignUp(header.names + header.namesSize, IMAGE_ALIGN);
+        header.textSize = (uint32_t) text.size();
+        header.data = header.text + header.textSize * sizeof(TextType);
+        header.dataSize = (uint32_t) data.size();
+
+        WriteArray(os, &header, 1);
+        WriteArray(os, table.data(), table.size());
+        WriteArray(os, lines.data(), lines.size());
+        WriteArray(os, names.data(), names.size());
+        Pad(os, header.names + header.namesSize, header.text);
+        WriteArray(os, text.data(), text.size());
+        WriteArray(os, data.data(), data.size());
+    }
+
+    bool Image::Is(StringView view)
+    {
+        uint32_t magic = 0;
+        if (view.length() < sizeof(magic))
+        { return false; }
+
+        memcpy(&magic, view.data, sizeof(magic));
+        return magic == IMAGE_MAGIC;
+    }
+
+    bool Image::Load(StringView view)
+    {
+        auto size = (uint64_t) view.length();
+        auto fail = [](const char *why) {
+            printf("invalid image: %s\n", why);
+            return false;
+        };
+        // 段[offset, offset + count * unit)必须在映像内
+        auto inside = [&](uint32_t offset, uint32_t count, size_t unit) {
+            return (uint64_t) offset + (uint64_t) count * unit <= size;
+        };
+
+        if (!Is(view) || size < sizeof(ImageHeader))
+        { return fail("bad magic"); }
+        if (((uintptr_t) view.data & (alignof(ImageHeader) - 1)) != 0)
+        { return fail("misaligned"); }
+
+        auto header = (const ImageHeader *) view.data;
+        if (header->version != IMAGE_VERSION)
+        { return fail("unsupported version"); }
+        if (!inside(header->text, header->textSize, sizeof(TextType)) ||
+            !inside(header->data, header->dataSize, sizeof(DataType)) ||
+            !inside(header->funcs, header->funcCount, sizeof(ImageFunc)) ||
+            !inside(header->lines, header->lineCount, sizeof(ImageLine)) ||
+            !inside(header->names, header->namesSize, 1))
+        { return fail("truncated"); }
+        if (header->text % sizeof(TextType) != 0 || header->funcs % sizeof(ImageFunc) != 0 ||
+            header->lines % sizeof(ImageLine) != 0)
+        { return fail("misaligned"); }
+        if (header->namesSize > 0 && view.data[header->names + header->namesSize - 1] != '\0')
+        { return fail("bad names"); }
+        if (header->entry < 0 || (uint32_t) header->entry >= header->textSize)
+        { return fail("bad entry"); }
+
+        auto funcs = (const ImageFunc *) (view.data + header->funcs);
+        for (uint32_t i = 0; i < header->funcCount; ++i)
+        {
+            if (funcs[i].name >= header->namesSize)
+            { return fail("bad names"); }
+        }
+
+        header_ = header;
+        text_ = (const TextType *) (view.data + header->text);
+        data_ = (const DataType *) (view.data + header->data);
+        funcs_ = funcs;
+        lines_ = (const ImageLine *) (view.data + header->lines);
+        names_ = view.data + header->names;
+        return true;
+    }
+
+    std::map<int, std::string> Image::Funcs() const
+    {
+        std::map<int, std::string> funcs;
+        for (uint32_t i = 0; i < header_->funcCount; ++i)
+        { funcs[funcs_[i].entry] = names_ + funcs_[i].name; }
+        return funcs;
+    }
+}
@@ -0,0 +1,114 @@
+//
+// Created by yw.
+//
+
+#ifndef DRTCC_IMAGE_H
+#define DRTCC_IMAGE_H
+
+#include "Type.h"
+#include "Token.h"
+
+#define IMAGE_MAGIC 0x00435444      // "DTC\0"
+#define IMAGE_VERSION 1
+#define IMAGE_ALIGN 4096            // text段在文件中按页对齐
+
+#define IMAGE_TIER 0x1              // 未优化的字节码，运行时分层优化
+
+namespace DrTcc
+{
+    // 字节码映像(.dtc)文件头，各段以文件内偏移定位，均为小端
+    //
+    //   +--------------------+  0
+    //   | ImageHeader        |
+    //   | ImageFunc[]        |  函数符号表
+    //   | ImageLine[]        |  调试行号(可选)
+    //   | names              |  以0结尾的函数名
+    //   +--------------------+  IMAGE_ALIGN的倍数
+    //   | text               |  字节码
+    //   | data               |  data段
+    //   +--------------------+
+    //
+    // 字节码中的地址都相对于VM的段基址，映像不需要重定位，映射的页面保持只读，可被多个进程共享
+    struct ImageHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t flags;
+        sint entry;                     // main的入口
+        uint32_t text, textSize;        // 偏移, 指令数
+        uint32_t data, dataSize;        // 偏移, 字节数
+        uint32_t funcs, funcCount;      // 偏移, 函数个数
+        uint32_t lines, lineCount;      // 偏移, 行号记录个数
+        uint32_t names, namesSize;      // 偏移, 字节数
+    };
+
+    struct ImageFunc
+    {
+        sint entry;                     // 函数入口
+        uint32_t name;                  // 名称在names中的偏移
+    };
+
+    struct ImageLine
+    {
+        sint pc;                        // 字节码地址
+        sint line;                      // 源码行号
+    };
+
+    class Image
+    {
+            using TextType = BaseType<TokenType::Int>::type;
+            using DataType = BaseType<TokenType::Char>::type;
+        public:
+            Image() = default;
+
+            ~Image() = default;
+
+            // funcs: 函数入口 -> 函数名
+            static void Write(std::ostream &os, const std::vector<TextType> &text, const std::vector<DataType> &data,
+                              const std::map<int, std::string> &funcs, int entry, uint32_t flags = 0,
+                              const std::vector<ImageLine> &lines = std::vector<ImageLine>());
+
+            // 是否以映像的魔数开头
+            static bool Is(StringView view);
+
+            // 校验并引用内存中的映像(通常是Source的只读映射)，不拷贝；映像须在Image使用期间有效
+            bool Load(StringView view);
+
+            const TextType *Text() const
+            { return text_; }
+
+            size_t TextSize() const
+            { return header_->textSize; }
+
+            const DataType *Data() const
+            { return data_; }
+
+            size_t DataSize() const
+            { return header_->dataSize; }
+
+            int Entry() const
+            { return header_->entry; }
+
+            uint32_t Flags() const
+            { return header_->flags; }
+
+            // 函数入口 -> 函数名
+            std::map<int, std::string> Funcs() const;
+
+            const ImageLine *Lines() const
+            { return lines_; }
+
+            size_t LineCount() const
+            { return header_->lineCount; }
+
+        private:
+            const ImageHeader *header_{nullptr};
+            const TextType *text_{nullptr};
+            const DataType *data_{nullptr};
+            const ImageFunc *funcs_{nullptr};
+            const ImageLine *lines_{nullptr};
+            const char *names_{nullptr};
+    };
+}
+
+#endif //DRTCC_IMAGE_H
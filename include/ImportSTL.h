@@ -9,6 +9,7 @@
 #include <unordered_map>
 #include <cassert>
 #include <vector>
+#include <deque>
 #include <bitset>
 #include <sstream>
 #include <iostream>
@@ -19,5 +20,9 @@
 #include <cctype>
 #include <cstring>
 #include <iomanip>
+#include <array>
+#include <map>
+#include <tuple>
+#include <algorithm>
 
 #endif // DRTCC_IMPORTSTL_H
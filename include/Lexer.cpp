@@ -3,16 +3,274 @@
 
 #include "Lexer.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LEXER_SSE2 1
+#include <emmintrin.h>
+#else
+#define LEXER_SSE2 0
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include <thread>
+#include <memory>
+
 #define INPUT_DEBUG 0;
 
 namespace DrTcc
 {
+    namespace
+    {
+        struct Keyword
+        {
+            const char *name;
+            uint length;
+            TokenType type;
+        };
+
+        // 关键字的完美哈希：首字符、尾字符与长度即可区分全部关键字
+        constexpr uint KeywordHash(const char *s, uint n)
+        { return ((uint8) s[0] + (uint8) s[n - 1] * 5u + n * 29u) & 127u; }
+
+#define DEFINE_KEYWORD(k) {#k, sizeof(#k) - 1, TokenType::K_##k}
+        constexpr Keyword KeywordList[] = {
+                DEFINE_KEYWORD(auto), DEFINE_KEYWORD(bool), DEFINE_KEYWORD(break), DEFINE_KEYWORD(case),
+                DEFINE_KEYWORD(char), DEFINE_KEYWORD(const), DEFINE_KEYWORD(continue), DEFINE_KEYWORD(default),
+                DEFINE_KEYWORD(do), DEFINE_KEYWORD(double), DEFINE_KEYWORD(else), DEFINE_KEYWORD(enum),
+                DEFINE_KEYWORD(extern), DEFINE_KEYWORD(false), DEFINE_KEYWORD(float), DEFINE_KEYWORD(for),
+                DEFINE_KEYWORD(goto), DEFINE_KEYWORD(if), DEFINE_KEYWORD(int), DEFINE_KEYWORD(long),
+                DEFINE_KEYWORD(register), DEFINE_KEYWORD(return), DEFINE_KEYWORD(short), DEFINE_KEYWORD(signed),
+                DEFINE_KEYWORD(sizeof), DEFINE_KEYWORD(static), DEFINE_KEYWORD(struct), DEFINE_KEYWORD(switch),
+                DEFINE_KEYWORD(true), DEFINE_KEYWORD(typedef), DEFINE_KEYWORD(union), DEFINE_KEYWORD(unsigned),
+                DEFINE_KEYWORD(void), DEFINE_KEYWORD(volatile), DEFINE_KEYWORD(while), DEFINE_KEYWORD(interrupt),
+                DEFINE_KEYWORD(pragma),
+        };
+#undef DEFINE_KEYWORD
+
+        static_assert(sizeof(KeywordList) / sizeof(KeywordList[0]) ==
+                      static_cast<int>(TokenType::KEnd) - static_cast<int>(TokenType::KStart) - 1,
+                      "KeywordList out of sync with TokenType");
+
+        struct KeywordTable
+        {
+            Keyword slot[128];
+        };
+
+        // 编译期建表，哈希冲突时无法求值，编译失败
+        constexpr KeywordTable MakeKeywordTable()
+        {
+            KeywordTable t{};
+            for (uint i = 0; i < sizeof(KeywordList) / sizeof(KeywordList[0]); i++)
+            {
+                const auto &k = KeywordList[i];
+                auto &s = t.slot[KeywordHash(k.name, k.length)];
+                if (s.name != nullptr)
+                { throw "keyword hash collision"; }
+                s.name = k.name;
+                s.length = k.length;
+                s.type = k.type;
+            }
+            return t;
+        }
+
+        constexpr KeywordTable KeywordTab = MakeKeywordTable();
+
+#ifdef _MSC_VER
+        inline uint Ctz(uint m)
+        {
+            unsigned long k;
+            _BitScanForward(&k, m);
+            return k;
+        }
+
+        inline uint Popcount(uint m)
+        { return __popcnt(m); }
+#else
+        inline uint Ctz(uint m)
+        { return __builtin_ctz(m); }
+
+        inline uint Popcount(uint m)
+        { return __builtin_popcount(m); }
+#endif
+
+        // 以下扫描函数每次比较16字节，得到字符掩码后用ctz找边界、popcount数换行，
+        // 不足16字节的尾部逐字节处理，结果与逐字节扫描一致
+#if LEXER_SSE2
+        inline uint Mask(const char *p, char c)
+        { return (uint) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) p), _mm_set1_epi8(c))); }
+#endif
+
+        // 空格/制表符串的结束位置
+        uint ScanBlank(const char *p, uint i, uint n)
+        {
+#if LEXER_SSE2
+            for (; i + 16 <= n; i += 16)
+            {
+                auto m = (Mask(p + i, ' ') | Mask(p + i, '\t')) ^ 0xffffu;
+                if (m != 0)
+                { return i + Ctz(m); }
+            }
+#endif
+            for (; i < n && (p[i] == ' ' || p[i] == '\t'); i++);
+            return i;
+        }
+
+        // 换行符串的结束位置，lines累加'\n'的个数
+        uint ScanNewline(const char *p, uint i, uint n, uint &lines)
+        {
+#if LEXER_SSE2
+            for (; i + 16 <= n; i += 16)
+            {
+                auto lf = Mask(p + i, '\n');
+                auto m = (lf | Mask(p + i, '\r')) ^ 0xffffu;
+                if (m != 0)
+                {
+                    auto k = Ctz(m);
+                    lines += Popcount(lf & ((1u << k) - 1));
+                    return i + k;
+                }
+                lines += Popcount(lf);
+            }
+#endif
+            for (; i < n && (p[i] == '\r' || p[i] == '\n'); i++)
+            { lines += p[i] == '\n'; }
+            return i;
+        }
+
+        // 行尾('\r'或'\n')的位置
+        uint ScanLineEnd(const char *p, uint i, uint n)
+        {
+#if LEXER_SSE2
+            for (; i + 16 <= n; i += 16)
+            {
+                auto m = Mask(p + i, '\n') | Mask(p + i, '\r');
+                if (m != 0)
+                { return i + Ctz(m); }
+            }
+#endif
+            for (; i < n && p[i] != '\n' && p[i] != '\r'; i++);
+            return i;
+        }
+
+        // 块注释结束符"*/"中'/'的位置(j > i)，lines累加[i, j)中'\n'的个数，找不到时返回n
+        uint ScanBlockEnd(const char *p, uint i, uint n, uint &lines)
+        {
+            if (i >= n)
+            { return n; }
+
+            lines += p[i] == '\n';
+            auto j = i + 1;
+#if LEXER_SSE2
+            for (; j + 16 <= n; j += 16)
+            {
+                auto lf = Mask(p + j, '\n');
+                auto m = Mask(p + j - 1, '*') & Mask(p + j, '/');
+                if (m != 0)
+                {
+                    auto k = Ctz(m);
+                    lines += Popcount(lf & ((1u << k) - 1));
+                    return j + k;
+                }
+                lines += Popcount(lf);
+            }
+#endif
+            for (; j < n && (p[j - 1] != '*' || p[j] != '/'); j++)
+            { lines += p[j] == '\n'; }
+            return j;
+        }
+
+        // 8个字节是否全为ASCII数字(SWAR，小端)
+        inline bool All8Digits(const char *p)
+        {
+            ulong v;
+            memcpy(&v, p, 8);
+            return ((v & 0xF0F0F0F0F0F0F0F0ULL) | (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ==
+                   0x3333333333333333ULL;
+        }
+
+        // 8个ASCII数字 -> 整数，三次乘法两两合并相邻位
+        inline uint Parse8(const char *p)
+        {
+            ulong v;
+            memcpy(&v, p, 8);
+            v -= 0x3030303030303030ULL;
+            v = (v * 10) + (v >> 8);
+            v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+                 (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+            return (uint) v;
+        }
+
+        // 十进制数字串的结束位置，累加到m，digits为有效数字位数(不含前导0)，超过19位的数字只计数不累加
+        uint ScanDigits(const char *p, uint i, uint n, ulong &m, int &digits)
+        {
+            for (; i + 8 <= n && digits <= 11 && All8Digits(p + i); i += 8)
+            {
+                auto zero = m == 0;
+                m = m * 100000000ULL + Parse8(p + i);
+                if (!zero)
+                { digits += 8; }
+                else
+                { for (auto k = m; k != 0; k /= 10, digits++); }
+            }
+            for (; i < n && p[i] >= '0' && p[i] <= '9'; i++)
+            {
+                if (digits < 19)
+                {
+                    m = m * 10 + (p[i] - '0');
+                    digits += m != 0;
+                }
+                else
+                { digits++; }
+            }
+            return i;
+        }
+
+        // 尾数m(s[0, len)的全部有效数字，含fraction位小数)乘以10^e，正确舍入
+        // 尾数不超过2^53且|指数|<=22时两个操作数都是精确的double，一次乘除只舍入一次(Clinger快速路径)，
+        // 其余情况交给strtod
+        double Decimal(const char *s, uint len, ulong m, int digits, int fraction, int e)
+        {
+            static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                           1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+            auto x = e - fraction;
+            if (digits <= 19 && m <= (1ULL << 53) && x >= -22 && x <= 22)
+            { return x < 0 ? (double) m / pow10[-x] : (double) m * pow10[x]; }
+
+            auto str = std::string(s, len) + "e" + std::to_string(e);
+            return strtod(str.c_str(), nullptr);
+        }
+
+        // 字符串中第一个前面不是'\\'的'"'的位置(p[i - 1]须可读)，escape表示其间是否有'\\'
+        uint ScanString(const char *p, uint i, uint n, bool &escape)
+        {
+#if LEXER_SSE2
+            for (; i + 16 <= n; i += 16)
+            {
+                auto slash = Mask(p + i, '\\');
+                auto m = Mask(p + i, '"') & ~Mask(p + i - 1, '\\');
+                if (m != 0)
+                {
+                    auto k = Ctz(m);
+                    escape = escape || (slash & ((1u << k) - 1)) != 0;
+                    return i + k;
+                }
+                escape = escape || slash != 0;
+            }
+#endif
+            for (; i < n && (p[i - 1] == '\\' || p[i] != '"'); i++)
+            { escape = escape || p[i] == '\\'; }
+            return i;
+        }
+    }
+
     Lexer::Lexer()
     {
         Init();
     }
 
-    void Lexer::Input(std::string str)
+    void Lexer::Input(StringView str)
     {
         text = str;
         length_ = str.length();
@@ -21,15 +279,8 @@ namespace DrTcc
 
     void Lexer::Init()
     {
-        auto endIndex = static_cast<int>(TokenType::KEnd) - static_cast<int>( TokenType::KStart);
-        for (size_t i = 1; i < endIndex; i++)
-        {
-            const auto &k = KeywordStringList[i];
-            KeywordMap.insert({std::string(std::get<1>(k)), std::get<0>(k)});
-        }
-
         int len = 0;
-        endIndex = tok_.ToUnderlying(OperatorType::OpEnd);
+        auto endIndex = tok_.ToUnderlying(OperatorType::OpEnd);
         for (auto i = 1; i < endIndex; i++)
         {
             const auto &op = tok_.OpStr((OperatorType) i);
@@ -89,6 +340,7 @@ namespace DrTcc
         err.error = error;
         err.str = text.substr(err.startIdx, err.endIdx - err.startIdx);
         records.push_back(err);
+        recent_ = records.size() - 1;
         Move(skip);
 
         return TokenType::Error;
@@ -114,6 +366,9 @@ namespace DrTcc
 
     TokenType Lexer::Next()
     {
+        if (streamed_)
+        { return Replay(); }
+
         auto c = Local();
         if (c == -1)
         {
@@ -152,29 +407,386 @@ namespace DrTcc
         return type;
     }
 
+    void Lexer::Pretokenize(uint threads)
+    {
+        streamed_ = false;
+        Reset();
+        stream_ = TokenStream();
+        storage = decltype(storage)();
+
+        // 粗略估计词数，避免反复扩容
+        auto n = length_ / 4;
+        stream_.kinds.reserve(n);
+        stream_.payloads.reserve(n);
+        stream_.begins.reserve(n);
+        stream_.ends.reserve(n);
+        stream_.lines.reserve(n);
+        stream_.columns.reserve(n);
+        stream_.lastLines.reserve(n);
+        stream_.lastColumns.reserve(n);
+
+        // 第一块在当前线程上分词，其余各块假设从词边界开始，在工作线程上推测分词
+        auto bounds = Split(threads);
+        auto m = bounds.size() - 1;
+        std::vector<std::unique_ptr<Lexer>> subs(m);
+        std::vector<TokenType> lasts(m);
+        std::vector<std::thread> workers;
+        for (uint k = 1; k < m; k++)
+        {
+            subs[k].reset(new Lexer());
+            workers.emplace_back([&, k]()
+                                 {
+                                     auto &sub = *subs[k];
+                                     sub.Input(text);
+                                     sub.index_ = bounds[k];
+                                     lasts[k] = sub.Lex(bounds[k + 1]);
+                                 });
+        }
+
+        auto last = Lex(bounds[1]);
+        for (auto &w : workers)
+        { w.join(); }
+
+        // 前一块恰好以换行结束于本块起点时推测成立(此时列为1)，否则从真实位置重新分词
+        for (uint k = 1; k < m; k++)
+        {
+            if (last == TokenType::Newline && index_ == bounds[k])
+            {
+                Append(*subs[k]);
+                last = lasts[k];
+            }
+            else
+            { last = Lex(bounds[k + 1]); }
+        }
+
+        // 末尾保留TokenEnd，记录结束时的位置
+        Next();
+        Push();
+
+        streamed_ = true;
+        Reset();
+    }
+
+    std::vector<uint> Lexer::Split(uint threads) const
+    {
+        // 块边界取在换行符串之后，使推测大多成立
+        std::vector<uint> bounds{0};
+        auto size = std::max(length_ / std::max(threads, 1u), (uint) LEXER_CHUNK);
+        for (auto i = size; i < length_; i += size)
+        {
+            auto nl = (const char *) memchr(text.data + i, '\n', length_ - i);
+            if (nl == nullptr)
+            { break; }
+
+            for (i = nl - text.data; i < length_ && (text[i] == '\r' || text[i] == '\n'); i++);
+            if (i >= length_)
+            { break; }
+            bounds.push_back(i);
+        }
+        bounds.push_back(length_);
+        return bounds;
+    }
+
+    TokenType Lexer::Lex(uint end)
+    {
+        // 从当前位置分词直到越过end(最后一个词可以跨过end)，返回最后一个词(含空白)的类型
+        auto t = TokenType::NONE;
+        while (index_ < end)
+        {
+            t = Next();
+            if (t != TokenType::Space && t != TokenType::Newline && t != TokenType::Comment)
+            { Push(); }
+        }
+        return t;
+    }
+
+    void Lexer::Push()
+    {
+        stream_.kinds.push_back(type);
+        stream_.payloads.push_back(type == TokenType::TokenEnd ? 0 : Store());
+        stream_.begins.push_back(beginIndex_);
+        stream_.ends.push_back(index_);
+        stream_.lines.push_back(line_);
+        stream_.columns.push_back(column_);
+        stream_.lastLines.push_back(lastLine_);
+        stream_.lastColumns.push_back(lastColumn_);
+    }
+
+    namespace
+    {
+        template<class T>
+        int Concat(std::vector<T> &dst, const std::vector<T> &src)
+        {
+            auto offset = (int) dst.size();
+            dst.insert(dst.end(), src.begin(), src.end());
+            return offset;
+        }
+    }
+
+    void Lexer::Append(const Lexer &sub)
+    {
+        // sub从第1行第1列开始计数，行号平移到当前行
+        auto base = line_ - 1;
+
+        std::array<int, (int) TokenType::TokenEnd + 1> offsets{};
+        offsets[(int) TokenType::Char] = Concat(storage._char, sub.storage._char);
+        offsets[(int) TokenType::Uchar] = Concat(storage._uchar, sub.storage._uchar);
+        offsets[(int) TokenType::Short] = Concat(storage._short, sub.storage._short);
+        offsets[(int) TokenType::Ushort] = Concat(storage._ushort, sub.storage._ushort);
+        offsets[(int) TokenType::Int] = Concat(storage._int, sub.storage._int);
+        offsets[(int) TokenType::Uint] = Concat(storage._uint, sub.storage._uint);
+        offsets[(int) TokenType::Long] = Concat(storage._long, sub.storage._long);
+        offsets[(int) TokenType::Ulong] = Concat(storage._ulong, sub.storage._ulong);
+        offsets[(int) TokenType::Float] = Concat(storage._float, sub.storage._float);
+        offsets[(int) TokenType::Double] = Concat(storage._double, sub.storage._double);
+        offsets[(int) TokenType::String] = Concat(storage._string, sub.storage._string);
+        offsets[(int) TokenType::Error] = Concat(records, sub.records);
+        for (auto i = (uint) offsets[(int) TokenType::Error]; i < records.size(); i++)
+        { records[i].line += base; }
+
+        // 按出现顺序重新编号标识符，与串行分词的ID一致
+        std::vector<int> ids(sub.names_.size(), -1);
+        const auto &src = sub.stream_;
+        for (uint i = 0; i < src.kinds.size(); i++)
+        {
+            auto t = src.kinds[i];
+            auto p = src.payloads[i];
+            if (t == TokenType::Identifier)
+            {
+                if (ids[p] == -1)
+                { ids[p] = Intern(StringView(sub.names_[p])); }
+                p = ids[p];
+            }
+            else if (t != TokenType::Keyword && t != TokenType::Operator)
+            { p += offsets[(int) t]; }
+
+            stream_.kinds.push_back(t);
+            stream_.payloads.push_back(p);
+            stream_.begins.push_back(src.begins[i]);
+            stream_.ends.push_back(src.ends[i]);
+            stream_.lines.push_back(src.lines[i] + base);
+            stream_.columns.push_back(src.columns[i]);
+            stream_.lastLines.push_back(src.lastLines[i] + base);
+            stream_.lastColumns.push_back(src.lastColumns[i]);
+        }
+
+        beginIndex_ = sub.beginIndex_;
+        index_ = sub.index_;
+        line_ = sub.line_ + base;
+        column_ = sub.column_;
+        lastLine_ = sub.lastLine_ + base;
+        lastColumn_ = sub.lastColumn_;
+    }
+
+    int Lexer::Store()
+    {
+#define STORE(t, f) \
+        case TokenType::t: \
+            storage.f.push_back(bags.f); \
+            return (int) storage.f.size() - 1;
+
+        switch (type)
+        {
+            STORE(Char, _char)
+            STORE(Uchar, _uchar)
+            STORE(Short, _short)
+            STORE(Ushort, _ushort)
+            STORE(Int, _int)
+            STORE(Uint, _uint)
+            STORE(Long, _long)
+            STORE(Ulong, _ulong)
+            STORE(Float, _float)
+            STORE(Double, _double)
+            STORE(String, _string)
+            case TokenType::Keyword:
+                return (int) bags._keyword;
+            case TokenType::Operator:
+                return (int) bags._operator;
+            case TokenType::Identifier:
+                return bags._identifier;
+            case TokenType::Error:
+                return (int) recent_;
+            default:
+                break;
+        }
+#undef STORE
+
+        return 0;
+    }
+
+    slong Lexer::IntegerAt(uint i) const
+    {
+        auto p = stream_.payloads[i];
+        switch (stream_.kinds[i])
+        {
+            case TokenType::Char:
+                return storage._char[p];
+            case TokenType::Uchar:
+                return storage._uchar[p];
+            case TokenType::Short:
+                return storage._short[p];
+            case TokenType::Ushort:
+                return storage._ushort[p];
+            case TokenType::Int:
+                return storage._int[p];
+            case TokenType::Uint:
+                return storage._uint[p];
+            case TokenType::Long:
+                return storage._long[p];
+            case TokenType::Ulong:
+                return (slong) storage._ulong[p];
+            default:
+                break;
+        }
+        return 0;
+    }
+
+    void Lexer::Copy(TokenStream &out, const Lexer &from, uint i, uint site)
+    {
+        auto t = from.stream_.kinds[i];
+        auto p = from.stream_.payloads[i];
+        if (&from != this)
+        {
+#define COPY(t, f) \
+            case TokenType::t: \
+                storage.f.push_back(from.storage.f[p]); \
+                p = (int) storage.f.size() - 1; \
+                break;
+
+            switch (t)
+            {
+                COPY(Char, _char)
+                COPY(Uchar, _uchar)
+                COPY(Short, _short)
+                COPY(Ushort, _ushort)
+                COPY(Int, _int)
+                COPY(Uint, _uint)
+                COPY(Long, _long)
+                COPY(Ulong, _ulong)
+                COPY(Float, _float)
+                COPY(Double, _double)
+                COPY(String, _string)
+                case TokenType::Identifier:
+                    p = Intern(StringView(from.names_[p]));
+                    break;
+                case TokenType::Error:
+                    records.push_back(from.records[p]);
+                    p = (int) records.size() - 1;
+                    break;
+                default:
+                    break;
+            }
+#undef COPY
+        }
+
+        out.kinds.push_back(t);
+        out.payloads.push_back(p);
+        out.begins.push_back(stream_.begins[site]);
+        out.ends.push_back(stream_.ends[site]);
+        out.lines.push_back(stream_.lines[site]);
+        out.columns.push_back(stream_.columns[site]);
+        out.lastLines.push_back(stream_.lastLines[site]);
+        out.lastColumns.push_back(stream_.lastColumns[site]);
+    }
+
+    void Lexer::Replace(TokenStream stream)
+    {
+        assert(!stream.kinds.empty() && stream.kinds.back() == TokenType::TokenEnd);
+        stream_ = std::move(stream);
+        streamed_ = true;
+        Reset();
+    }
+
+    TokenType Lexer::Replay()
+    {
+        // 停在末尾的TokenEnd上
+        auto i = cursor_;
+        if (cursor_ + 1 < stream_.kinds.size())
+        { cursor_++; }
+
+        auto p = stream_.payloads[i];
+        type = stream_.kinds[i];
+        beginIndex_ = stream_.begins[i];
+        index_ = stream_.ends[i];
+        line_ = stream_.lines[i];
+        column_ = stream_.columns[i];
+        lastLine_ = stream_.lastLines[i];
+        lastColumn_ = stream_.lastColumns[i];
+
+#define REPLAY(t, f) \
+        case TokenType::t: \
+            bags.f = storage.f[p]; \
+            break;
+
+        switch (type)
+        {
+            REPLAY(Char, _char)
+            REPLAY(Uchar, _uchar)
+            REPLAY(Short, _short)
+            REPLAY(Ushort, _ushort)
+            REPLAY(Int, _int)
+            REPLAY(Uint, _uint)
+            REPLAY(Long, _long)
+            REPLAY(Ulong, _ulong)
+            REPLAY(Float, _float)
+            REPLAY(Double, _double)
+            REPLAY(String, _string)
+            case TokenType::Keyword:
+                bags._keyword = (TokenType) p;
+                break;
+            case TokenType::Operator:
+                bags._operator = (OperatorType) p;
+                break;
+            case TokenType::Identifier:
+                bags._identifier = p;
+                break;
+            case TokenType::Error:
+                recent_ = p;
+                break;
+            default:
+                break;
+        }
+#undef REPLAY
+
+        return type;
+    }
+
     TokenType Lexer::ParseIdentifier()
     {
         size_t i;
 
         for (i = index_ + 1; i < length_ && (isalnum(text[i]) || text[i] == '_'); i++);
 
-        // get the Match str
-        auto s = text.substr(index_, i - index_);
-        auto kw = KeywordMap.find(s);
+        // get the Match str，直接引用源码，不分配
+        StringView s(text.data + index_, i - index_);
+        const auto &kw = KeywordTab.slot[KeywordHash(s.data, s.size)];
 
-        // match keyword
-        if (kw != KeywordMap.end())
+        // match keyword, 空槽的length为0
+        if (kw.length == s.size && memcmp(kw.name, s.data, s.size) == 0)
         {
-            bags._keyword = kw->second;
+            bags._keyword = kw.type;
             Move(s.length());
             return TokenType::Keyword;
         }
 
-        bags._identifier = s;
+        bags._identifier = Intern(s);
         Move(s.length());
         return TokenType::Identifier;
     }
 
+    int Lexer::Intern(StringView s)
+    {
+        auto it = ids_.find(s);
+        if (it != ids_.end())
+        { return it->second; }
+
+        // 首次出现时才拷贝名字
+        int id = (int) names_.size();
+        names_.emplace_back(s.data, s.size);
+        ids_.insert({StringView(names_.back()), id});
+        return id;
+    }
+
     TokenType Lexer::ParseDigit()
     {
         /* d:存储浮点数
@@ -228,76 +840,56 @@ namespace DrTcc
             return GetDigit(t, n, d, i);
         }
 
-        // 解析整数部分
-        for (; i < length_ && (isdigit(text[i])); i++)
-        {
-            if (t == TokenType::Double)
-            {
-                d *= 10.0;
-                d += text[i] - '0';
-            }
-            else
-            {   // 整数加位
-                _n = n;
-                n *= 10;
-                n += text[i] - '0';
-            }
+        // 解析整数部分，每次8位
+        auto m = 0ULL;              // 尾数的前19位有效数字
+        auto digits = 0;            // 有效数字位数
+        auto fraction = 0, e = 0;   // 小数位数，指数
+        i = ScanDigits(text.data, i, length_, m, digits);
+        auto end = i;               // 尾数(含小数点)的结束位置
+        n = m;
 
-            if (t == TokenType::Int)
-            {
-                if (n > INT_MAX)
-                { t = TokenType::Long; }  // 溢出 转换成long
-            }
-            else if (t == TokenType::Long)
-            {
-                if (n > LONG_LONG_MAX)
-                {
-                    d = (double) _n;
-                    d *= 10.0;
-                    d += text[i] - '0';
-                    t = TokenType::Double;
-                }
-            }
-        }
+        if (digits > 19 || n > LONG_LONG_MAX)
+        { t = TokenType::Double; }  // 溢出 转换成double
+        else if (n > INT_MAX)
+        { t = TokenType::Long; }    // 溢出 转换成long
+
+        auto decimal = [&]()
+        { return t == TokenType::Double ? Decimal(text.data + index_, end - index_, m, digits, fraction, e) : d; };
 
         // 只有整数部分
         if (i == length_)
-        { return GetDigit(t, n, d, i); }
+        { return GetDigit(t, n, decimal(), i); }
 
         // 判断是有无后缀
         if ((postFix = DigitType(t, i)) != TokenType::Error)
         {
             Move(i - index_);
-            return DigitFromInteger(postFix, n) ? postFix : t;
+            if (t != TokenType::Double)
+            { return DigitFromInteger(postFix, n) ? postFix : t; }
+            else
+            { return DigitFromDouble(postFix, decimal()) ? postFix : t; }
         }
 
         // 解析小数部分
         if (text[i] == '.')
         {
-            sint l = ++i;
-            for (; i < length_ && (isdigit(text[i])); ++i)
-            {
-                d *= 10.0;
-                d += text[i] - '0';
-            }
-
-            l = i - l;
-            if (l > 0)
-            {
-                d = (double) n + CalculateExp(d, -l);
-                t = TokenType::Double;
-            }
+            auto l = ++i;
+            i = ScanDigits(text.data, i, length_, m, digits);
+            fraction = i - l;
+            end = i;
+            if (fraction > 0)
+            { t = TokenType::Double; }
         }
         if (i == length_) // 只有整数和小数部分
-        { return GetDigit(t, n, d, i); }
+        { return GetDigit(t, n, decimal(), i); }
 
         if ((postFix = DigitType(t, i)) != TokenType::Error)
         {
             Move(i - index_);
-            if (t == TokenType::Int)
+            if (t != TokenType::Double)
             { return DigitFromInteger(postFix, n) ? postFix : t; }
             else
-            { return DigitFromDouble(postFix, d) ? postFix : t; }
+            { return DigitFromDouble(postFix, decimal()) ? postFix : t; }
         }
 
         /*********************** 解析指数 *******************/
@@ -305,53 +897,48 @@ namespace DrTcc
         if (text[i] == 'e' || text[i] == 'E')
         {
             bool negative = false;
-            auto e = 0;
-
-            if (t != TokenType::Double)
-            {
-                t = TokenType::Double;
-                d = (double) n;
-            }
+            t = TokenType::Double;
 
             if (++i == length_)
-            { return GetDigit(t, n, d, i); }
+            { return GetDigit(t, n, decimal(), i); }
 
             if (!isdigit(text[i]))
             {
                 if (text[i] == '-')
                 { // 1e-1
                     if (++i == length_)
-                    { return GetDigit(t, n, d, i); }
+                    { return GetDigit(t, n, decimal(), i); }
                     negative = true;
                 }
                 else if (text[i] == '+')
                 {
                     if (++i == length_)
-                    { return GetDigit(t, n, d, i); }
+                    { return GetDigit(t, n, decimal(), i); }
                 }
                 else
-                { return GetDigit(t, n, d, i); }
+                { return GetDigit(t, n, decimal(), i); }
             }
 
-            // 解析指数部分
+            // 解析指数部分，过大的指数只需保证溢出/下溢
+            auto x = 0;
             for (; i < length_ && (isdigit(text[i])); ++i)
             {
-                e *= 10;
-                e += text[i] - '0';
+                if (x < 100000)
+                { x = x * 10 + text[i] - '0'; }
             }
-            d = CalculateExp(d, negative ? -e : e);
+            e = negative ? -x : x;
         }
 
         if ((postFix = DigitType(t, i)) != TokenType::Error)
         {
             Move(i - index_);
-            if (t == TokenType::Int)
+            if (t != TokenType::Double)
             { return DigitFromInteger(postFix, n) ? postFix : t; }
             else
-            { return DigitFromDouble(postFix, d) ? postFix : t; }
+            { return DigitFromDouble(postFix, decimal()) ? postFix : t; }
         }
 
-        return GetDigit(t, n, d, i);
+        return GetDigit(t, n, decimal(), i);
     }
 
     TokenType
@@ -501,8 +1088,7 @@ namespace DrTcc
 
     void Lexer::SkipWhiteSpace()
     {
-        uint i;
-        for (i = index_ + 1; i < length_ && (text[i] == ' ' || text[i] == '\t'); ++i);
+        auto i = ScanBlank(text.data, index_ + 1, length_);
         bags._space = i - index_;
         Move(bags._space);
     }
@@ -510,8 +1096,8 @@ namespace DrTcc
     void Lexer::SkipNewLine()
     {
         // j记录换行符个数
-        uint i, j;
-        for (i = index_, j = 0; i < length_ && (text[i] == '\r' || (text[i] == '\n' ? ++j > 0 : false)); ++i);
+        uint j = 0;
+        auto i = ScanNewline(text.data, index_, length_, j);
         bags._newline = j;
         Move(i - index_, bags._newline);
     }
@@ -594,17 +1180,22 @@ namespace DrTcc
 
     TokenType Lexer::ParseString()
     {
-        int i = index_;
-
-        auto prev = text[i];
         // 寻找非'\"'的第一个'"'
-
-        for (i++; i < length_ && (prev == '\\' || text[i] != '"'); prev = text[i++]);
+        bool escape = false;
+        int i = ScanString(text.data, index_ + 1, length_, escape);
         auto j = i;
 
         if (j == length_) // EOF
         { return RecordError(ErrorInvalidString, i - index_); }
 
+        // 没有转义字符，直接截取
+        if (!escape)
+        {
+            bags._string = text.substr(index_ + 1, j - index_ - 1);
+            Move(j - index_ + 1);
+            return TokenType::String;
+        }
+
         std::stringstream ss;
         int status = 1;
         char c = 0;
@@ -706,20 +1297,15 @@ namespace DrTcc
         if (text[++i] == '/')       // '//'
         {
             // find '\n'
-            for (++i; i < length_ && (text[i] != '\n' && text[i] != '\r'); i++);
+            i = ScanLineEnd(text.data, i + 1, length_);
             bags._comment = text.substr(index_ + 2, i - index_ - 2);
             Move(i - index_);
         }
         else                    // '/* comments */'
         {
             // find '*/'
-            char prev = 0;
-            auto newLine = 0;
-            for (++i; i < length_ && (prev != '*' || text[i] != '/');)
-            {
-                prev = text[i++];
-                prev == '\n' ? ++newLine : 0;
-            }
+            uint newLine = 0;
+            i = ScanBlockEnd(text.data, i + 1, length_, newLine);
             ++i;
             bags._comment = text.substr(index_ + 2, i - index_ - 1);
             Move(i - index_, newLine);
@@ -811,6 +1397,9 @@ namespace DrTcc
                             case '>':
                                 p = OperatorType::RightShift;
                                 break;
+                            case '#':
+                                p = OperatorType::SharpSharp;
+                                break;
                             default:
                                 break;
                         }
@@ -865,7 +1454,10 @@ namespace DrTcc
         lastLine_ = 1;
         lastColumn_ = 1;
 
-        records.clear();
+        // 已分词时错误记录由stream_引用，保留
+        cursor_ = 0;
+        if (!streamed_)
+        { records.clear(); }
     }
 
     bool Lexer::IsBaseType() const
@@ -7,8 +7,21 @@
 #include "Token.h"
 #include "Type.h"
 
+#define LEXER_CHUNK (256 * 1024)     // 并行分词时每块的最小字节数
+
 namespace DrTcc
 {
+    // 预分词结果(SoA)，不含空白、换行与注释
+    // payloads: 关键字/操作符为枚举值，标识符为ID，数值/字符串为Lexer::storage中对应数组的下标，错误为错误记录下标
+    struct TokenStream
+    {
+        std::vector<TokenType> kinds;
+        std::vector<int> payloads;
+        std::vector<uint> begins, ends;             // 源码区间
+        std::vector<int> lines, columns;            // 词尾的行列，同GetLine/GetColumn
+        std::vector<int> lastLines, lastColumns;    // 词首的行列，同GetLastLine/GetLastColumn
+    };
+
     class Lexer
     {
         public:
@@ -20,10 +33,43 @@ namespace DrTcc
 
             Lexer &operator=(const Lexer &) = delete;
 
-            void Input(std::string s);
+            // 不拷贝源码，调用者须保证源码在词法分析期间有效
+            void Input(StringView s);
 
             TokenType Next();
 
+            // 一次性分词到stream_，此后Next与Reset都只在数组上进行
+            // threads > 1且源码足够大时按LEXER_CHUNK以上的块并行分词，结果与串行相同
+            void Pretokenize(uint threads = 1);
+
+            const TokenStream &Stream() const
+            { return stream_; }
+
+            // 向前看第k个词(0为Next将返回的词)，须先Pretokenize
+            TokenType PeekType(uint k) const
+            { return cursor_ + k < stream_.kinds.size() ? stream_.kinds[cursor_ + k] : TokenType::TokenEnd; }
+
+            bool PeekOperator(uint k, OperatorType t) const
+            { return PeekType(k) == TokenType::Operator && (OperatorType) stream_.payloads[cursor_ + k] == t; }
+
+            // 标识符ID -> 名字，ID在Lexer的生命周期内有效
+            const std::string &Name(int id) const
+            { return names_[id]; }
+
+            // 第i个词的源码原文
+            std::string Spelling(uint i) const
+            { return text.substr(stream_.begins[i], stream_.ends[i] - stream_.begins[i]); }
+
+            // 第i个词为整数时的值
+            slong IntegerAt(uint i) const;
+
+            // 预处理用: 把from的第i个词追加到out，from可以是其他Lexer(如头文件)
+            // 载荷换成本Lexer的编号，位置取本Lexer第site个词的位置(#include或宏调用处)
+            void Copy(TokenStream &out, const Lexer &from, uint i, uint site);
+
+            // 换成预处理后的词流，末尾须为TokenEnd
+            void Replace(TokenStream stream);
+
         public:
             struct ErrorRecord
             {
@@ -140,7 +186,7 @@ namespace DrTcc
             { return storage._string[index]; };
 
             const ErrorRecord &RecentError() const
-            { return records.back(); }
+            { return records[recent_]; }
 
             bool IsType(TokenType t) const
             { return GetType() == t; }
@@ -198,6 +244,20 @@ namespace DrTcc
 
             TokenType RecordError(ErrorType error, int skip);
 
+            TokenType Replay();
+
+            std::vector<uint> Split(uint threads) const;
+
+            TokenType Lex(uint end);
+
+            void Push();
+
+            void Append(const Lexer &sub);
+
+            int Store();
+
+            int Intern(StringView s);
+
             TokenType ParseIdentifier();
 
             TokenType ParseDigit();
@@ -213,11 +273,16 @@ namespace DrTcc
             TokenType ParseOperator();
 
         private:
-            std::unordered_map<std::string, TokenType> KeywordMap;
             std::array<OperatorType, 0x100> sinOp;
             std::bitset<128> bitOp[2];
             std::vector<ErrorRecord> records;
-            std::string text;
+            uint recent_{0};
+            TokenStream stream_;
+            bool streamed_{false};
+            uint cursor_{0};
+            StringView text;
+            std::deque<std::string> names_;                                 // 标识符表, deque保证引用稳定
+            std::unordered_map<StringView, int, StringViewHash> ids_;       // 名字(指向names_) -> ID
             uint index_{0};
             uint length_{0};
             uint beginIndex_{0};     // last_index
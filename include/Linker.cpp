@@ -0,0 +1,254 @@
+//
+// Created by yw.
+//
+
+#include "Linker.h"
+#include "Optimizer.h"
+
+#define LINK_DEBUG 0
+
+namespace DrTcc
+{
+    Object::Object(const GenCode &gen) : text_(gen.Text()), data_(gen.Data())
+    {
+        for (const auto &f : gen.Funcs())
+        { symbols_.push_back(Symbol{ObjFunc, f.first, 0, f.second}); }
+        for (const auto &g : gen.Globals())
+        { symbols_.push_back(Symbol{ObjGlobal, g.second.first, g.second.second, g.first}); }
+
+        // 同一函数只导入一次
+        std::unordered_map<std::string, int> names;
+        std::unordered_map<int, int> imports;      // CALL操作数地址 -> 导入符号序号
+        for (const auto &i : gen.Imports())
+        {
+            auto f = names.find(i.second);
+            if (f == names.end())
+            {
+                f = names.insert(std::make_pair(i.second, (int) symbols_.size())).first;
+                symbols_.push_back(Symbol{ObjImport, 0, 0, i.second});
+            }
+            imports[i.first] = f->second;
+        }
+
+        for (size_t i = 0; i < text_.size(); i += Optimizer::InsLength(text_[i]))
+        {
+            auto op = text_[i];
+            auto opr = (sint) i + 1;
+            if (op == JMP || op == JZ || op == JNZ || op == CALL)
+            {
+                auto f = imports.find(opr);
+                if (f != imports.end())
+                { relocs_.push_back(ObjectReloc{RelocImport, opr, f->second}); }
+                else
+                { relocs_.push_back(ObjectReloc{RelocText, opr, 0}); }
+            }
+            else if (op == IMM && i + 2 < text_.size() && text_[i + 2] == LOAD)
+            { relocs_.push_back(ObjectReloc{RelocData, opr, 0}); }
+        }
+    }
+
+    void Object::Write(std::ostream &os) const
+    {
+        std::vector<ObjectSymbol> symbols;
+        std::string names;
+        for (const auto &s : symbols_)
+        {
+            symbols.push_back(ObjectSymbol{(uint32_t) s.kind, s.value, s.size, (uint32_t) names.size()});
+            names += s.name;
+            names += '\0';
+        }
+
+        ObjectHeader header{};
+        header.magic = OBJECT_MAGIC;
+        header.version = OBJECT_VERSION;
+        header.textSize = (uint32_t) text_.size();
+        header.dataSize = (uint32_t) data_.size();
+        header.symbolCount = (uint32_t) symbols.size();
+        header.relocCount = (uint32_t) relocs_.size();
+        header.namesSize = (uint32_t) names.size();
+
+        os.write((const char *) &header, sizeof(header));
+        os.write((const char *) symbols.data(), (std::streamsize) (symbols.size() * sizeof(ObjectSymbol)));
+        os.write((const char *) relocs_.data(), (std::streamsize) (relocs_.size() * sizeof(ObjectReloc)));
+        os.write(names.data(), (std::streamsize) names.size());
+        os.write((const char *) text_.data(), (std::streamsize) (text_.size() * sizeof(TextType)));
+        os.write((const char *) data_.data(), (std::streamsize) data_.size());
+    }
+
+    bool Object::Is(StringView view)
+    {
+        uint32_t magic = 0;
+        if (view.length() < sizeof(magic))
+        { return false; }
+
+        memcpy(&magic, view.data, sizeof(magic));
+        return magic == OBJECT_MAGIC;
+    }
+
+    bool Object::Load(StringView view)
+    {
+        auto fail = [](const char *why) {
+            printf("invalid object: %s\n", why);
+            return false;
+        };
+        ObjectHeader header;
+        if (!Is(view) || view.length() < sizeof(header))
+        { return fail("bad magic"); }
+        memcpy(&header, view.data, sizeof(header));
+        if (header.version != OBJECT_VERSION)
+        { return fail("unsupported version"); }
+
+        auto size = (uint64_t) sizeof(header) + (uint64_t) header.symbolCount * sizeof(ObjectSymbol) +
+                    (uint64_t) header.relocCount * sizeof(ObjectReloc) + header.namesSize +
+                    (uint64_t) header.textSize * sizeof(TextType) + header.dataSize;
+        if (size != view.length())
+        { return fail("truncated"); }
+
+        // 目标文件较小，拷贝出来，不要求对齐
+        auto p = view.data + sizeof(header);
+        std::vector<ObjectSymbol> symbols(header.symbolCount);
+        relocs_.resize(header.relocCount);
+        text_.resize(header.textSize);
+        data_.resize(header.dataSize);
+        memcpy(symbols.data(), p, symbols.size() * sizeof(ObjectSymbol));
+        p += symbols.size() * sizeof(ObjectSymbol);
+        memcpy(relocs_.data(), p, relocs_.size() * sizeof(ObjectReloc));
+        p += relocs_.size() * sizeof(ObjectReloc);
+        auto names = p;
+        p += header.namesSize;
+        memcpy(text_.data(), p, text_.size() * sizeof(TextType));
+        p += text_.size() * sizeof(TextType);
+        memcpy(data_.data(), p, data_.size());
+
+        if (header.namesSize > 0 && names[header.namesSize - 1] != '\0')
+        { return fail("bad names"); }
+        symbols_.clear();
+        for (const auto &s : symbols)
+        {
+            if (s.name >= header.namesSize || s.kind > ObjImport)
+            { return fail("bad symbol"); }
+            symbols_.push_back(Symbol{(ObjectSymbolKind) s.kind, s.value, s.size, names + s.name});
+        }
+        for (const auto &r : relocs_)
+        {
+            if (r.offset < 0 || (uint32_t) r.offset >= header.textSize || r.kind > RelocImport ||
+                (r.kind == RelocImport && (r.symbol < 0 || (uint32_t) r.symbol >= header.symbolCount)))
+            { return fail("bad relocation"); }
+        }
+        return true;
+    }
+
+    void Linker::Add(Object object)
+    {
+        objects_.push_back(std::move(object));
+    }
+
+    void Linker::Link(bool tier)
+    {
+        text_.clear();
+        data_.clear();
+        funcs_.clear();
+
+        std::unordered_map<std::string, int> funcs;                     // 函数名 -> 入口
+        std::unordered_map<std::string, std::pair<int, int>> globals;   // 全局变量名 -> <地址, 大小>
+        std::vector<int> textBase, dataBase;
+
+        // 1. 合并各段，收集定义
+        for (const auto &obj : objects_)
+        {
+            textBase.push_back((int) text_.size());
+            while(data_.size() % 4 != 0)
+            { data_.push_back(0); }
+            dataBase.push_back((int) data_.size());
+            text_.insert(text_.end(), obj.text_.begin(), obj.text_.end());
+            data_.insert(data_.end(), obj.data_.begin(), obj.data_.end());
+
+            for (const auto &s : obj.symbols_)
+            {
+                if (s.kind == ObjFunc)
+                {
+                    if (!funcs.insert(std::make_pair(s.name, textBase.back() + s.value)).second)
+                    {
+                        printf("duplicate symbol: \"%s\"\n", s.name.c_str());
+                        throw std::exception();
+                    }
+                }
+                else if (s.kind == ObjGlobal)
+                {
+                    auto g = globals.insert(std::make_pair(s.name, std::make_pair(dataBase.back() + s.value, s.size)));
+                    if (!g.second && g.first->second.second != s.size)
+                    {
+                        printf("conflicting types for global: \"%s\"\n", s.name.c_str());
+                        throw std::exception();
+                    }
+                }
+            }
+        }
+
+        // 2. 修正重定位
+        for (size_t k = 0; k < objects_.size(); ++k)
+        {
+            const auto &obj = objects_[k];
+            std::unordered_map<int, const std::string *> locals;       // 本文件全局变量的偏移 -> 名称
+            for (const auto &s : obj.symbols_)
+            {
+                if (s.kind == ObjGlobal)
+                { locals[s.value] = &s.name; }
+            }
+
+            for (const auto &r : obj.relocs_)
+            {
+                auto &opr = text_[textBase[k] + r.offset];
+                switch (r.kind)
+                {
+                    case RelocText:
+                        opr += textBase[k];
+                        break;
+                    case RelocData:
+                    {
+                        auto g = locals.find(opr);
+                        opr = g != locals.end() ? globals[*g->second].first : dataBase[k] + opr;
+                    }
+                        break;
+                    case RelocImport:
+                    {
+                        const auto &name = obj.symbols_[r.symbol].name;
+                        auto f = funcs.find(name);
+                        if (f == funcs.end())
+                        {
+                            printf("undefined symbol: \"%s\"\n", name.c_str());
+                            throw std::exception();
+                        }
+                        opr = f->second;
+                    }
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+
+        auto main = funcs.find("main");
+        if (main == funcs.end())
+        {
+            printf("main() not defined\n");
+            throw std::exception();
+        }
+
+        // 3. 合并后统一优化，跨文件的调用也能内联
+        Optimizer opt(text_);
+        for (const auto &f : funcs)
+        { opt.AddFunc(f.second); }
+        opt.Number();
+        if (!tier)
+        { opt.Optimize(); }
+
+        for (const auto &f : funcs)
+        { funcs_[opt.Relocate(f.second)] = f.first; }
+        entry_ = opt.Relocate(main->second);
+#if LINK_DEBUG
+        printf("[LINK] %d objects, text %d, data %d, entry %d\n", (int) objects_.size(), (int) text_.size(),
+               (int) data_.size(), entry_);
+#endif
+    }
+}
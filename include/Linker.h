@@ -0,0 +1,129 @@
+//
+// Created by yw.
+//
+
+#ifndef DRTCC_LINKER_H
+#define DRTCC_LINKER_H
+
+#include "Type.h"
+#include "Token.h"
+#include "GenCode.h"
+
+#define OBJECT_MAGIC 0x004F5444     // "DTO\0"
+#define OBJECT_VERSION 1
+
+namespace DrTcc
+{
+    // 可重定位字节码目标文件(.dto)，均为小端
+    //   ObjectHeader | ObjectSymbol[] | ObjectReloc[] | names | text | data
+    struct ObjectHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t textSize;          // 指令数
+        uint32_t dataSize;          // 字节数
+        uint32_t symbolCount;
+        uint32_t relocCount;
+        uint32_t namesSize;
+    };
+
+    enum ObjectSymbolKind
+    {
+        ObjFunc,            // 定义的函数, value = 入口
+        ObjGlobal,          // 全局变量, value = data段偏移；各文件的同名全局变量合并为一个(common)
+        ObjImport,          // 只有原型的函数，由其他目标文件定义
+    };
+
+    struct ObjectSymbol
+    {
+        uint32_t kind;
+        sint value;
+        sint size;
+        uint32_t name;              // 名称在names中的偏移
+    };
+
+    enum ObjectRelocKind
+    {
+        RelocText,          // JMP/JZ/JNZ/CALL的目标，加上本文件text的基址
+        RelocData,          // IMM x; LOAD 的data段偏移，指向全局变量时换成合并后的地址
+        RelocImport,        // 调用导入函数，symbol为导入符号的序号
+    };
+
+    struct ObjectReloc
+    {
+        uint32_t kind;
+        sint offset;                // 操作数在text中的位置
+        sint symbol;
+    };
+
+    class Object
+    {
+            using TextType = BaseType<TokenType::Int>::type;
+            using DataType = BaseType<TokenType::Char>::type;
+        public:
+            Object() = default;
+
+            // 由object模式的GenCode构造，重定位项从未优化的字节码中扫描得到
+            explicit Object(const GenCode &gen);
+
+            void Write(std::ostream &os) const;
+
+            static bool Is(StringView view);
+
+            bool Load(StringView view);
+
+        private:
+            friend class Linker;
+
+            struct Symbol
+            {
+                ObjectSymbolKind kind;
+                int value;
+                int size;
+                std::string name;
+            };
+
+            std::vector<TextType> text_;
+            std::vector<DataType> data_;
+            std::vector<Symbol> symbols_;
+            std::vector<ObjectReloc> relocs_;
+    };
+
+    // 字节码链接器: 合并目标文件的text/data段，解析导入函数和同名全局变量，修正重定位后统一优化
+    class Linker
+    {
+            using TextType = BaseType<TokenType::Int>::type;
+            using DataType = BaseType<TokenType::Char>::type;
+        public:
+            Linker() = default;
+
+            ~Linker() = default;
+
+            void Add(Object object);
+
+            // tier为false时对合并后的字节码做优化
+            void Link(bool tier = false);
+
+            const std::vector<TextType> &Text() const
+            { return text_; }
+
+            const std::vector<DataType> &Data() const
+            { return data_; }
+
+            // 函数入口 -> 函数名
+            const std::map<int, std::string> &Funcs() const
+            { return funcs_; }
+
+            int Entry() const
+            { return entry_; }
+
+        private:
+            std::vector<Object> objects_;
+            std::vector<TextType> text_;
+            std::vector<DataType> data_;
+            std::map<int, std::string> funcs_;
+            int entry_{-1};
+    };
+}
+
+#endif //DRTCC_LINKER_H
@@ -452,6 +452,78 @@ namespace DrTcc
             }
     };
 
+    // 线性分配器(bump pointer)
+    // 分配只移动指针，当前块用完时按ChunkSize(或更大)新增一块；对象不单独释放，Clear时整体释放
+    template<size_t ChunkSize = 0x10000>
+    class Arena
+    {
+        public:
+            Arena() = default;
+
+            ~Arena()
+            {
+                for (auto chunk : chunks_)
+                { delete[] chunk; }
+            }
+
+            Arena(const Arena &) = delete;
+
+            Arena &operator=(const Arena &) = delete;
+
+            template<class T>
+            T *Alloc()
+            {
+                return static_cast<T *>(_Alloc(sizeof(T), alignof(T)));
+            }
+
+            template<class T>
+            T *AllocArray(uint count)
+            {
+                return static_cast<T *>(_Alloc(count * sizeof(T), alignof(T)));
+            }
+
+            // 只保留第一块，其余释放
+            void Clear()
+            {
+                for (size_t i = 1; i < chunks_.size(); i++)
+                { delete[] chunks_[i]; }
+
+                if (chunks_.empty())
+                { return; }
+
+                chunks_.resize(1);
+                current_ = chunks_[0];
+                end_ = current_ + ChunkSize;
+            }
+
+        private:
+            void *_Alloc(size_t size, size_t align)
+            {
+                auto p = current_ + ((align - (uintptr_t) current_ % align) % align);
+                if (p == nullptr || size > (size_t) (end_ - p))
+                { return Grow(size, align); }
+
+                current_ = p + size;
+                return p;
+            }
+
+            void *Grow(size_t size, size_t align)
+            {
+                // 超大的分配单独成块
+                auto chunkSize = std::max(ChunkSize, size + align);
+                auto chunk = new char[chunkSize];
+                chunks_.push_back(chunk);
+                current_ = chunk;
+                end_ = chunk + chunkSize;
+                return _Alloc(size, align);
+            }
+
+        private:
+            std::vector<char *> chunks_;
+            char *current_{nullptr};
+            char *end_{nullptr};
+    };
+
     template<size_t DefaultSize = DefaultAllocator<>::DEFAULT_ALLOC_BLOCK_SIZE> using MemoryPool = LegacyMemoryPool<LegacyMemoryPoolAllocator<DefaultAllocator<>, DefaultSize>>;
 }
 
@@ -0,0 +1,480 @@
+//
+// Created by yw.
+//
+
+#include "Native.h"
+#include "Optimizer.h"
+#include "VM.h"
+
+namespace DrTcc
+{
+    Native::Native(const std::vector<TextType> &text, const std::vector<DataType> &data,
+                   const std::map<int, std::string> &funcs, int entry)
+            : text_(text), data_(data), funcs_(funcs), entry_(entry)
+    {
+    }
+
+    void Native::Byte(std::initializer_list<int> bytes)
+    {
+        for (auto b : bytes)
+        { code_.push_back((uint8) b); }
+    }
+
+    void Native::Dword(int value)
+    {
+        for (auto i = 0; i < 4; ++i)
+        { code_.push_back((uint8) (((uint32_t) value >> (i * 8)) & 0xff)); }
+    }
+
+    void Native::Rel32(std::vector<std::pair<int, int>> &fixups, int target)
+    {
+        fixups.emplace_back((int) code_.size(), target);
+        Dword(0);
+    }
+
+    int Native::Extern(const std::string &name)
+    {
+        auto f = std::find(externNames_.begin(), externNames_.end(), name);
+        if (f != externNames_.end())
+        { return (int) (f - externNames_.begin()); }
+        externNames_.push_back(name);
+        return (int) externNames_.size() - 1;
+    }
+
+    void Native::Gen()
+    {
+        if (funcs_.find(entry_) == funcs_.end())
+        {
+            printf("main() not defined\n");
+            throw std::exception();
+        }
+
+        for (auto f = funcs_.begin(); f != funcs_.end(); ++f)
+        {
+            auto next = std::next(f);
+            auto start = (int) code_.size();
+            Func(f->first, next != funcs_.end() ? next->first : (int) text_.size());
+            symbols_.emplace_back(start, (int) code_.size() - start);
+            while(code_.size() % 16 != 0)
+            { Byte({0x90}); }
+        }
+
+        // int drtcc_main(uint32_t sp, unsigned char *base)
+        main_ = (int) code_.size();
+        Byte({0x41, 0x57});                 // push r15
+        Byte({0x49, 0x89, 0xf7});           // mov r15, rsi
+        Byte({0x31, 0xf6});                 // xor esi, esi
+        Byte({0xe8});                       // call main
+        Rel32(calls_, entry_);
+        Byte({0x41, 0x5f});                 // pop r15
+        Byte({0xc3});                       // ret
+
+        for (const auto &j : jumps_)
+        {
+            auto rel = labels_.at(j.second) - (j.first + 4);
+            std::memcpy(&code_[j.first], &rel, 4);
+        }
+        for (const auto &c : calls_)
+        {
+            auto rel = entries_.at(c.second) - (c.first + 4);
+            std::memcpy(&code_[c.first], &rel, 4);
+        }
+    }
+
+    void Native::Func(int begin, int end)
+    {
+        for (auto pc = begin; pc < end; pc += Optimizer::InsLength(text_[pc]))
+        {
+            auto op = text_[pc];
+            if ((op == JMP || op == JZ || op == JNZ) && (text_[pc + 1] < begin || text_[pc + 1] >= end))
+            {
+                printf("native: jump out of function at %d\n", pc);
+                throw std::exception();
+            }
+            if (op == CALL && funcs_.find(text_[pc + 1]) == funcs_.end())
+            {
+                printf("native: call to non-function address %d at %d\n", text_[pc + 1], pc);
+                throw std::exception();
+            }
+        }
+
+        // int f(uint32_t sp, int ax)
+        entries_[begin] = (int) code_.size();
+        Byte({0x53});                       // push rbx
+        Byte({0x41, 0x54});                 // push r12
+        Byte({0x41, 0x55});                 // push r13, 保持rsp 16字节对齐
+        Byte({0x89, 0xfb});                 // mov ebx, edi
+        Byte({0x89, 0xf0});                 // mov eax, esi
+
+        auto push = [this]() {
+            Byte({0x81, 0xeb});                 // sub ebx, 4
+            Dword(4);
+            Byte({0x41, 0x89, 0x04, 0x1f});     // mov [r15+rbx], eax
+        };
+        auto pop = [this]() {
+            Byte({0x41, 0x8b, 0x0c, 0x1f});     // mov ecx, [r15+rbx]
+            Byte({0x81, 0xc3});                 // add ebx, 4
+            Dword(4);
+        };
+        auto ldl = [this](int off) {
+            Byte({0x43, 0x8b, 0x84, 0x27});     // mov eax, [r15+r12+off]
+            Dword(off);
+        };
+        auto cmp = [&](int cc) {
+            pop();
+            Byte({0x39, 0xc1});                 // cmp ecx, eax
+            Byte({0x0f, cc, 0xc0});             // setcc al
+            Byte({0x0f, 0xb6, 0xc0});           // movzx eax, al
+        };
+        auto leave = [this]() {
+            Byte({0x41, 0x5d, 0x41, 0x5c});     // pop r13; pop r12
+            Byte({0x5b, 0xc3});                 // pop rbx; ret
+        };
+
+        for (auto pc = begin; pc < end; pc += Optimizer::InsLength(text_[pc]))
+        {
+            auto op = text_[pc];
+            auto opr = Optimizer::InsLength(op) > 1 ? text_[pc + 1] : 0;
+            labels_[pc] = (int) code_.size();
+            switch (op)
+            {
+                case NOP:
+                    break;
+                case LEA:
+                    Byte({0x41, 0x8d, 0x84, 0x24});     // lea eax, [r12+opr]
+                    Dword(opr);
+                    break;
+                case IMM:
+                    Byte({0xb8});                       // mov eax, opr
+                    Dword(opr);
+                    break;
+                case JMP:
+                    Byte({0xe9});
+                    Rel32(jumps_, opr);
+                    break;
+                case JZ:
+                    Byte({0x85, 0xc0, 0x0f, 0x84});     // test eax, eax; jz
+                    Rel32(jumps_, opr);
+                    break;
+                case JNZ:
+                    Byte({0x85, 0xc0, 0x0f, 0x85});     // test eax, eax; jnz
+                    Rel32(jumps_, opr);
+                    break;
+                case CALL:
+                    // 栈上仍保留返回地址，参数位于 bp+8 之后
+                    Byte({0x81, 0xeb});                 // sub ebx, 4
+                    Dword(4);
+                    Byte({0x41, 0xc7, 0x04, 0x1f});     // mov dword [r15+rbx], ret
+                    Dword((int) (USER_BASE + (pc + 2) * 4));
+                    Byte({0x89, 0xdf, 0x89, 0xc6});     // mov edi, ebx; mov esi, eax
+                    Byte({0xe8});
+                    Rel32(calls_, opr);
+                    Byte({0x81, 0xc3});                 // add ebx, 4
+                    Dword(4);
+                    break;
+                case ENT:
+                    Byte({0x81, 0xeb});                 // sub ebx, 4
+                    Dword(4);
+                    Byte({0x41, 0xc7, 0x04, 0x1f});     // mov dword [r15+rbx], 0
+                    Dword(0);
+                    Byte({0x41, 0x89, 0xdc});           // mov r12d, ebx
+                    Byte({0x81, 0xeb});                 // sub ebx, opr
+                    Dword(opr);
+                    break;
+                case ADJ:
+                    Byte({0x81, 0xc3});                 // add ebx, opr * 4
+                    Dword(opr * 4);
+                    break;
+                case LEV:
+                    leave();
+                    break;
+                case LI:
+                    Byte({0x41, 0x8b, 0x04, 0x07});     // mov eax, [r15+rax]
+                    break;
+                case LC:
+                    Byte({0x41, 0x0f, 0xb6, 0x04, 0x07});   // movzx eax, byte [r15+rax]
+                    break;
+                case SI:
+                    pop();
+                    Byte({0x41, 0x89, 0x04, 0x0f});     // mov [r15+rcx], eax
+                    break;
+                case SC:
+                    pop();
+                    Byte({0x41, 0x88, 0x04, 0x0f});     // mov [r15+rcx], al
+                    break;
+                case PUSH:
+                    push();
+                    break;
+                case LOAD:
+                    Byte({0x25});                       // and eax, PAGE_SIZE - 1
+                    Dword(PAGE_SIZE - 1);
+                    Byte({0x0d});                       // or eax, DATA_BASE
+                    Dword((int) DATA_BASE);
+                    break;
+                case LDL:
+                    ldl(opr);
+                    break;
+                case STL:
+                    Byte({0x43, 0x89, 0x84, 0x27});     // mov [r15+r12+opr], eax
+                    Dword(opr);
+                    break;
+                case PSHI:
+                    push();
+                    Byte({0xb8});
+                    Dword(opr);
+                    break;
+                case PSHL:
+                    push();
+                    ldl(opr);
+                    break;
+                case OR:
+                    pop();
+                    Byte({0x09, 0xc8});                 // or eax, ecx
+                    break;
+                case XOR:
+                    pop();
+                    Byte({0x31, 0xc8});
+                    break;
+                case AND:
+                    pop();
+                    Byte({0x21, 0xc8});
+                    break;
+                case EQ:
+                    cmp(0x94);
+                    break;
+                case NE:
+                    cmp(0x95);
+                    break;
+                case LT:
+                    cmp(0x9c);
+                    break;
+                case GT:
+                    cmp(0x9f);
+                    break;
+                case LE:
+                    cmp(0x9e);
+                    break;
+                case GE:
+                    cmp(0x9d);
+                    break;
+                case SHL:
+                case SHR:
+                    pop();
+                    Byte({0x89, 0xca, 0x89, 0xc1});     // mov edx, ecx; mov ecx, eax
+                    Byte({0xd3, op == SHL ? 0xe2 : 0xfa});  // shl/sar edx, cl
+                    Byte({0x89, 0xd0});                 // mov eax, edx
+                    break;
+                case ADD:
+                    pop();
+                    Byte({0x01, 0xc8});
+                    break;
+                case SUB:
+                    pop();
+                    Byte({0x29, 0xc1, 0x89, 0xc8});     // sub ecx, eax; mov eax, ecx
+                    break;
+                case MUL:
+                    pop();
+                    Byte({0x0f, 0xaf, 0xc1});           // imul eax, ecx
+                    break;
+                case DIV:
+                case MOD:
+                    pop();
+                    Byte({0x91, 0x99, 0xf7, 0xf9});     // xchg eax, ecx; cdq; idiv ecx
+                    if (op == MOD)
+                    { Byte({0x89, 0xd0}); }             // mov eax, edx
+                    break;
+                case EXIT:
+                    Byte({0x89, 0xc7, 0xe8});           // mov edi, eax; call rt_exit
+                    Rel32(externs_, Extern("rt_exit"));
+                    break;
+                case IMX:
+                    Byte({0x0f, 0x0b});                 // ud2
+                    break;
+                default:
+                    Builtin(op, pc);
+                    break;
+            }
+        }
+        leave();
+    }
+
+    void Native::Builtin(int op, int pc)
+    {
+        // 与VM一致，参数个数取自紧随其后的ADJ
+        auto next = pc + Optimizer::InsLength(op);
+        auto n = next + 1 < (int) text_.size() && text_[next] == ADJ ? text_[next + 1] : 0;
+        const char *name;
+        switch (op)
+        {
+            case PRTF:
+                name = "rt_printf";
+                break;
+            case OPEN:
+                name = "rt_open";
+                break;
+            case READ:
+                name = "rt_read";
+                break;
+            case CLOS:
+                name = "rt_close";
+                break;
+            case MALC:
+                name = "rt_malc";
+                break;
+            case MSET:
+                name = "rt_mset";
+                break;
+            case MCMP:
+                name = "rt_mcmp";
+                break;
+            case TRAC:
+                name = "rt_trac";
+                break;
+            case TRAN:
+                name = "rt_tran";
+                break;
+            default:
+                printf("native: unknown instruction %d at %d\n", op, pc);
+                throw std::exception();
+        }
+        Byte({0x89, 0xdf, 0xbe});               // mov edi, ebx; mov esi, n
+        Dword(n);
+        Byte({0xe8});                           // call rt_xxx
+        Rel32(externs_, Extern(name));
+    }
+
+    // ELF64 小端写入
+    static void Put(std::string &buf, uint64_t value, int size)
+    {
+        for (auto i = 0; i < size; ++i)
+        { buf.push_back((char) ((value >> (i * 8)) & 0xff)); }
+    }
+
+    static void Align(std::string &buf, size_t align)
+    {
+        while(buf.size() % align != 0)
+        { buf.push_back(0); }
+    }
+
+    void Native::Write(std::ostream &os)
+    {
+        Gen();
+
+        // .rodata: 数据段, 数据段长度
+        std::string rodata(data_.begin(), data_.end());
+        Align(rodata, 4);
+        auto sizeOffset = rodata.size();
+        Put(rodata, data_.size(), 4);
+
+        // 符号: 局部函数, 全局定义, 外部引用
+        std::string strtab(1, 0), symtab(24, 0);
+        auto name = [&](const std::string &s) {
+            auto off = strtab.size();
+            strtab += s;
+            strtab.push_back(0);
+            return (uint64_t) off;
+        };
+        auto sym = [&](const std::string &s, int info, int shndx, uint64_t value, uint64_t size) {
+            Put(symtab, s.empty() ? 0 : name(s), 4);
+            Put(symtab, (uint64_t) info, 1);
+            Put(symtab, 0, 1);
+            Put(symtab, (uint64_t) shndx, 2);
+            Put(symtab, value, 8);
+            Put(symtab, size, 8);
+        };
+        auto i = 0;
+        for (const auto &f : funcs_)
+        {
+            sym("f_" + f.second, 0x02, 1, (uint64_t) symbols_[i].first, (uint64_t) symbols_[i].second);
+            ++i;
+        }
+        auto firstGlobal = (int) funcs_.size() + 1;
+        sym("drtcc_main", 0x12, 1, (uint64_t) main_, code_.size() - (size_t) main_);
+        sym("drtcc_data", 0x11, 2, 0, data_.size());
+        sym("drtcc_data_size", 0x11, 2, sizeOffset, 4);
+        auto firstExtern = firstGlobal + 3;
+        for (const auto &e : externNames_)
+        { sym(e, 0x10, 0, 0, 0); }
+
+        // .rela.text: R_X86_64_PLT32
+        std::string rela;
+        for (const auto &e : externs_)
+        {
+            Put(rela, (uint64_t) e.first, 8);
+            Put(rela, ((uint64_t) (firstExtern + e.second) << 32) | 4, 8);
+            Put(rela, (uint64_t) -4, 8);
+        }
+
+        std::string shstrtab(1, 0);
+        auto secName = [&](const std::string &s) {
+            auto off = shstrtab.size();
+            shstrtab += s;
+            shstrtab.push_back(0);
+            return (uint64_t) off;
+        };
+
+        struct Section
+        {
+            uint64_t name, type, flags, offset, size, link, info, align, entsize;
+            const std::string *data;
+        };
+        std::string text(code_.begin(), code_.end()), empty;
+        std::vector<Section> sections{
+                {0,                           0, 0,    0, 0, 0, 0,                     0,  0,  &empty},
+                {secName(".text"),            1, 6,    0, 0, 0, 0,                     16, 0,  &text},
+                {secName(".rodata"),          1, 2,    0, 0, 0, 0,                     16, 0,  &rodata},
+                {secName(".rela.text"),       4, 0x40, 0, 0, 4, 1,                     8,  24, &rela},
+                {secName(".symtab"),          2, 0,    0, 0, 5, (uint64_t) firstGlobal, 8, 24, &symtab},
+                {secName(".strtab"),          3, 0,    0, 0, 0, 0,                     1,  0,  &strtab},
+                {secName(".shstrtab"),        3, 0,    0, 0, 0, 0,                     1,  0,  &shstrtab},
+                {secName(".note.GNU-stack"),  1, 0,    0, 0, 0, 0,                     1,  0,  &empty},
+        };
+
+        std::string out(64, 0);
+        for (auto &s : sections)
+        {
+            Align(out, s.align != 0 ? s.align : 1);
+            s.offset = s.type != 0 ? out.size() : 0;
+            s.size = s.data->size();
+            out += *s.data;
+        }
+        Align(out, 8);
+        auto shoff = out.size();
+        for (const auto &s : sections)
+        {
+            Put(out, s.name, 4);
+            Put(out, s.type, 4);
+            Put(out, s.flags, 8);
+            Put(out, 0, 8);
+            Put(out, s.offset, 8);
+            Put(out, s.size, 8);
+            Put(out, s.link, 4);
+            Put(out, s.info, 4);
+            Put(out, s.align, 8);
+            Put(out, s.entsize, 8);
+        }
+
+        // ELF头
+        std::string header("\x7f" "ELF", 4);
+        Put(header, 2, 1);                      // ELFCLASS64
+        Put(header, 1, 1);                      // ELFDATA2LSB
+        Put(header, 1, 1);                      // EV_CURRENT
+        header.resize(16, 0);
+        Put(header, 1, 2);                      // ET_REL
+        Put(header, 62, 2);                     // EM_X86_64
+        Put(header, 1, 4);
+        Put(header, 0, 8);                      // e_entry
+        Put(header, 0, 8);                      // e_phoff
+        Put(header, shoff, 8);
+        Put(header, 0, 4);                      // e_flags
+        Put(header, 64, 2);                     // e_ehsize
+        Put(header, 0, 2);
+        Put(header, 0, 2);
+        Put(header, 64, 2);                     // e_shentsize
+        Put(header, sections.size(), 2);
+        Put(header, 6, 2);                      // e_shstrndx
+        out.replace(0, header.size(), header);
+
+        os.write(out.data(), (std::streamsize) out.size());
+    }
+}
@@ -0,0 +1,63 @@
+//
+// Created by yw.
+//
+
+#ifndef DRTCC_NATIVE_H
+#define DRTCC_NATIVE_H
+
+#include "Type.h"
+#include "Token.h"
+
+namespace DrTcc
+{
+    // 字节码 -> x86-64 可重定位ELF目标文件
+    // 寄存器: eax = ax, ebx = sp, r12d = bp, r15 = 4GB客户地址空间的基址，访存为 [r15 + 32位虚拟地址]
+    // 内建函数调用运行库(Translator::Runtime(os, true))中的rt_*函数，由系统链接器链接
+    class Native
+    {
+            using TextType = BaseType<TokenType::Int>::type;
+            using DataType = BaseType<TokenType::Char>::type;
+        public:
+            // funcs: 函数入口 -> 函数名, entry: main的入口
+            Native(const std::vector<TextType> &text, const std::vector<DataType> &data,
+                   const std::map<int, std::string> &funcs, int entry);
+
+            ~Native() = default;
+
+            void Write(std::ostream &os);
+
+        private:
+            void Gen();
+
+            void Func(int begin, int end);
+
+            void Builtin(int op, int pc);
+
+            void Byte(std::initializer_list<int> bytes);
+
+            void Dword(int value);
+
+            // rel32占位，链接时或Gen结束时修正
+            void Rel32(std::vector<std::pair<int, int>> &fixups, int target);
+
+            int Extern(const std::string &name);
+
+        private:
+            const std::vector<TextType> &text_;
+            const std::vector<DataType> &data_;
+            const std::map<int, std::string> &funcs_;
+            int entry_;
+
+            std::vector<uint8> code_;
+            std::unordered_map<int, int> labels_;         // 字节码地址 -> 机器码偏移
+            std::unordered_map<int, int> entries_;        // 函数入口 -> 机器码偏移(序言)
+            std::vector<std::pair<int, int>> jumps_;      // <rel32位置, 字节码地址>
+            std::vector<std::pair<int, int>> calls_;      // <rel32位置, 函数入口>
+            std::vector<std::pair<int, int>> externs_;    // <rel32位置, 外部符号序号>
+            std::vector<std::string> externNames_;
+            std::vector<std::pair<int, int>> symbols_;    // 函数: <偏移, 长度>, 与funcs_顺序相同
+            int main_{0};                                 // drtcc_main的偏移
+    };
+}
+
+#endif //DRTCC_NATIVE_H
@@ -0,0 +1,1260 @@
+//
+// Created by yw.
+//
+
+#include "Optimizer.h"
+#include "VM.h"
+
+#define OPT_DEBUG 0
+
+namespace DrTcc
+{
+    Optimizer::Optimizer(std::vector<TextType> &text, const Profile *profile) : text_(text), profile_(profile)
+    {
+    }
+
+    void Optimizer::AddFunc(int entry, const FuncProfile *prof)
+    {
+        funcs_.push_back(entry);
+        added_[entry] = prof;
+    }
+
+    int Optimizer::InsLength(int op)
+    {
+        switch (op)
+        {
+            case LEA:
+            case IMM:
+            case JMP:
+            case CALL:
+            case JZ:
+            case JNZ:
+            case ENT:
+            case ADJ:
+            case LDL:
+            case STL:
+            case PSHI:
+            case PSHL:
+                return 2;
+            case IMX:
+                return 3;
+            default:
+                return 1;
+        }
+    }
+
+    static bool IsBinary(int op)
+    {
+        return op >= OR && op <= MOD;
+    }
+
+    static bool IsCommutative(int op)
+    {
+        switch (op)
+        {
+            case OR:
+            case XOR:
+            case AND:
+            case EQ:
+            case NE:
+            case ADD:
+            case MUL:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    static bool IsJump(int op)
+    {
+        return op == JMP || op == JZ || op == JNZ || op == CALL;
+    }
+
+    void Optimizer::Track(int addr)
+    {
+        points_[addr] = addr;
+    }
+
+    void Optimizer::Number()
+    {
+        if (funcs_.empty() || !entries_.empty())
+        { return; }
+
+        // 函数在text段中连续存放，相邻入口之间即为一个函数
+        std::sort(funcs_.begin(), funcs_.end());
+        funcs_.erase(std::unique(funcs_.begin(), funcs_.end()), funcs_.end());
+        if (funcs_.front() != 0)
+        { funcs_.insert(funcs_.begin(), 0); }
+        entries_ = funcs_;
+
+        // 跳转点按函数内的出现顺序编号，优化后仍然跟随原指令
+        profs_.clear();
+        enable_.clear();
+        for (size_t i = 0; i < funcs_.size(); ++i)
+        {
+            auto f = added_.find(funcs_[i]);
+            profs_.push_back(f != added_.end() ? f->second : nullptr);
+            enable_.push_back(f != added_.end());
+
+            auto end = i + 1 < funcs_.size() ? funcs_[i + 1] : (int) text_.size();
+            auto n = 0;
+            for (auto pc = funcs_[i]; pc < end; pc += InsLength(text_[pc]))
+            {
+                auto op = text_[pc];
+                if (op == JMP || op == JZ || op == JNZ)
+                { sites_[pc] = n++; }
+            }
+        }
+    }
+
+    void Optimizer::Optimize()
+    {
+        Number();
+        if (funcs_.empty())
+        { return; }
+
+        RunPass(PassLicm);
+        RunPass(PassCse);
+        if (profile_ != nullptr)
+        {
+            RunPass(PassRotate);
+            RunPass(PassInline);
+        }
+        if (profile_ != nullptr || fuseAll_)
+        { RunPass(PassFuse); }
+    }
+
+    void Optimizer::RunPass(Pass pass)
+    {
+        out_.clear();
+        reloc_.clear();
+        fixups_.clear();
+        newSites_.clear();
+        for (size_t i = 0; i < funcs_.size(); ++i)
+        {
+            auto end = i + 1 < funcs_.size() ? funcs_[i + 1] : (int) text_.size();
+            prof_ = profs_[i];
+            OptimizeFunc(funcs_[i], end, pass, enable_[i] != 0);
+        }
+        prof_ = nullptr;
+        reloc_[(int) text_.size()] = (int) out_.size();
+
+        // 修正跳转和调用地址
+        for (const auto &f : fixups_)
+        {
+            auto r = reloc_.find(f.second);
+            out_[f.first] = r != reloc_.end() ? r->second : f.second;
+        }
+        for (auto &f : funcs_)
+        { f = reloc_[f]; }
+        for (auto &p : points_)
+        {
+            auto r = reloc_.find(p.second);
+            p.second = r != reloc_.end() ? r->second : -1;
+        }
+        sites_.swap(newSites_);
+
+#if OPT_DEBUG
+        printf("[OPT] pass %d, text: %d -> %d\n", pass, (int) text_.size(), (int) out_.size());
+#endif
+        text_.swap(out_);
+        out_.clear();
+    }
+
+    int Optimizer::Relocate(int addr) const
+    {
+        auto f = std::lower_bound(entries_.begin(), entries_.end(), addr);
+        if (f != entries_.end() && *f == addr)
+        { return funcs_[f - entries_.begin()]; }
+        auto p = points_.find(addr);
+        if (p != points_.end())
+        { return p->second; }
+        return addr;
+    }
+
+    void Optimizer::OptimizeFunc(int begin, int end, Pass pass, bool enable)
+    {
+        exprs_.clear();
+        exprMap_.clear();
+        blocks_.clear();
+        nslots_ = 0;
+
+        auto ok = Decode(begin, end);
+        replace_.assign(ins_.size(), -1);
+        save_.assign(ins_.size(), -1);
+        backTo_.assign(ins_.size(), -1);
+        hoist_.clear();
+        rotate_.clear();
+        inline_.clear();
+        fuse_.clear();
+        slots_.clear();
+
+        // 只优化以ENT开头的函数，备用槽位于局部变量之后
+        if (enable && ok && !ins_.empty() && ins_[0].op == ENT)
+        {
+            BuildBlocks();
+            for (auto &blk : blocks_)
+            { Walk(blk); }
+            slots_.assign(exprs_.size(), -1);
+            switch (pass)
+            {
+                case PassLicm:
+                    Hoisting();
+                    break;
+                case PassCse:
+                    Available();
+                    Select();
+                    break;
+                case PassRotate:
+                    Rotating();
+                    break;
+                case PassInline:
+                    Inlining();
+                    break;
+                case PassFuse:
+                    Fusing();
+                    break;
+            }
+        }
+
+        Emit(begin, end);
+    }
+
+    bool Optimizer::Decode(int begin, int end)
+    {
+        return Decode(begin, end, ins_, index_);
+    }
+
+    bool Optimizer::Decode(int begin, int end, std::vector<Ins> &ins, std::unordered_map<int, int> &index) const
+    {
+        ins.clear();
+        index.clear();
+        for (auto pc = begin; pc < end;)
+        {
+            Ins in{text_[pc], {0, 0}, pc};
+            auto len = InsLength(in.op);
+            if (pc + len > end)
+            { return false; }
+            for (auto j = 1; j < len; ++j)
+            { in.opr[j - 1] = text_[pc + j]; }
+            index[pc] = (int) ins.size();
+            ins.push_back(in);
+            pc += len;
+        }
+
+        // 函数内的跳转必须落在指令边界上
+        for (const auto &in : ins)
+        {
+            if (in.op != CALL && IsJump(in.op) && index.find(in.opr[0]) == index.end())
+            { return false; }
+        }
+        return true;
+    }
+
+    bool Optimizer::StackDepth(const std::vector<TextType> &text, int begin, int end,
+                               std::unordered_map<int, int> &depth)
+    {
+        std::vector<Ins> ins;
+        std::unordered_map<int, int> index;
+        for (auto pc = begin; pc < end; pc += InsLength(text[pc]))
+        {
+            Ins in{text[pc], {0, 0}, pc};
+            for (auto j = 1; j < InsLength(in.op) && pc + j < end; ++j)
+            { in.opr[j - 1] = text[pc + j]; }
+            index[pc] = (int) ins.size();
+            ins.push_back(in);
+        }
+        for (const auto &in : ins)
+        {
+            if (in.op != CALL && IsJump(in.op) && index.find(in.opr[0]) == index.end())
+            { return false; }
+        }
+
+        std::vector<int> d;
+        if (!Depth(ins, index, d))
+        { return false; }
+        depth.clear();
+        for (size_t i = 0; i < ins.size(); ++i)
+        { depth[ins[i].addr] = d[i]; }
+        return true;
+    }
+
+    bool Optimizer::Depth(const std::vector<Ins> &ins, const std::unordered_map<int, int> &index,
+                          std::vector<int> &depth)
+    {
+        // 每条指令执行前运行栈上的值个数(相对ENT之后)，各路径不一致时失败
+        depth.assign(ins.size(), -1);
+        if (ins.empty())
+        { return false; }
+
+        std::vector<std::pair<int, int>> work{{0, 0}};
+        while(!work.empty())
+        {
+            auto i = work.back().first;
+            auto d = work.back().second;
+            work.pop_back();
+            if (i >= (int) ins.size() || d < 0)
+            { return false; }
+            if (depth[i] >= 0)
+            {
+                if (depth[i] != d)
+                { return false; }
+                continue;
+            }
+            depth[i] = d;
+
+            const auto &in = ins[i];
+            switch (in.op)
+            {
+                case PUSH:
+                case PSHI:
+                case PSHL:
+                    d++;
+                    break;
+                case SI:
+                case SC:
+                    d--;
+                    break;
+                case ADJ:
+                    d -= in.opr[0];
+                    break;
+                case LEV:
+                    continue;
+                case JMP:
+                    work.emplace_back(index.at(in.opr[0]), d);
+                    continue;
+                case JZ:
+                case JNZ:
+                    work.emplace_back(index.at(in.opr[0]), d);
+                    break;
+                default:
+                    if (IsBinary(in.op))
+                    { d--; }
+                    break;
+            }
+            work.emplace_back(i + 1, d);
+        }
+        return true;
+    }
+
+    void Optimizer::BuildBlocks()
+    {
+        // 基本块的首指令: 函数入口, 跳转目标, 跳转/返回的下一条指令
+        std::vector<char> leader(ins_.size() + 1, 0);
+        leader[0] = 1;
+        for (size_t i = 0; i < ins_.size(); ++i)
+        {
+            auto op = ins_[i].op;
+            if (op == JMP || op == JZ || op == JNZ)
+            {
+                leader[index_[ins_[i].opr[0]]] = 1;
+                leader[i + 1] = 1;
+            }
+            else if (op == LEV)
+            { leader[i + 1] = 1; }
+        }
+        std::vector<char> entry(ins_.size(), 0);
+        for (const auto &p : points_)
+        {
+            auto i = index_.find(p.second);
+            if (i != index_.end())
+            { leader[i->second] = entry[i->second] = 1; }
+        }
+
+        blockOf_.assign(ins_.size(), -1);
+        for (size_t i = 0; i < ins_.size(); ++i)
+        {
+            if (leader[i])
+            {
+                Block blk;
+                blk.first = (int) i;
+                blk.reachable = false;
+                blk.entry = entry[i] != 0;
+                blocks_.push_back(blk);
+            }
+            blocks_.back().last = (int) i;
+            blockOf_[i] = (int) blocks_.size() - 1;
+        }
+
+        for (size_t b = 0; b < blocks_.size(); ++b)
+        {
+            auto &blk = blocks_[b];
+            const auto &in = ins_[blk.last];
+            if (in.op == JMP || in.op == JZ || in.op == JNZ)
+            { blk.succ.push_back(blockOf_[index_[in.opr[0]]]); }
+            if (in.op != JMP && in.op != LEV && b + 1 < blocks_.size())
+            { blk.succ.push_back((int) b + 1); }
+            for (auto s : blk.succ)
+            { blocks_[s].pred.push_back((int) b); }
+        }
+    }
+
+    int Optimizer::Intern(int op, int a, int b)
+    {
+        if (IsCommutative(op) && a > b)
+        { std::swap(a, b); }
+
+        auto k = std::make_tuple(op, a, b);
+        auto f = exprMap_.find(k);
+        if (f != exprMap_.end())
+        { return f->second; }
+
+        Expr e{op, a, b, false, false, op == DIV || op == MOD, {}};
+        if (op != IMM && op != LEA)
+        {
+            for (auto c : {a, b})
+            {
+                if (c < 0)
+                { continue; }
+                const auto &child = exprs_[c];
+                e.load = e.load || child.load;
+                e.other = e.other || child.other;
+                e.trap = e.trap || child.trap;
+                e.mem.insert(e.mem.end(), child.mem.begin(), child.mem.end());
+            }
+        }
+        if (op == LI || op == LC)
+        {
+            auto lo = 0;
+            auto cls = AddrClass(a, lo);
+            e.load = true;
+            if (cls == MemOther)
+            { e.other = true; }
+            else
+            { e.mem.emplace_back(cls, lo, op == LI ? 4 : 1); }
+        }
+
+        exprs_.push_back(e);
+        exprMap_.insert(std::make_pair(k, (int) exprs_.size() - 1));
+        return (int) exprs_.size() - 1;
+    }
+
+    Optimizer::MemClass Optimizer::AddrClass(int key, int &lo) const
+    {
+        const auto &e = exprs_[key];
+        if (e.op == LEA)
+        {
+            lo = e.a;
+            return MemFrame;        // 栈帧上的变量
+        }
+        if (e.op == LOAD && exprs_[e.a].op == IMM)
+        {
+            lo = exprs_[e.a].a & (PAGE_SIZE - 1);
+            return MemData;         // data段上的全局变量
+        }
+        return MemOther;            // 指针，地址未知
+    }
+
+    bool Optimizer::Conflict(int key, const Event &ev) const
+    {
+        const auto &e = exprs_[key];
+        if (!e.load)
+        { return false; }
+        if (ev.cls == MemAll || ev.cls == MemOther || e.other)
+        { return true; }
+        for (const auto &m : e.mem)
+        {
+            if (std::get<0>(m) == ev.cls && std::get<1>(m) < ev.lo + ev.width && ev.lo < std::get<1>(m) + std::get<2>(m))
+            { return true; }
+        }
+        return false;
+    }
+
+    void Optimizer::Kill(const Event &ev, Value &ax, std::vector<Value> &stack) const
+    {
+        if (ax.key >= 0 && Conflict(ax.key, ev))
+        { ax = Value{-1, -1, -1}; }
+        for (auto &v : stack)
+        {
+            if (v.key >= 0 && Conflict(v.key, ev))
+            { v = Value{-1, -1, -1}; }
+        }
+    }
+
+    void Optimizer::Walk(Block &blk)
+    {
+        // 模拟ax和运行栈，给每条产生ax的指令编号
+        // 块入口处ax和栈内容均未知
+        Value ax{-1, -1, -1};
+        std::vector<Value> stack;
+        auto impure = blk.first - 1;    // 最近一条有副作用的指令
+
+        auto pop = [&]() {
+            if (stack.empty())
+            { return Value{-1, -1, -1}; }
+            auto v = stack.back();
+            stack.pop_back();
+            return v;
+        };
+        auto def = [&](int key, int start, int i) {
+            ax = Value{key, key < 0 ? -1 : start, -1};
+            if (key >= 0)
+            { blk.events.push_back(Event{key, ax.start, i, MemAll, 0, 0, false}); }
+        };
+
+        for (auto i = blk.first; i <= blk.last; ++i)
+        {
+            const auto &in = ins_[i];
+            switch (in.op)
+            {
+                case NOP:
+                case JMP:
+                case JZ:
+                case JNZ:
+                case LEV:
+                    break;
+                case IMM:
+                case LEA:
+                    def(Intern(in.op, in.opr[0]), i, i);
+                    break;
+                case LDL:
+                    def(Intern(LI, Intern(LEA, in.opr[0])), i, i);
+                    break;
+                case LOAD:
+                case LI:
+                case LC:
+                    def(ax.key < 0 ? -1 : Intern(in.op, ax.key), ax.start, i);
+                    break;
+                case PUSH:
+                    stack.push_back(Value{ax.key, ax.start, i});
+                    ax.start = -1;
+                    break;
+                case PSHI:
+                case PSHL:
+                    // 压栈和取值在同一条指令中，结果不可替换
+                    stack.push_back(Value{ax.key, ax.start, i});
+                    def(in.op == PSHI ? Intern(IMM, in.opr[0]) : Intern(LI, Intern(LEA, in.opr[0])), -1, i);
+                    break;
+                case SI:
+                case SC:
+                case STL:
+                {
+                    Event ev{-1, -1, i, MemOther, 0, in.op == SC ? 1 : 4, false};
+                    if (in.op == STL)
+                    {
+                        ev.cls = MemFrame;
+                        ev.lo = in.opr[0];
+                    }
+                    else
+                    {
+                        auto addr = pop();
+                        ev.cls = addr.key < 0 ? MemOther : AddrClass(addr.key, ev.lo);
+                    }
+                    blk.events.push_back(ev);
+                    Kill(ev, ax, stack);
+                    ax.start = -1;
+                    impure = i;
+                }
+                    break;
+                case ADJ:
+                    for (auto n = in.opr[0]; n > 0; --n)
+                    { pop(); }
+                    ax.start = -1;
+                    impure = i;
+                    break;
+                case ENT:
+                case IMX:
+                    ax = Value{-1, -1, -1};
+                    impure = i;
+                    break;
+                default:
+                    if (IsBinary(in.op))
+                    {
+                        auto lhs = pop();
+                        auto key = lhs.key < 0 || ax.key < 0 ? -1 : Intern(in.op, lhs.key, ax.key);
+                        auto pure = lhs.start >= 0 && ax.start == lhs.push + 1 && lhs.start > impure;
+                        def(key, pure ? lhs.start : -1, i);
+                    }
+                    else
+                    {
+                        // CALL 以及内建函数，可能修改任意内存
+                        Event ev{-1, -1, i, MemAll, 0, 0, false};
+                        blk.events.push_back(ev);
+                        Kill(ev, ax, stack);
+                        ax = Value{-1, -1, -1};
+                        impure = i;
+                    }
+                    break;
+            }
+        }
+    }
+
+    void Optimizer::Transfer(Block &blk, std::vector<char> &set, bool mark)
+    {
+        for (auto &ev : blk.events)
+        {
+            if (ev.key >= 0)
+            {
+                if (mark)
+                { ev.redundant = set[ev.key] != 0; }
+                set[ev.key] = 1;
+            }
+            else
+            {
+                for (size_t k = 0; k < set.size(); ++k)
+                {
+                    if (set[k] && Conflict((int) k, ev))
+                    { set[k] = 0; }
+                }
+            }
+        }
+    }
+
+    void Optimizer::Available()
+    {
+        // 可用表达式分析: IN[b] = ∩ OUT[pred]
+        std::vector<int> work{0};
+        blocks_[0].reachable = true;
+        while(!work.empty())
+        {
+            auto b = work.back();
+            work.pop_back();
+            for (auto s : blocks_[b].succ)
+            {
+                if (!blocks_[s].reachable)
+                {
+                    blocks_[s].reachable = true;
+                    work.push_back(s);
+                }
+            }
+        }
+
+        auto n = exprs_.size();
+        std::vector<std::vector<char>> out(blocks_.size(), std::vector<char>(n, 1));
+        auto changed = true;
+        while(changed)
+        {
+            changed = false;
+            for (size_t b = 0; b < blocks_.size(); ++b)
+            {
+                auto &blk = blocks_[b];
+                if (!blk.reachable)
+                { continue; }
+                std::vector<char> set(n, b == 0 || blk.entry ? 0 : 1);
+                for (auto p : blk.pred)
+                {
+                    if (!blocks_[p].reachable)
+                    { continue; }
+                    for (size_t k = 0; k < n; ++k)
+                    { set[k] = set[k] && out[p][k]; }
+                }
+                Transfer(blk, set, false);
+                if (set != out[b])
+                {
+                    out[b].swap(set);
+                    changed = true;
+                }
+            }
+        }
+
+        for (size_t b = 0; b < blocks_.size(); ++b)
+        {
+            auto &blk = blocks_[b];
+            std::vector<char> set(n, blk.reachable && b != 0 && !blk.entry ? 1 : 0);
+            for (auto p : blk.pred)
+            {
+                if (!blocks_[p].reachable)
+                { continue; }
+                for (size_t k = 0; k < n; ++k)
+                { set[k] = set[k] && out[p][k]; }
+            }
+            if (!blk.reachable)
+            { std::fill(set.begin(), set.end(), 0); }
+            Transfer(blk, set, true);
+        }
+    }
+
+    void Optimizer::Select()
+    {
+        // 冗余且可替换的计算区间改为从备用槽读取(LDL),
+        // 同一表达式的非冗余计算之后存入备用槽(STL)
+        auto n = exprs_.size();
+        std::vector<std::vector<const Event *>> uses(n);
+        std::vector<int> defs(n, 0), longest(n, 0);
+        for (const auto &blk : blocks_)
+        {
+            for (const auto &ev : blk.events)
+            {
+                if (ev.key < 0)
+                { continue; }
+                if (!ev.redundant)
+                { defs[ev.key]++; }
+                else if (ev.start >= 0 && ev.end > ev.start)
+                {
+                    uses[ev.key].push_back(&ev);
+                    longest[ev.key] = std::max(longest[ev.key], ev.end - ev.start + 1);
+                }
+            }
+        }
+
+        // 大表达式优先，其内部的子表达式随之消除
+        std::vector<int> order;
+        for (size_t k = 0; k < n; ++k)
+        {
+            if (!uses[k].empty())
+            { order.push_back((int) k); }
+        }
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return longest[a] > longest[b]; });
+
+        std::vector<std::pair<int, int>> taken;
+        auto inside = [&](const Event *ev) {
+            for (const auto &r : taken)
+            {
+                if (r.first <= ev->start && ev->end <= r.second)
+                { return true; }
+            }
+            return false;
+        };
+
+        for (auto k : order)
+        {
+            if (nslots_ >= OPT_MAX_SLOTS)
+            { break; }
+            std::vector<const Event *> live;
+            auto benefit = 0;
+            for (auto ev : uses[k])
+            {
+                if (!inside(ev))
+                {
+                    live.push_back(ev);
+                    benefit += ev->end - ev->start;
+                }
+            }
+            if (benefit <= defs[k])
+            { continue; }
+
+            slots_[k] = nslots_++;
+            for (auto ev : live)
+            {
+                replace_[ev->start] = ev->end;
+                taken.emplace_back(ev->start, ev->end);
+            }
+#if OPT_DEBUG
+            printf("[OPT] cse expr #%d: slot %d, %d use(s), %d def(s)\n", k, slots_[k], (int) live.size(), defs[k]);
+#endif
+        }
+
+        for (const auto &blk : blocks_)
+        {
+            for (const auto &ev : blk.events)
+            {
+                if (ev.key >= 0 && !ev.redundant && slots_[ev.key] >= 0)
+                { save_[ev.end] = slots_[ev.key]; }
+            }
+        }
+    }
+
+    void Optimizer::Hoisting()
+    {
+        // 由回边确定循环，循环头之前插入preheader，
+        // 循环内没有被修改的表达式在preheader中计算一次并存入备用槽
+        auto n = blocks_.size();
+        std::map<int, std::vector<char>> loops;     // 循环头 -> 循环体
+        for (size_t b = 0; b < n; ++b)
+        {
+            const auto &in = ins_[blocks_[b].last];
+            if (in.op != JMP && in.op != JZ && in.op != JNZ)
+            { continue; }
+            auto h = blockOf_[index_[in.opr[0]]];
+            if (h > (int) b)
+            { continue; }
+            auto &body = loops[h];
+            if (body.empty())
+            { body.assign(n, 0); }
+            body[h] = 1;
+            std::vector<int> work{(int) b};
+            while(!work.empty())
+            {
+                auto x = work.back();
+                work.pop_back();
+                if (body[x])
+                { continue; }
+                body[x] = 1;
+                for (auto p : blocks_[x].pred)
+                { work.push_back(p); }
+            }
+        }
+
+        // 内层循环(循环头地址较大)执行次数多，优先分配备用槽
+        std::vector<std::pair<int, int>> taken;
+        auto inside = [&](const Event *ev) {
+            for (const auto &r : taken)
+            {
+                if (r.first <= ev->start && ev->end <= r.second)
+                { return true; }
+            }
+            return false;
+        };
+
+        for (auto loop = loops.rbegin(); loop != loops.rend(); ++loop)
+        {
+            auto h = loop->first;
+            const auto &body = loop->second;
+
+            // 循环只能从循环头进入，且循环头不依赖进入时的ax
+            auto op = ins_[blocks_[h].first].op;
+            if (op != IMM && op != LEA && op != LDL)
+            { continue; }
+            if (h > 0 && body[h - 1])
+            { continue; }
+            auto single = true;
+            for (size_t x = 0; x < n; ++x)
+            {
+                if (!body[x] || (int) x == h)
+                { continue; }
+                for (auto p : blocks_[x].pred)
+                {
+                    if (!body[p])
+                    { single = false; }
+                }
+            }
+            if (!single)
+            { continue; }
+
+            // 有剖析数据时，不处理没有执行过回边的冷循环
+            if (prof_ != nullptr)
+            {
+                slong hits = 0;
+                for (size_t x = 0; x < n; ++x)
+                {
+                    auto c = Count(blocks_[x].last);
+                    if (body[x] && c != nullptr && ins_[blocks_[x].last].opr[0] == ins_[blocks_[h].first].addr)
+                    { hits += c->hits; }
+                }
+                if (hits == 0)
+                { continue; }
+            }
+
+            // 循环内的存储和调用
+            std::vector<const Event *> kills;
+            for (size_t x = 0; x < n; ++x)
+            {
+                if (!body[x])
+                { continue; }
+                for (const auto &ev : blocks_[x].events)
+                {
+                    if (ev.key < 0)
+                    { kills.push_back(&ev); }
+                }
+            }
+
+            // 不变量: 不被循环内的存储和调用影响;
+            // 可能除零的表达式不外提，未知地址的读取只在必然执行的循环头中外提
+            std::map<int, std::vector<const Event *>> uses;
+            std::vector<int> order;
+            std::unordered_map<int, int> longest;
+            for (size_t x = 0; x < n; ++x)
+            {
+                if (!body[x])
+                { continue; }
+                for (const auto &ev : blocks_[x].events)
+                {
+                    if (ev.key < 0 || ev.start < 0 || ev.end == ev.start)
+                    { continue; }
+                    const auto &e = exprs_[ev.key];
+                    if (e.trap || (e.other && (int) x != h))
+                    { continue; }
+                    auto invariant = true;
+                    for (auto k : kills)
+                    {
+                        if (Conflict(ev.key, *k))
+                        {
+                            invariant = false;
+                            break;
+                        }
+                    }
+                    if (!invariant)
+                    { continue; }
+                    if (uses.find(ev.key) == uses.end())
+                    { order.push_back(ev.key); }
+                    uses[ev.key].push_back(&ev);
+                    longest[ev.key] = std::max(longest[ev.key], ev.end - ev.start + 1);
+                }
+            }
+            std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return longest[a] > longest[b]; });
+
+            auto head = blocks_[h].first;
+            for (auto k : order)
+            {
+                std::vector<const Event *> live;
+                for (auto ev : uses[k])
+                {
+                    if (!inside(ev))
+                    { live.push_back(ev); }
+                }
+                if (live.empty())
+                { continue; }
+                if (slots_[k] < 0)
+                {
+                    if (nslots_ >= OPT_MAX_SLOTS)
+                    { continue; }
+                    slots_[k] = nslots_++;
+                }
+                hoist_[head].push_back(Hoist{live[0]->start, live[0]->end, slots_[k]});
+                for (auto ev : live)
+                {
+                    replace_[ev->start] = ev->end;
+                    taken.emplace_back(ev->start, ev->end);
+                }
+#if OPT_DEBUG
+                printf("[OPT] licm expr #%d: loop %d, slot %d, %d use(s)\n", k, ins_[head].addr, slots_[k], (int) live.size());
+#endif
+            }
+
+            // 循环内跳回循环头的指令绕过preheader
+            if (hoist_.find(head) != hoist_.end())
+            {
+                for (size_t x = 0; x < n; ++x)
+                {
+                    const auto &in = ins_[blocks_[x].last];
+                    if (body[x] && (in.op == JMP || in.op == JZ || in.op == JNZ) && in.opr[0] == ins_[head].addr)
+                    { backTo_[blocks_[x].last] = head; }
+                }
+            }
+        }
+    }
+
+    void Optimizer::Rotating()
+    {
+        // 热点循环     a: <cond> JZ b; <body> JMP a; b:
+        // 改为         a: <cond> JZ b; c: <body> <cond> JNZ c; b:
+        // 每次迭代少执行一条JMP
+        if (prof_ == nullptr)
+        { return; }
+
+        for (size_t l = 0; l + 1 < ins_.size(); ++l)
+        {
+            const auto &latch = ins_[l];
+            if (latch.op != JMP || latch.opr[0] > latch.addr)
+            { continue; }
+            auto a = index_.at(latch.opr[0]);
+            auto exit = ins_[l + 1].addr;
+
+            // 条件以跳出循环的JZ结尾
+            auto j = -1;
+            for (auto k = a; k < (int) l; ++k)
+            {
+                if (ins_[k].op == JZ && ins_[k].opr[0] == exit)
+                {
+                    j = k;
+                    break;
+                }
+            }
+            if (j < 0 || ins_[j].addr + InsLength(JZ) - ins_[a].addr > OPT_ROTATE_SIZE)
+            { continue; }
+
+            // 条件内的跳转只能落在条件内
+            auto ok = true;
+            for (auto k = a; k < j; ++k)
+            {
+                const auto &in = ins_[k];
+                if (in.op == LEV || in.op == ENT)
+                { ok = false; }
+                if ((in.op == JMP || in.op == JZ || in.op == JNZ) &&
+                    (in.opr[0] < ins_[a].addr || in.opr[0] > ins_[j].addr))
+                { ok = false; }
+            }
+
+            // 平均每次进入循环至少迭代一次
+            auto c = Count(j);
+            if (!ok || c == nullptr || c->hits == c->zero || c->hits - c->zero < c->zero)
+            { continue; }
+            rotate_[(int) l] = std::make_pair(a, j);
+#if OPT_DEBUG
+            printf("[OPT] rotate loop %d, cond %d words\n", ins_[a].addr, ins_[j].addr + 2 - ins_[a].addr);
+#endif
+        }
+    }
+
+    void Optimizer::Inlining()
+    {
+        // 热点函数中调用的小叶子函数(不再调用其他函数)直接展开，
+        // 被调函数的栈帧直接建立在调用者的运行栈上，参数和局部变量按偏移重定位
+        if (prof_ == nullptr || prof_->calls == 0)
+        { return; }
+
+        slong total = 0;
+        for (auto p : profs_)
+        {
+            if (p != nullptr)
+            { total += p->calls; }
+        }
+
+        std::vector<int> depth;
+        if (!Depth(ins_, index_, depth))
+        { return; }
+        auto frame = ins_[0].opr[0];
+
+        for (size_t i = 0; i < ins_.size(); ++i)
+        {
+            if (ins_[i].op != CALL || depth[i] < 0)
+            { continue; }
+            auto f = std::lower_bound(funcs_.begin(), funcs_.end(), ins_[i].opr[0]);
+            if (f == funcs_.end() || *f != ins_[i].opr[0])
+            { continue; }
+            auto n = f - funcs_.begin();
+            auto callee = profs_[n];
+            auto end = n + 1 < (int) funcs_.size() ? funcs_[n + 1] : (int) text_.size();
+            if (callee == nullptr || callee->calls * 100 < total * OPT_HOT_PERCENT || end - *f > OPT_INLINE_SIZE)
+            { continue; }
+
+            Inline x;
+            std::vector<int> d;
+            if (!Decode(*f, end, x.body, x.index) || x.body.empty() || x.body[0].op != ENT)
+            { continue; }
+            auto leaf = Depth(x.body, x.index, d);
+            for (size_t t = 1; leaf && t < x.body.size(); ++t)
+            {
+                auto op = x.body[t].op;
+                if (op == ENT || op == CALL || op == ADJ || op == IMX || op > MOD)
+                { leaf = false; }
+                if (op == LEV && d[t] > 0)
+                { leaf = false; }
+            }
+            if (!leaf)
+            { continue; }
+
+            x.delta = -8 - frame - 4 * depth[i];
+            inline_[(int) i] = x;
+#if OPT_DEBUG
+            printf("[OPT] inline func %d at %d\n", *f, ins_[i].addr);
+#endif
+        }
+    }
+
+    void Optimizer::Fusing()
+    {
+        // 执行频繁的指令组合合并为超级指令:
+        //   LEA k; LI -> LDL k
+        //   PUSH; IMM k -> PSHI k
+        //   PUSH; LEA k; LI -> PSHL k
+        auto hot = [&](int a, int b) {
+            if (fuseAll_)
+            { return true; }
+            if (profile_ == nullptr || profile_->Total() == 0)
+            { return false; }
+            return profile_->Pair(a, b) * 100 >= profile_->Total() * OPT_FUSE_PERCENT;
+        };
+        auto ldl = hot(LEA, LI);
+        auto pshi = hot(PUSH, IMM);
+        auto pshl = ldl && hot(PUSH, LEA);
+
+        for (size_t i = 0; i + 1 < ins_.size(); ++i)
+        {
+            auto same = [&](size_t k) { return k < ins_.size() && blockOf_[k] == blockOf_[i]; };
+            const auto &a = ins_[i];
+            const auto &b = ins_[i + 1];
+            if (!same(i + 1))
+            { continue; }
+
+            if (pshl && a.op == PUSH && b.op == LDL)
+            { fuse_[(int) i] = std::make_pair(PSHL, 2); }
+            else if (pshl && a.op == PUSH && b.op == LEA && same(i + 2) && ins_[i + 2].op == LI)
+            { fuse_[(int) i] = std::make_pair(PSHL, 3); }
+            else if (pshi && a.op == PUSH && b.op == IMM)
+            { fuse_[(int) i] = std::make_pair(PSHI, 2); }
+            else if (ldl && a.op == LEA && b.op == LI)
+            { fuse_[(int) i] = std::make_pair(LDL, 2); }
+            else
+            { continue; }
+            i += fuse_[(int) i].second - 1;
+        }
+    }
+
+    const SiteCount *Optimizer::Count(int i) const
+    {
+        if (prof_ == nullptr)
+        { return nullptr; }
+        auto s = sites_.find(ins_[i].addr);
+        if (s == sites_.end() || s->second >= (int) prof_->sites.size())
+        { return nullptr; }
+        return &prof_->sites[s->second];
+    }
+
+    void Optimizer::Put(const Ins &in)
+    {
+        // 跳转点编号跟随指令(包括复制出的指令)
+        auto s = sites_.find(in.addr);
+        if (s != sites_.end() && (in.op == JMP || in.op == JZ || in.op == JNZ))
+        { newSites_[(int) out_.size()] = s->second; }
+        out_.push_back(in.op);
+    }
+
+    void Optimizer::Emit(int begin, int end)
+    {
+        auto frame = !ins_.empty() && ins_[0].op == ENT ? ins_[0].opr[0] : 0;
+        auto slot = [&](int s) { return -(frame + 4 * (s + 1)); };
+        std::unordered_map<int, int> inner;     // 循环头 -> preheader之后的地址
+
+        for (size_t i = 0; i < ins_.size(); ++i)
+        {
+            const auto &in = ins_[i];
+            reloc_[in.addr] = (int) out_.size();
+
+            auto h = hoist_.find((int) i);
+            if (h != hoist_.end())
+            {
+                // preheader
+                for (const auto &x : h->second)
+                {
+                    for (auto j = x.start; j <= x.end; ++j)
+                    {
+                        out_.push_back(ins_[j].op);
+                        for (auto k = 1; k < InsLength(ins_[j].op); ++k)
+                        { out_.push_back(ins_[j].opr[k - 1]); }
+                    }
+                    out_.push_back(STL);
+                    out_.push_back(slot(x.slot));
+                }
+                inner[(int) i] = (int) out_.size();
+            }
+
+            if (replace_[i] >= 0)
+            {
+                // 整段替换为一条LDL
+                auto last = replace_[i];
+                auto key = -1;
+                for (const auto &ev : blocks_[blockOf_[last]].events)
+                {
+                    if (ev.key >= 0 && ev.end == last)
+                    { key = ev.key; }
+                }
+                out_.push_back(LDL);
+                out_.push_back(slot(slots_[key]));
+                i = (size_t) last;
+                continue;
+            }
+
+            auto r = rotate_.find((int) i);
+            if (r != rotate_.end())
+            {
+                // 回边JMP替换为条件的副本，副本内的跳转指向副本自身
+                auto base = (int) out_.size() - ins_[r->second.first].addr;
+                for (auto k = r->second.first; k <= r->second.second; ++k)
+                {
+                    auto x = ins_[k];
+                    if (k == r->second.second)
+                    {
+                        x.op = JNZ;
+                        Put(x);
+                        fixups_.emplace_back((int) out_.size(), ins_[k + 1].addr);
+                        out_.push_back(0);
+                        continue;
+                    }
+                    Put(x);
+                    for (auto j = 1; j < InsLength(x.op); ++j)
+                    { out_.push_back(IsJump(x.op) && x.op != CALL ? base + x.opr[j - 1] : x.opr[j - 1]); }
+                    if (x.op == CALL)
+                    { fixups_.emplace_back((int) out_.size() - 1, x.opr[0]); }
+                }
+                continue;
+            }
+
+            auto c = inline_.find((int) i);
+            if (c != inline_.end())
+            {
+                const auto &x = c->second;
+                auto size = (int) x.body.size();
+                auto k = x.body[0].opr[0];
+                auto words = (k + 8) / 4;
+                if (k > 0)
+                {
+                    out_.push_back(ADJ);
+                    out_.push_back(-words);
+                }
+
+                // 先计算副本中每条指令的位置
+                std::vector<int> pos((size_t) size + 1);
+                auto p = (int) out_.size();
+                for (auto t = 1; t < size; ++t)
+                {
+                    pos[t] = p;
+                    if (x.body[t].op == LEV)
+                    { p += (k > 0 ? 2 : 0) + (t + 1 < size ? 2 : 0); }
+                    else
+                    { p += InsLength(x.body[t].op); }
+                }
+                pos[size] = p;
+
+                for (auto t = 1; t < size; ++t)
+                {
+                    const auto &y = x.body[t];
+                    switch (y.op)
+                    {
+                        case LEV:
+                            if (k > 0)
+                            {
+                                out_.push_back(ADJ);
+                                out_.push_back(words);
+                            }
+                            if (t + 1 < size)
+                            {
+                                out_.push_back(JMP);
+                                out_.push_back(pos[size]);
+                            }
+                            break;
+                        case JMP:
+                        case JZ:
+                        case JNZ:
+                            out_.push_back(y.op);
+                            out_.push_back(pos[x.index.at(y.opr[0])]);
+                            break;
+                        case LEA:
+                        case LDL:
+                        case STL:
+                        case PSHL:
+                            out_.push_back(y.op);
+                            out_.push_back(y.opr[0] + x.delta);
+                            break;
+                        default:
+                            out_.push_back(y.op);
+                            for (auto j = 1; j < InsLength(y.op); ++j)
+                            { out_.push_back(y.opr[j - 1]); }
+                            break;
+                    }
+                }
+                continue;
+            }
+
+            auto f = fuse_.find((int) i);
+            if (f != fuse_.end())
+            {
+                out_.push_back(f->second.first);
+                out_.push_back(f->second.first == LDL ? in.opr[0] : ins_[i + 1].opr[0]);
+                i += f->second.second - 1;
+                continue;
+            }
+
+            Put(in);
+            auto len = InsLength(in.op);
+            for (auto j = 1; j < len; ++j)
+            {
+                if (backTo_[i] >= 0)
+                {
+                    out_.push_back(inner[backTo_[i]]);
+                    continue;
+                }
+                if (IsJump(in.op))
+                { fixups_.emplace_back((int) out_.size(), in.opr[j - 1]); }
+                if (in.op == ENT)
+                { out_.push_back(in.opr[j - 1] + 4 * nslots_); }
+                else
+                { out_.push_back(in.opr[j - 1]); }
+            }
+
+            if (save_[i] >= 0)
+            {
+                out_.push_back(STL);
+                out_.push_back(slot(save_[i]));
+            }
+        }
+
+        // 无法解码的尾部原样保留
+        auto pc = ins_.empty() ? begin : ins_.back().addr + InsLength(ins_.back().op);
+        for (; pc < end; ++pc)
+        {
+            reloc_[pc] = (int) out_.size();
+            out_.push_back(text_[pc]);
+        }
+    }
+}
@@ -0,0 +1,221 @@
+//
+// Created by yw.
+//
+
+#ifndef DRTCC_OPTIMIZER_H
+#define DRTCC_OPTIMIZER_H
+
+#include "Type.h"
+#include "Token.h"
+#include "Profile.h"
+
+/* 每个函数最多使用的备用栈槽数(每槽4B，栈只有4KB) */
+#define OPT_MAX_SLOTS 4
+/* 以下为剖析数据驱动的优化 */
+/* 循环条件复制到循环末尾的最大长度(字) */
+#define OPT_ROTATE_SIZE 32
+/* 内联函数的最大长度(字) */
+#define OPT_INLINE_SIZE 48
+/* 调用次数占全部调用的百分比不低于此值的函数为热点函数 */
+#define OPT_HOT_PERCENT 5
+/* 指令对执行次数占全部指令的百分比不低于此值时合并为超级指令 */
+#define OPT_FUSE_PERCENT 1
+
+namespace DrTcc
+{
+    // 字节码优化器
+    // 以函数为单位对GenCode生成的字节码做优化，优化后重新排布text段并修正跳转地址
+    class Optimizer
+    {
+            using TextType = BaseType<TokenType::Int>::type;
+        public:
+            explicit Optimizer(std::vector<TextType> &text, const Profile *profile = nullptr);
+
+            ~Optimizer() = default;
+
+            // 登记函数入口及其剖析数据
+            void AddFunc(int entry, const FuncProfile *prof = nullptr);
+
+            // 跟踪函数内的地址(如循环头)，优化后可用Relocate查询新地址
+            // 跟踪地址处不沿用之前算出的公共子表达式，从此处进入时不依赖备用槽的值
+            void Track(int addr);
+
+            // 没有剖析数据时也合并超级指令
+            void SetFuse(bool enable)
+            { fuseAll_ = enable; }
+
+            // 给跳转点编号
+            void Number();
+
+            void Optimize();
+
+            // 跳转点: 地址 -> 函数内编号
+            const std::unordered_map<int, int> &Sites() const
+            { return sites_; }
+
+            // 函数入口或跟踪地址的旧地址 -> 优化后地址, -1 表示已被优化掉
+            int Relocate(int addr) const;
+
+            static int InsLength(int op);
+
+            // 函数内每条指令执行前运行栈上的值个数: 地址 -> 个数
+            static bool StackDepth(const std::vector<TextType> &text, int begin, int end,
+                                   std::unordered_map<int, int> &depth);
+
+        private:
+            enum Pass
+            {
+                PassLicm,       // 循环不变量外提
+                PassCse,        // 公共子表达式消除
+                PassRotate,     // 热点循环的条件复制到循环末尾，去掉回边JMP
+                PassInline,     // 内联热点叶子函数
+                PassFuse,       // 合并超级指令
+            };
+
+            // 解码后的指令
+            struct Ins
+            {
+                int op;
+                int opr[2];
+                int addr;
+            };
+
+            // 表达式(值编号), 叶子为IMM/LEA, 其余为对子表达式的运算
+            struct Expr
+            {
+                int op;
+                int a, b;
+                bool load;      // 依赖内存
+                bool other;     // 依赖未知地址的内存
+                bool trap;      // 可能出错(除零)，不可提前计算
+                std::vector<std::tuple<int, int, int>> mem;     // 已知地址的读取 <段, 偏移, 宽度>
+            };
+
+            // 存储/调用对内存的影响
+            enum MemClass
+            {
+                MemOther, MemFrame, MemData, MemAll
+            };
+
+            struct Event
+            {
+                int key;            // 表达式, -1 表示kill事件
+                int start, end;     // 计算该表达式的指令区间, start = -1 表示不可替换
+                MemClass cls;
+                int lo, width;
+                bool redundant;
+            };
+
+            struct Block
+            {
+                int first, last;
+                std::vector<int> succ, pred;
+                std::vector<Event> events;
+                bool reachable;
+                bool entry;         // 从跟踪地址开始的块
+            };
+
+            // 外提到循环前计算的表达式
+            struct Hoist
+            {
+                int start, end;
+                int slot;
+            };
+
+            // 内联的被调函数
+            struct Inline
+            {
+                std::vector<Ins> body;
+                std::unordered_map<int, int> index;
+                int delta;      // 被调函数bp相对调用者bp的偏移
+            };
+
+            // 符号栈/ax中的值
+            struct Value
+            {
+                int key;
+                int start;
+                int push;
+            };
+
+            void RunPass(Pass pass);
+
+            void OptimizeFunc(int begin, int end, Pass pass, bool enable);
+
+            bool Decode(int begin, int end);
+
+            bool Decode(int begin, int end, std::vector<Ins> &ins, std::unordered_map<int, int> &index) const;
+
+            static bool Depth(const std::vector<Ins> &ins, const std::unordered_map<int, int> &index,
+                              std::vector<int> &depth);
+
+            void BuildBlocks();
+
+            void Walk(Block &blk);
+
+            void Available();
+
+            void Transfer(Block &blk, std::vector<char> &set, bool mark);
+
+            void Select();
+
+            void Hoisting();
+
+            void Rotating();
+
+            void Inlining();
+
+            void Fusing();
+
+            const SiteCount *Count(int i) const;
+
+            void Put(const Ins &in);
+
+            void Emit(int begin, int end);
+
+            int Intern(int op, int a, int b = -1);
+
+            MemClass AddrClass(int key, int &lo) const;
+
+            bool Conflict(int key, const Event &ev) const;
+
+            void Kill(const Event &ev, Value &ax, std::vector<Value> &stack) const;
+
+        private:
+            std::vector<TextType> &text_;
+            std::vector<TextType> out_;
+            const Profile *profile_;
+            std::unordered_map<int, const FuncProfile *> added_;
+            std::vector<int> entries_;                    // 函数入口(原地址)
+            std::vector<int> funcs_;                      // 函数入口(当前地址)
+            std::vector<const FuncProfile *> profs_;      // 与funcs_对应
+            std::vector<char> enable_;                    // 与funcs_对应, 未登记的区间原样保留
+            std::unordered_map<int, int> points_;         // 跟踪地址: 原地址 -> 当前地址
+            bool fuseAll_{false};
+            std::unordered_map<int, int> sites_;          // 跳转点: 地址 -> 编号
+            std::unordered_map<int, int> newSites_;
+            std::unordered_map<int, int> reloc_;
+            std::vector<std::pair<int, int>> fixups_;     // <新位置, 旧目标>
+
+            // 当前函数
+            std::vector<Ins> ins_;
+            std::unordered_map<int, int> index_;          // 地址 -> 指令序号
+            std::vector<Block> blocks_;
+            std::vector<int> blockOf_;
+            std::vector<Expr> exprs_;
+            std::map<std::tuple<int, int, int>, int> exprMap_;
+            std::vector<int> slots_;                      // 表达式 -> 槽号
+            std::vector<int> replace_;                    // 指令序号 -> 被替换区间的结束, -1 不替换
+            std::vector<int> save_;                       // 指令序号 -> 保存到的槽号, -1 不保存
+            std::unordered_map<int, std::vector<Hoist>> hoist_;     // 循环头指令序号 -> 外提的表达式
+            std::vector<int> backTo_;                     // 指令序号 -> 回边跳转到的循环头, -1 不是回边
+            std::unordered_map<int, std::pair<int, int>> rotate_;   // 回边JMP序号 -> 复制的条件区间
+            std::unordered_map<int, Inline> inline_;      // CALL序号 -> 内联的函数体
+            std::unordered_map<int, std::pair<int, int>> fuse_;     // 指令序号 -> <超级指令, 合并的指令数>
+            const FuncProfile *prof_{nullptr};
+            int nslots_{0};
+    };
+}
+
+
+#endif //DRTCC_OPTIMIZER_H
@@ -3,20 +3,25 @@
 //
 
 #include "Parser.h"
+#include <thread>
 
 #define Tokenize 0
 #define GEN_AST 0
+#define PARSER_DEBUG 0
 
 namespace DrTcc
 {
-    Parser::Parser(std::string str)
+    Parser::Parser(StringView str, Preprocessor *pp)
     {
         lexer.Input(str);
+        lexer.Pretokenize(std::thread::hardware_concurrency());
+        if (pp != nullptr)
+        { pp->Run(lexer); }
     }
 
     AstNode *Parser::Parse()
     {
-        // 清空词法分析结果
+        // 回到第一个词
         lexer.Reset();
         ast.Reset();
         
@@ -113,7 +118,7 @@ namespace DrTcc
             { Error("Bad global declaration"); }
 
             // 得到identifier
-            auto id = lexer.GetBagsIdentifier();
+            const auto &id = lexer.Name(lexer.GetBagsIdentifier());
             MatchType(TokenType::Identifier);
 
             // 函数声明
@@ -227,13 +232,20 @@ namespace DrTcc
     void Parser::FunctionDeclaration()
     {   // 函数声明
         // returnType funcName (..) {}
+#if PARSER_DEBUG
         printf("***FunctionDeclaration***\n");
+#endif
 
         MatchOperator(OperatorType::Lparan);
         ast.NewChild(AstNodeType::AstParam);
         FunctionParameter();
         ast.Convert(AstToType::ToParent);
         MatchOperator(OperatorType::Rparan);    // ')'
+
+        // 函数原型 returnType funcName (..); 没有函数体，由其他文件或后文定义
+        if (lexer.IsOperator(OperatorType::Semi))
+        { return; }
+
         MatchOperator(OperatorType::Lbrace);    // '{'
         ast.NewChild(AstNodeType::AstBlock);
         FunctionBody();
@@ -242,7 +254,9 @@ namespace DrTcc
 
     void Parser::FunctionParameter()
     {
+#if PARSER_DEBUG
         printf("***FunctionParameter***\n");
+#endif
         // 判断参数右括号结尾
         // int par1, int par2
         while(!lexer.IsOperator(OperatorType::Rparan))
@@ -263,7 +277,7 @@ namespace DrTcc
                 Error("bad parameter declaration");
             }
 
-            auto id = lexer.GetBagsIdentifier();
+            const auto &id = lexer.Name(lexer.GetBagsIdentifier());
             MatchType(TokenType::Identifier);
 
             ast.NewChild(AstNodeType::AstVarParam);
@@ -306,7 +320,7 @@ namespace DrTcc
             auto idNode = ast.NewChild(AstNodeType::AstId, false);
             auto intValueNode = ast.NewChild(AstNodeType::AstInt, false);
 
-            ast.SetId(idNode, lexer.GetBagsIdentifier());
+            ast.SetId(idNode, lexer.Name(lexer.GetBagsIdentifier()));
             intValueNode->data._int = i++;
             ast.Convert(AstToType::ToParent);
 
@@ -325,7 +339,9 @@ namespace DrTcc
         // {
         //      parse here -> Function Body
         // }
+#if PARSER_DEBUG
         printf("***FunctionBody***\n");
+#endif
 
         {
             // 1. local declarations
@@ -350,7 +366,7 @@ namespace DrTcc
                     if (!lexer.IsType(TokenType::Identifier))
                     { Error("bad local declaration"); }
 
-                    auto id = lexer.GetBagsIdentifier();
+                    const auto &id = lexer.Name(lexer.GetBagsIdentifier());
                     MatchType(TokenType::Identifier);
 
                     ast.NewChild(AstNodeType::AstVarLocal);
@@ -598,7 +614,7 @@ namespace DrTcc
             // 2. Enum variable 枚举值
             // 3. global/local variable 全局/局部变量名
 
-            auto id = lexer.GetBagsIdentifier();
+            const auto &id = lexer.Name(lexer.GetBagsIdentifier());
             MatchType(TokenType::Identifier);
 
             if (lexer.IsOperator(OperatorType::Lparan))  // FUNCTION CALL
@@ -608,7 +624,7 @@ namespace DrTcc
                 ast.SetId(node, id);
 #if GEN_AST
                 printf("-----> [%04d:%03d] AST - Function Call > '%s'\n", lexer.GetLine(), lexer.GetColumn(),
-                       lexer.GetBagsIdentifier().c_str());
+                       lexer.Name(lexer.GetBagsIdentifier()).c_str());
 #endif
                 // arguments
                 while(!lexer.IsOperator(OperatorType::Rparan))
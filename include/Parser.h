@@ -7,13 +7,15 @@
 
 #include "Lexer.h"
 #include "AST.h"
+#include "Preprocessor.h"
 
 namespace DrTcc
 {
     class Parser
     {
         public:
-            explicit Parser(std::string str);
+            // 只引用源码，不拷贝；pp不为空时分词后先做预处理
+            explicit Parser(StringView str, Preprocessor *pp = nullptr);
 
             ~Parser() = default;
 
@@ -22,6 +24,10 @@ namespace DrTcc
             AstNode *root()
             { return ast.GetRoot(); }
 
+            // Parse之后调用，展开为紧凑AST供生成代码使用
+            AstTree Compact()
+            { return ast.Compact(); }
+
         private:
             void Next();
 
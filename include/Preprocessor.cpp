@@ -0,0 +1,797 @@
+//
+// Created by yw.
+//
+
+#include "Preprocessor.h"
+#include <sys/stat.h>
+
+#define PP_DEBUG 0
+
+namespace DrTcc
+{
+    // 行首的#开始一条预处理指令
+    static bool IsDirective(const Lexer &lexer, uint i)
+    {
+        const auto &s = lexer.Stream();
+        return s.kinds[i] == TokenType::Operator && (OperatorType) s.payloads[i] == OperatorType::Sharp &&
+               (i == 0 || s.lastLines[i] > s.lines[i - 1]);
+    }
+
+    // 指令名，须与#在同一行
+    static std::string DirectiveName(const Lexer &lexer, uint i, uint end)
+    {
+        const auto &s = lexer.Stream();
+        if (i + 1 >= end || s.lastLines[i + 1] != s.lastLines[i])
+        { return std::string(); }
+        return lexer.Spelling(i + 1);
+    }
+
+    // 整个文件包在 #ifndef X / #define X ... #endif 中时返回X，再次包含时可直接跳过
+    static std::string Guard(const Lexer &lexer)
+    {
+        const auto &s = lexer.Stream();
+        auto n = s.kinds.empty() ? 0 : (uint) s.kinds.size() - 1;
+        if (n < 6 || !IsDirective(lexer, 0) || DirectiveName(lexer, 0, n) != "ifndef" ||
+            s.kinds[2] != TokenType::Identifier || !IsDirective(lexer, 3) || DirectiveName(lexer, 3, n) != "define" ||
+            s.kinds[5] != TokenType::Identifier || s.payloads[5] != s.payloads[2])
+        { return std::string(); }
+
+        // 与开头的#ifndef配对的#endif须在最后一行
+        auto depth = 0;
+        for (uint i = 0; i < n; i++)
+        {
+            if (!IsDirective(lexer, i))
+            { continue; }
+            auto name = DirectiveName(lexer, i, n);
+            if (name == "if" || name == "ifdef" || name == "ifndef")
+            { depth++; }
+            else if (name == "endif" && --depth == 0)
+            {
+                auto j = i + 1;
+                while(j < n && s.lastLines[j] == s.lastLines[i])
+                { j++; }
+                return j == n ? lexer.Name(s.payloads[2]) : std::string();
+            }
+        }
+        return std::string();
+    }
+
+    std::shared_ptr<const Header> HeaderCache::Get(const std::string &path)
+    {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || (st.st_mode & S_IFMT) != S_IFREG)
+        { return nullptr; }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto f = headers_.find(path);
+        if (f != headers_.end() && f->second->mtime == (int64_t) st.st_mtime && f->second->size == (uint64_t) st.st_size)
+        {
+            hits_++;
+            return f->second;
+        }
+
+        auto header = std::make_shared<Header>();
+        if (!header->source.Open(path))
+        { return nullptr; }
+        header->mtime = (int64_t) st.st_mtime;
+        header->size = (uint64_t) st.st_size;
+        if (header->source.View().length() > 0)
+        {
+            header->lexer.Input(header->source.View());
+            header->lexer.Pretokenize();
+        }
+        header->guard = Guard(header->lexer);
+#if PP_DEBUG
+        printf("[PP] lex %s, guard: %s\n", path.c_str(), header->guard.c_str());
+#endif
+        misses_++;
+        headers_[path] = header;
+        return header;
+    }
+
+    Preprocessor::Preprocessor(std::string file, HeaderCache &headers, std::vector<std::string> dirs)
+            : file_(std::move(file)), headers_(headers), dirs_(std::move(dirs))
+    {}
+
+    void Preprocessor::Run(Lexer &lexer)
+    {
+        // 没有指令就没有宏，词流保持原样
+        const auto &s = lexer.Stream();
+        auto n = (uint) s.kinds.size() - 1;     // 末尾为TokenEnd
+        auto any = false;
+        for (uint i = 0; i < n && !any; i++)
+        { any = IsDirective(lexer, i); }
+        if (!any)
+        { return; }
+
+        main_ = &lexer;
+        File(lexer, file_, PP_NO_SITE, 0);
+
+        TokenStream out;
+        for (const auto &t : out_)
+        { lexer.Copy(out, *t.lexer, t.index, t.site); }
+        lexer.Copy(out, lexer, n, n);
+        lexer.Replace(std::move(out));
+
+        out_.clear();
+        scratch_.clear();
+        used_.clear();
+    }
+
+    void Preprocessor::File(const Lexer &lexer, const std::string &path, uint site, int depth)
+    {
+        const auto &s = lexer.Stream();
+        Input in{&lexer, 0, s.kinds.empty() ? 0 : (uint) s.kinds.size() - 1, site, conds_.size(), path};
+        while(true)
+        {
+            if (pending_.empty())
+            {
+                if (in.pos >= in.end)
+                { break; }
+                if (IsDirective(lexer, in.pos))
+                {
+                    Directive(in, depth);
+                    continue;
+                }
+                if (!Active())
+                {
+                    in.pos++;
+                    continue;
+                }
+            }
+            Tok t;
+            Take(in, t);
+            Expand(t, in);
+        }
+
+        if (conds_.size() != in.base)
+        { Error(Site(in, in.end > 0 ? in.end - 1 : 0), "unterminated conditional directive"); }
+    }
+
+    void Preprocessor::Directive(Input &in, int depth)
+    {
+        const auto &s = in.lexer->Stream();
+        auto hash = in.pos;
+        auto site = Site(in, hash);
+
+        // 取出指令所在行的词，行尾的'\'续行
+        std::vector<Tok> line;
+        auto row = s.lastLines[hash];
+        auto i = hash + 1;
+        for (; i < in.end; i++)
+        {
+            if (s.lastLines[i] != row)
+            {
+                if (line.empty() || !IsOp(line.back(), OperatorType::Escape) ||
+                    s.lastLines[i] != s.lines[line.back().index] + 1)
+                { break; }
+                line.pop_back();
+                row = s.lastLines[i];
+            }
+            line.push_back(Tok{in.lexer, i, Site(in, i), nullptr});
+        }
+        in.pos = i;
+        if (line.empty())
+        { return; }     // 空指令
+
+        auto name = Spell(line[0]);
+        auto parent = Active();
+        if (name == "if" || name == "ifdef" || name == "ifndef")
+        {
+            auto v = false;
+            if (parent)
+            {
+                if (name == "if")
+                { v = Eval(line, site); }
+                else
+                {
+                    if (line.size() < 2 || MacroName(line[1]).empty())
+                    { Error(site, "no macro name given in #" + name + " directive"); }
+                    v = (macros_.find(MacroName(line[1])) != macros_.end()) == (name == "ifdef");
+                }
+            }
+            conds_.push_back(Cond{v, v, parent, false});
+            return;
+        }
+        if (name == "elif" || name == "else" || name == "endif")
+        {
+            if (conds_.size() <= in.base)
+            { Error(site, "#" + name + " without #if"); }
+            auto &c = conds_.back();
+            if (name == "endif")
+            { conds_.pop_back(); }
+            else if (c.done)
+            { Error(site, "#" + name + " after #else"); }
+            else if (name == "else")
+            {
+                c.active = c.parent && !c.taken;
+                c.taken = true;
+                c.done = true;
+            }
+            else
+            {
+                c.active = c.parent && !c.taken && Eval(line, site);
+                c.taken = c.taken || c.active;
+            }
+            return;
+        }
+
+        // 不生效的分支里其余指令都忽略
+        if (!parent)
+        { return; }
+
+        if (name == "define")
+        { Define(line, site); }
+        else if (name == "undef")
+        {
+            if (line.size() < 2 || MacroName(line[1]).empty())
+            { Error(site, "no macro name given in #undef directive"); }
+            macros_.erase(MacroName(line[1]));
+        }
+        else if (name == "include")
+        { Include(in, line, depth); }
+        else if (name == "pragma")
+        {
+            if (line.size() > 1 && Spell(line[1]) == "once")
+            { once_.insert(in.path); }     // 其他pragma忽略
+        }
+        else if (name == "error")
+        {
+            std::string info = "#error";
+            for (size_t k = 1; k < line.size(); k++)
+            { info += " " + Spell(line[k]); }
+            Error(site, info);
+        }
+        else if (name != "line" && name != "warning")
+        { Error(site, "invalid preprocessing directive #" + name); }
+    }
+
+    void Preprocessor::Define(const std::vector<Tok> &line, uint site)
+    {
+        if (line.size() < 2 || MacroName(line[1]).empty())
+        { Error(site, "macro names must be identifiers"); }
+
+        Macro m{false, false, {}, {}};
+        const auto &s = line[1].lexer->Stream();
+        size_t k = 2;
+        if (k < line.size() && IsOp(line[k], OperatorType::Lparan) && s.begins[line[k].index] == s.ends[line[1].index])
+        {   // 名字后紧跟'('为函数式宏
+            m.function = true;
+            for (k++;; k++)
+            {
+                if (k < line.size() && IsOp(line[k], OperatorType::Rparan) && m.params.empty())
+                { break; }
+                if (k < line.size() && IsOp(line[k], OperatorType::Ellipsis))
+                {
+                    m.variadic = true;
+                    m.params.emplace_back("__VA_ARGS__");
+                    k++;
+                }
+                else if (k < line.size() && Kind(line[k]) == TokenType::Identifier)
+                {
+                    m.params.push_back(line[k].lexer->Name(Payload(line[k])));
+                    k++;
+                }
+                else
+                { Error(site, "invalid macro parameter list"); }
+
+                if (k < line.size() && IsOp(line[k], OperatorType::Rparan))
+                { break; }
+                if (m.variadic || k >= line.size() || !IsOp(line[k], OperatorType::Comma))
+                { Error(site, "expected ',' or ')' in macro parameter list"); }
+            }
+            k++;
+        }
+        m.body.assign(line.begin() + k, line.end());
+        macros_[MacroName(line[1])] = std::move(m);
+    }
+
+    void Preprocessor::Include(const Input &in, const std::vector<Tok> &line, int depth)
+    {
+        auto site = line[0].site;
+        std::string name;
+        auto quoted = false;
+        if (line.size() >= 2 && Kind(line[1]) == TokenType::String)
+        {
+            name = line[1].lexer->GetStorageString(Payload(line[1]));
+            quoted = true;
+        }
+        else if (line.size() >= 2 && IsOp(line[1], OperatorType::LessThan))
+        {
+            size_t k = 2;
+            for (; k < line.size() && !IsOp(line[k], OperatorType::GreaterThan); k++)
+            { name += Spell(line[k]); }
+            if (k >= line.size())
+            { Error(site, "missing terminating > character"); }
+        }
+        if (name.empty())
+        { Error(site, "#include expects \"FILENAME\" or <FILENAME>"); }
+
+        // ""先在当前文件所在目录找，再找-I目录
+        std::vector<std::string> candidates;
+        if (name[0] == '/' || (name.size() > 1 && name[1] == ':'))
+        { candidates.push_back(name); }
+        else
+        {
+            if (quoted)
+            {
+                auto slash = in.path.find_last_of("/\\");
+                candidates.push_back(slash == std::string::npos ? name : in.path.substr(0, slash + 1) + name);
+            }
+            for (const auto &d : dirs_)
+            { candidates.push_back(d + "/" + name); }
+        }
+
+        std::shared_ptr<const Header> header;
+        std::string path;
+        for (const auto &c : candidates)
+        {
+            if ((header = headers_.Get(c)) != nullptr)
+            {
+                path = c;
+                break;
+            }
+        }
+        if (header == nullptr)
+        { Error(site, "cannot open include file: " + name); }
+        includes_.push_back(path);
+
+        // #pragma once 或保护宏已定义时不再展开
+        if (once_.count(path) > 0 || (!header->guard.empty() && macros_.find(header->guard) != macros_.end()))
+        { return; }
+        if (depth >= PP_INCLUDE_DEPTH)
+        { Error(site, "#include nested too deeply"); }
+
+        used_.push_back(header);
+        File(header->lexer, path, site, depth + 1);
+    }
+
+    bool Preprocessor::Eval(const std::vector<Tok> &line, uint site)
+    {
+        // 先替换defined X / defined(X)，再展开宏
+        std::vector<Tok> list;
+        for (size_t k = 1; k < line.size(); k++)
+        {
+            if (Kind(line[k]) == TokenType::Identifier && line[k].lexer->Name(Payload(line[k])) == "defined")
+            {
+                auto paren = k + 1 < line.size() && IsOp(line[k + 1], OperatorType::Lparan);
+                auto j = k + (paren ? 2 : 1);
+                if (j >= line.size() || MacroName(line[j]).empty())
+                { Error(site, "operator \"defined\" requires an identifier"); }
+                if (paren && (j + 1 >= line.size() || !IsOp(line[j + 1], OperatorType::Rparan)))
+                { Error(site, "missing ')' after \"defined\""); }
+                auto v = macros_.find(MacroName(line[j])) != macros_.end();
+                list.push_back(Make(v ? "1" : "0", TokenType::Int, site, "defined"));
+                k = paren ? j + 1 : j;
+                continue;
+            }
+            list.push_back(line[k]);
+        }
+        list = ExpandList(list);
+        if (list.empty())
+        { Error(site, "#if with no expression"); }
+
+        size_t pos = 0;
+        auto v = EvalExpr(list, pos, 0, site);
+        if (pos != list.size())
+        { Error(site, "missing binary operator before token \"" + Spell(list[pos]) + "\""); }
+        return v != 0;
+    }
+
+    static int BinaryPriority(OperatorType op)
+    {
+        switch (op)
+        {
+            case OperatorType::Mul:
+            case OperatorType::Divide:
+            case OperatorType::Mod:
+                return 10;
+            case OperatorType::Add:
+            case OperatorType::Minus:
+                return 9;
+            case OperatorType::LeftShift:
+            case OperatorType::RightShift:
+                return 8;
+            case OperatorType::LessThan:
+            case OperatorType::LessThanOrEqual:
+            case OperatorType::GreaterThan:
+            case OperatorType::GreaterThanOrEqual:
+                return 7;
+            case OperatorType::Equal:
+            case OperatorType::NotEqual:
+                return 6;
+            case OperatorType::BitAnd:
+                return 5;
+            case OperatorType::BitXor:
+                return 4;
+            case OperatorType::BitOr:
+                return 3;
+            case OperatorType::LogicalAnd:
+                return 2;
+            case OperatorType::LogicalOr:
+                return 1;
+            default:
+                return 0;
+        }
+    }
+
+    slong Preprocessor::EvalExpr(const std::vector<Tok> &e, size_t &pos, int prec, uint site)
+    {
+        auto lhs = EvalUnary(e, pos, site);
+        while(pos < e.size() && Kind(e[pos]) == TokenType::Operator)
+        {
+            auto op = (OperatorType) Payload(e[pos]);
+            if (op == OperatorType::Query && prec == 0)
+            {   // 条件运算符优先级最低，右结合
+                pos++;
+                auto a = EvalExpr(e, pos, 0, site);
+                if (pos >= e.size() || !IsOp(e[pos], OperatorType::Colon))
+                { Error(site, "expected ':' in #if expression"); }
+                pos++;
+                auto b = EvalExpr(e, pos, 0, site);
+                lhs = lhs != 0 ? a : b;
+                continue;
+            }
+            auto p = BinaryPriority(op);
+            if (p <= prec)
+            { break; }
+            pos++;
+            auto rhs = EvalExpr(e, pos, p, site);
+            switch (op)
+            {
+                case OperatorType::Mul:
+                    lhs *= rhs;
+                    break;
+                case OperatorType::Divide:
+                    lhs = rhs != 0 ? lhs / rhs : 0;
+                    break;
+                case OperatorType::Mod:
+                    lhs = rhs != 0 ? lhs % rhs : 0;
+                    break;
+                case OperatorType::Add:
+                    lhs += rhs;
+                    break;
+                case OperatorType::Minus:
+                    lhs -= rhs;
+                    break;
+                case OperatorType::LeftShift:
+                    lhs <<= rhs;
+                    break;
+                case OperatorType::RightShift:
+                    lhs >>= rhs;
+                    break;
+                case OperatorType::LessThan:
+                    lhs = lhs < rhs;
+                    break;
+                case OperatorType::LessThanOrEqual:
+                    lhs = lhs <= rhs;
+                    break;
+                case OperatorType::GreaterThan:
+                    lhs = lhs > rhs;
+                    break;
+                case OperatorType::GreaterThanOrEqual:
+                    lhs = lhs >= rhs;
+                    break;
+                case OperatorType::Equal:
+                    lhs = lhs == rhs;
+                    break;
+                case OperatorType::NotEqual:
+                    lhs = lhs != rhs;
+                    break;
+                case OperatorType::BitAnd:
+                    lhs &= rhs;
+                    break;
+                case OperatorType::BitXor:
+                    lhs ^= rhs;
+                    break;
+                case OperatorType::BitOr:
+                    lhs |= rhs;
+                    break;
+                case OperatorType::LogicalAnd:
+                    lhs = lhs != 0 && rhs != 0;
+                    break;
+                case OperatorType::LogicalOr:
+                    lhs = lhs != 0 || rhs != 0;
+                    break;
+                default:
+                    break;
+            }
+        }
+        return lhs;
+    }
+
+    slong Preprocessor::EvalUnary(const std::vector<Tok> &e, size_t &pos, uint site)
+    {
+        if (pos >= e.size())
+        { Error(site, "#if expression expected value"); }
+
+        const auto &t = e[pos++];
+        auto kind = Kind(t);
+        if (kind >= TokenType::Char && kind <= TokenType::Ulong)
+        { return t.lexer->IntegerAt(t.index); }
+        if (kind == TokenType::Identifier || kind == TokenType::Keyword)
+        { return 0; }      // 展开后剩下的标识符为0
+        if (kind == TokenType::Operator)
+        {
+            switch ((OperatorType) Payload(t))
+            {
+                case OperatorType::LogicalNot:
+                    return EvalUnary(e, pos, site) == 0;
+                case OperatorType::BitNot:
+                    return ~EvalUnary(e, pos, site);
+                case OperatorType::Minus:
+                    return -EvalUnary(e, pos, site);
+                case OperatorType::Add:
+                    return EvalUnary(e, pos, site);
+                case OperatorType::Lparan:
+                {
+                    auto v = EvalExpr(e, pos, 0, site);
+                    if (pos >= e.size() || !IsOp(e[pos], OperatorType::Rparan))
+                    { Error(site, "missing ')' in #if expression"); }
+                    pos++;
+                    return v;
+                }
+                default:
+                    break;
+            }
+        }
+        Error(site, "token \"" + Spell(t) + "\" is not valid in #if expression");
+        return 0;
+    }
+
+    bool Preprocessor::Take(Input &in, Tok &t)
+    {
+        if (!pending_.empty())
+        {
+            t = pending_.front();
+            pending_.pop_front();
+            return true;
+        }
+        if (in.lexer == nullptr || in.pos >= in.end || IsDirective(*in.lexer, in.pos))
+        { return false; }
+        t = Tok{in.lexer, in.pos, Site(in, in.pos), nullptr};
+        in.pos++;
+        return true;
+    }
+
+    bool Preprocessor::Peek(const Input &in, Tok &t) const
+    {
+        if (!pending_.empty())
+        {
+            t = pending_.front();
+            return true;
+        }
+        if (in.lexer == nullptr || in.pos >= in.end || IsDirective(*in.lexer, in.pos))
+        { return false; }
+        t = Tok{in.lexer, in.pos, Site(in, in.pos), nullptr};
+        return true;
+    }
+
+    void Preprocessor::Expand(const Tok &t, Input &in)
+    {
+        auto name = MacroName(t);
+        auto f = name.empty() ? macros_.end() : macros_.find(name);
+        if (f == macros_.end() || (t.hide != nullptr && t.hide->count(name) > 0))
+        {
+            out_.push_back(t);
+            return;
+        }
+
+        const auto &m = f->second;
+        std::vector<Tok> result;
+        if (!m.function)
+        { result = m.body; }
+        else
+        {
+            // 函数式宏后面不是'('时按普通标识符处理
+            Tok next;
+            if (!Peek(in, next) || !IsOp(next, OperatorType::Lparan))
+            {
+                out_.push_back(t);
+                return;
+            }
+            Take(in, next);
+
+            std::vector<std::vector<Tok>> args(1);
+            auto level = 1;
+            while(true)
+            {
+                Tok a;
+                if (!Take(in, a))
+                { Error(t.site, "unterminated argument list invoking macro \"" + name + "\""); }
+                if (IsOp(a, OperatorType::Lparan))
+                { level++; }
+                else if (IsOp(a, OperatorType::Rparan) && --level == 0)
+                { break; }
+                else if (IsOp(a, OperatorType::Comma) && level == 1 && !(m.variadic && args.size() >= m.params.size()))
+                {
+                    args.emplace_back();
+                    continue;
+                }
+                args.back().push_back(a);
+            }
+            if (m.params.empty() && args.size() == 1 && args[0].empty())
+            { args.clear(); }
+            if (m.variadic && args.size() + 1 == m.params.size())
+            { args.emplace_back(); }    // 可变参数为空
+            if (args.size() != m.params.size())
+            {
+                Error(t.site, "macro \"" + name + "\" requires " + std::to_string(m.params.size()) +
+                              " arguments, but " + std::to_string(args.size()) + " given");
+            }
+            result = Substitute(m, args);
+        }
+
+        // 展开结果放回输入前端重新扫描，隐藏集加上宏名防止递归展开
+        auto hide = std::make_shared<std::set<std::string>>();
+        if (t.hide != nullptr)
+        { *hide = *t.hide; }
+        hide->insert(name);
+        for (auto it = result.rbegin(); it != result.rend(); ++it)
+        {
+            if (it->lexer == nullptr)
+            { continue; }
+            auto r = *it;
+            r.site = t.site;
+            if (r.hide == nullptr)
+            { r.hide = hide; }
+            else
+            {
+                auto both = std::make_shared<std::set<std::string>>(*r.hide);
+                both->insert(hide->begin(), hide->end());
+                r.hide = both;
+            }
+            pending_.push_front(r);
+        }
+    }
+
+    std::vector<Preprocessor::Tok> Preprocessor::ExpandList(const std::vector<Tok> &list)
+    {
+        // 参数和#if表达式单独展开，不读取文件中后面的词
+        std::deque<Tok> pending(list.begin(), list.end());
+        std::vector<Tok> out;
+        pending_.swap(pending);
+        out_.swap(out);
+        Input none{nullptr, 0, 0, PP_NO_SITE, 0, std::string()};
+        while(!pending_.empty())
+        {
+            Tok t;
+            Take(none, t);
+            Expand(t, none);
+        }
+        pending_.swap(pending);
+        out_.swap(out);
+        return out;
+    }
+
+    std::vector<Preprocessor::Tok> Preprocessor::Substitute(const Macro &m, const std::vector<std::vector<Tok>> &args)
+    {
+        auto param = [&](const Tok &b) {
+            if (Kind(b) != TokenType::Identifier)
+            { return -1; }
+            const auto &name = b.lexer->Name(Payload(b));
+            for (size_t i = 0; i < m.params.size(); i++)
+            {
+                if (m.params[i] == name)
+                { return (int) i; }
+            }
+            return -1;
+        };
+
+        std::vector<Tok> r;
+        const auto &body = m.body;
+        for (size_t k = 0; k < body.size(); k++)
+        {
+            const auto &b = body[k];
+            if (IsOp(b, OperatorType::Sharp) && k + 1 < body.size() && param(body[k + 1]) >= 0)
+            {
+                r.push_back(Stringize(args[param(body[k + 1])], b.site));
+                k++;
+                continue;
+            }
+            if (IsOp(b, OperatorType::SharpSharp) && !r.empty() && k + 1 < body.size())
+            {
+                // ##两边的参数不展开
+                std::vector<Tok> rhs;
+                auto p = param(body[k + 1]);
+                if (p >= 0)
+                { rhs = args[p]; }
+                else
+                { rhs.push_back(body[k + 1]); }
+                k++;
+                if (rhs.empty())
+                { continue; }
+                auto left = r.back();
+                r.pop_back();
+                r.push_back(left.lexer == nullptr ? rhs[0] : Paste(left, rhs[0]));
+                r.insert(r.end(), rhs.begin() + 1, rhs.end());
+                continue;
+            }
+            auto p = param(b);
+            if (p >= 0)
+            {
+                auto pasted = k + 1 < body.size() && IsOp(body[k + 1], OperatorType::SharpSharp);
+                auto arg = pasted ? args[p] : ExpandList(args[p]);
+                if (arg.empty())
+                { r.push_back(Tok{nullptr, 0, 0, nullptr}); }
+                else
+                { r.insert(r.end(), arg.begin(), arg.end()); }
+                continue;
+            }
+            r.push_back(b);
+        }
+        return r;
+    }
+
+    Preprocessor::Tok Preprocessor::Stringize(const std::vector<Tok> &arg, uint site)
+    {
+        std::string text = "\"";
+        for (size_t k = 0; k < arg.size(); k++)
+        {
+            const auto &a = arg[k];
+            if (k > 0)
+            {
+                // 原文中有空白的地方留一个空格
+                const auto &prev = arg[k - 1];
+                if (prev.lexer != a.lexer || prev.lexer->Stream().ends[prev.index] < a.lexer->Stream().begins[a.index])
+                { text += ' '; }
+            }
+            auto s = Spell(a);
+            if (!s.empty() && (s[0] == '"' || s[0] == '\''))
+            {
+                for (auto c : s)
+                {
+                    if (c == '"' || c == '\\')
+                    { text += '\\'; }
+                    text += c;
+                }
+            }
+            else
+            { text += s; }
+        }
+        text += '"';
+        return Make(text, TokenType::String, site, "#");
+    }
+
+    Preprocessor::Tok Preprocessor::Paste(const Tok &a, const Tok &b)
+    {
+        return Make(Spell(a) + Spell(b), TokenType::NONE, a.site, "##");
+    }
+
+    Preprocessor::Tok Preprocessor::Make(const std::string &text, TokenType kind, uint site, const std::string &what)
+    {
+        scratch_.emplace_back(new Scratch());
+        auto &s = *scratch_.back();
+        s.text = text;
+        s.lexer.Input(StringView(s.text));
+        s.lexer.Pretokenize();
+
+        // 须恰好得到一个词(末尾的TokenEnd除外)
+        const auto &kinds = s.lexer.Stream().kinds;
+        if (kinds.size() != 2 || kinds[0] == TokenType::Error || (kind != TokenType::NONE && kinds[0] != kind))
+        { Error(site, "\"" + text + "\" produced by " + what + " is not a valid token"); }
+        return Tok{&s.lexer, 0, site, nullptr};
+    }
+
+    std::string Preprocessor::MacroName(const Tok &t) const
+    {
+        if (t.lexer == nullptr)
+        { return std::string(); }
+        auto kind = Kind(t);
+        if (kind == TokenType::Identifier)
+        { return t.lexer->Name(Payload(t)); }
+        if (kind == TokenType::Keyword)
+        { return Spell(t); }
+        return std::string();
+    }
+
+    void Preprocessor::Error(uint site, const std::string &info) const
+    {
+        const auto &s = main_->Stream();
+        if (site < s.kinds.size())
+        { printf("[%04d:%03d] ERROR: %s\n", s.lastLines[site], s.lastColumns[site], info.c_str()); }
+        else
+        { printf("ERROR: %s\n", info.c_str()); }
+        throw std::exception();
+    }
+}
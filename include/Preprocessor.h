@@ -0,0 +1,183 @@
+//
+// Created by yw.
+//
+
+#ifndef DRTCC_PREPROCESSOR_H
+#define DRTCC_PREPROCESSOR_H
+
+#include "Type.h"
+#include "Lexer.h"
+#include "Source.h"
+#include <set>
+#include <mutex>
+#include <memory>
+
+#define PP_INCLUDE_DEPTH 64         // #include 最大嵌套层数
+#define PP_NO_SITE 0xFFFFFFFFU      // 主文件的词，位置就是自身
+
+namespace DrTcc
+{
+    // 分好词的头文件，同一进程内的各翻译单元共用
+    struct Header
+    {
+        Source source;
+        Lexer lexer;
+        int64_t mtime{0};
+        uint64_t size{0};
+        std::string guard;          // 整个文件包在 #ifndef X / #define X ... #endif 中时为X
+    };
+
+    // 头文件词流缓存: 每个头文件只分词一次，文件改动(修改时间或大小变化)后重新分词
+    class HeaderCache
+    {
+        public:
+            HeaderCache() = default;
+
+            ~HeaderCache() = default;
+
+            // 文件不存在时返回空
+            std::shared_ptr<const Header> Get(const std::string &path);
+
+            uint64_t Hits() const
+            { return hits_; }
+
+            uint64_t Misses() const
+            { return misses_; }
+
+        private:
+            std::mutex mutex_;
+            std::unordered_map<std::string, std::shared_ptr<const Header>> headers_;
+            uint64_t hits_{0};
+            uint64_t misses_{0};
+    };
+
+    // 预处理器: 在分好的词流上处理 #define/#undef/#include/#if 系列/#pragma once/#error
+    // 宏展开按隐藏集防止递归，支持函数式宏、可变参数、# 和 ##
+    class Preprocessor
+    {
+        public:
+            // file: 源文件路径，""形式的头文件先在其所在目录查找；dirs: -I 指定的目录
+            Preprocessor(std::string file, HeaderCache &headers,
+                         std::vector<std::string> dirs = std::vector<std::string>());
+
+            ~Preprocessor() = default;
+
+            // 就地替换lexer的词流，没有预处理指令时不做任何事
+            void Run(Lexer &lexer);
+
+            // 本次预处理找到的所有头文件路径，用于判断编译结果是否过期
+            const std::vector<std::string> &Includes() const
+            { return includes_; }
+
+        private:
+            using HideSet = std::shared_ptr<const std::set<std::string>>;
+
+            struct Tok
+            {
+                const Lexer *lexer;     // 为空时是##两边的空参数占位
+                uint index;
+                uint site;              // 在主文件中的位置，用于报错和行号
+                HideSet hide;
+            };
+
+            struct Macro
+            {
+                bool function;
+                bool variadic;
+                std::vector<std::string> params;
+                std::vector<Tok> body;
+            };
+
+            struct Cond
+            {
+                bool active;            // 当前分支生效
+                bool taken;             // 已有分支生效
+                bool parent;            // 外层生效
+                bool done;              // 已遇到#else
+            };
+
+            struct Input
+            {
+                const Lexer *lexer;
+                uint pos, end;
+                uint site;              // 所在#include的位置，主文件为PP_NO_SITE
+                size_t base;            // 进入文件时条件栈的深度
+                std::string path;
+            };
+
+            // 由#、##和defined生成的词，文本和Lexer须在预处理期间有效
+            struct Scratch
+            {
+                std::string text;
+                Lexer lexer;
+            };
+
+            void File(const Lexer &lexer, const std::string &path, uint site, int depth);
+
+            void Directive(Input &in, int depth);
+
+            void Define(const std::vector<Tok> &line, uint site);
+
+            void Include(const Input &in, const std::vector<Tok> &line, int depth);
+
+            bool Eval(const std::vector<Tok> &line, uint site);
+
+            slong EvalExpr(const std::vector<Tok> &e, size_t &pos, int prec, uint site);
+
+            slong EvalUnary(const std::vector<Tok> &e, size_t &pos, uint site);
+
+            bool Take(Input &in, Tok &t);
+
+            bool Peek(const Input &in, Tok &t) const;
+
+            void Expand(const Tok &t, Input &in);
+
+            std::vector<Tok> ExpandList(const std::vector<Tok> &list);
+
+            std::vector<Tok> Substitute(const Macro &m, const std::vector<std::vector<Tok>> &args);
+
+            Tok Stringize(const std::vector<Tok> &arg, uint site);
+
+            Tok Paste(const Tok &a, const Tok &b);
+
+            Tok Make(const std::string &text, TokenType kind, uint site, const std::string &what);
+
+            std::string MacroName(const Tok &t) const;
+
+            bool Active() const
+            { return conds_.empty() || conds_.back().active; }
+
+            void Error(uint site, const std::string &info) const;
+
+            static uint Site(const Input &in, uint i)
+            { return in.site == PP_NO_SITE ? i : in.site; }
+
+            static TokenType Kind(const Tok &t)
+            { return t.lexer->Stream().kinds[t.index]; }
+
+            static int Payload(const Tok &t)
+            { return t.lexer->Stream().payloads[t.index]; }
+
+            static bool IsOp(const Tok &t, OperatorType op)
+            { return t.lexer != nullptr && Kind(t) == TokenType::Operator && (OperatorType) Payload(t) == op; }
+
+            static std::string Spell(const Tok &t)
+            { return t.lexer->Spelling(t.index); }
+
+        private:
+            std::string file_;
+            HeaderCache &headers_;
+            std::vector<std::string> dirs_;
+            Lexer *main_{nullptr};
+            std::unordered_map<std::string, Macro> macros_;
+            std::set<std::string> once_;                        // 含#pragma once的头文件
+            std::vector<std::shared_ptr<const Header>> used_;   // 输出引用其中的词，预处理期间保持有效
+            std::vector<std::string> includes_;
+            std::deque<std::unique_ptr<Scratch>> scratch_;
+            std::vector<Cond> conds_;
+            std::deque<Tok> pending_;                           // 宏展开结果，先于文件中的词读取
+            std::vector<Tok> out_;
+    };
+}
+
+#endif //DRTCC_PREPROCESSOR_H
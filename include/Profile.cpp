@@ -0,0 +1,107 @@
+//
+// Created by yw.
+//
+
+#include "Profile.h"
+
+namespace DrTcc
+{
+    // 文件格式(文本):
+    //   total <执行指令数>
+    //   func <函数名> <调用次数> <跳转点数>
+    //   site <编号> <执行次数> <ax为0次数>     (属于上一个func)
+    //   pair <指令> <指令> <次数>
+    bool Profile::Load(const std::string &path)
+    {
+        std::ifstream file(path);
+        if (!file)
+        { return false; }
+
+        FuncProfile *func = nullptr;
+        std::string tag;
+        while(file >> tag)
+        {
+            if (tag == "total")
+            { file >> total_; }
+            else if (tag == "func")
+            {
+                std::string name;
+                size_t n = 0;
+                file >> name;
+                func = &funcs_[name];
+                file >> func->calls >> n;
+                func->sites.assign(n, SiteCount{0, 0});
+            }
+            else if (tag == "site" && func != nullptr)
+            {
+                size_t i = 0;
+                SiteCount c{0, 0};
+                file >> i >> c.hits >> c.zero;
+                if (i < func->sites.size())
+                { func->sites[i] = c; }
+            }
+            else if (tag == "pair")
+            {
+                int a = 0, b = 0;
+                slong n = 0;
+                file >> a >> b >> n;
+                AddPair(a, b, n);
+            }
+            else
+            {
+                printf("invalid profile: %s\n", path.c_str());
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool Profile::Save(const std::string &path) const
+    {
+        std::ofstream file(path);
+        if (!file)
+        { return false; }
+
+        file << "total " << total_ << '\n';
+        for (const auto &f : funcs_)
+        {
+            file << "func " << f.first << ' ' << f.second.calls << ' ' << f.second.sites.size() << '\n';
+            for (size_t i = 0; i < f.second.sites.size(); ++i)
+            {
+                const auto &c = f.second.sites[i];
+                if (c.hits > 0)
+                { file << "site " << i << ' ' << c.hits << ' ' << c.zero << '\n'; }
+            }
+        }
+        for (const auto &p : pairs_)
+        { file << "pair " << p.first.first << ' ' << p.first.second << ' ' << p.second << '\n'; }
+        return true;
+    }
+
+    const FuncProfile *Profile::Func(const std::string &name) const
+    {
+        auto f = funcs_.find(name);
+        if (f == funcs_.end())
+        { return nullptr; }
+        return &f->second;
+    }
+
+    FuncProfile &Profile::Func(const std::string &name)
+    {
+        return funcs_[name];
+    }
+
+    slong Profile::Pair(int a, int b) const
+    {
+        auto p = pairs_.find(std::make_pair(a, b));
+        if (p == pairs_.end())
+        { return 0; }
+        return p->second;
+    }
+
+    void Profile::AddPair(int a, int b, slong n)
+    {
+        if (n > 0)
+        { pairs_[std::make_pair(a, b)] += n; }
+    }
+}
@@ -0,0 +1,61 @@
+//
+// Created by yw.
+//
+
+#ifndef DRTCC_PROFILE_H
+#define DRTCC_PROFILE_H
+
+#include "Type.h"
+
+namespace DrTcc
+{
+    // 一个跳转点(JMP/JZ/JNZ)的计数
+    struct SiteCount
+    {
+        slong hits;     // 执行次数
+        slong zero;     // 执行时ax为0的次数(JZ跳转/JNZ不跳转)
+    };
+
+    // 一个函数的剖析数据
+    // 跳转点按GenCode生成的顺序编号，与优化无关，重新编译同一份源码时编号不变
+    struct FuncProfile
+    {
+        slong calls{0};
+        std::vector<SiteCount> sites;
+    };
+
+    // VM执行计数，--profile-gen 保存，--profile-use 读取后指导优化
+    class Profile
+    {
+        public:
+            Profile() = default;
+
+            ~Profile() = default;
+
+            bool Load(const std::string &path);
+
+            bool Save(const std::string &path) const;
+
+            const FuncProfile *Func(const std::string &name) const;
+
+            FuncProfile &Func(const std::string &name);
+
+            // 相邻两条指令的执行次数
+            slong Pair(int a, int b) const;
+
+            void AddPair(int a, int b, slong n);
+
+            slong Total() const
+            { return total_; }
+
+            void SetTotal(slong n)
+            { total_ = n; }
+
+        private:
+            slong total_{0};
+            std::unordered_map<std::string, FuncProfile> funcs_;
+            std::map<std::pair<int, int>, slong> pairs_;
+    };
+}
+
+#endif //DRTCC_PROFILE_H
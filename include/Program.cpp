@@ -0,0 +1,79 @@
+//
+// Created by yw.
+//
+
+#include "Program.h"
+#include "Parser.h"
+#include "GenCode.h"
+#include "Image.h"
+
+namespace DrTcc
+{
+    std::shared_ptr<const Program> Program::Compile(StringView source, const CompileOptions &options)
+    {
+        if (source.length() == 0)
+        {
+            printf("empty source\n");
+            throw std::exception();
+        }
+
+        HeaderCache local;
+        Preprocessor pp(options.file, options.headers != nullptr ? *options.headers : local, options.includes);
+        Parser parser(source, &pp);
+        parser.Parse();
+        AstTree tree = parser.Compact();
+        GenCode genCode(tree, nullptr, options.tier);
+
+        std::shared_ptr<Program> program(new Program());
+        program->text_ = genCode.Text();
+        program->data_ = genCode.Data();
+        program->funcs_ = genCode.Funcs();
+        program->entry_ = genCode.Entry();
+        program->tier_ = options.tier;
+        program->includes_ = pp.Includes();
+        return program;
+    }
+
+    std::shared_ptr<const Program> Program::Load(StringView image)
+    {
+        Image img;
+        if (!img.Load(image))
+        { throw std::exception(); }
+
+        std::shared_ptr<Program> program(new Program());
+        program->text_.assign(img.Text(), img.Text() + img.TextSize());
+        program->data_.assign(img.Data(), img.Data() + img.DataSize());
+        program->funcs_ = img.Funcs();
+        program->entry_ = img.Entry();
+        program->tier_ = (img.Flags() & IMAGE_TIER) != 0;
+        return program;
+    }
+
+    void Program::Install(std::unique_ptr<VM> &vm) const
+    {
+        if (vm == nullptr)
+        { vm.reset(new VM(text_, data_)); }
+        else
+        { vm->Load(text_.data(), text_.size(), data_.data(), data_.size()); }
+
+        if (tier_)
+        {
+            std::vector<int> entries;
+            for (const auto &f : funcs_)
+            { entries.push_back(f.first); }
+            vm->Tiering(text_, entries);
+        }
+    }
+
+    Execution::Execution(std::shared_ptr<const Program> program) : program_(std::move(program))
+    {}
+
+    VmStatus Execution::Run()
+    {
+        program_->Install(vm_);
+        vm_->Args(args_);
+        vm_->Output(output_);
+        vm_->Limit(limits_.cycles, limits_.heap);
+        return vm_->Exec(program_->Entry());
+    }
+}
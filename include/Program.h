@@ -0,0 +1,121 @@
+//
+// Created by yw.
+//
+
+#ifndef DRTCC_PROGRAM_H
+#define DRTCC_PROGRAM_H
+
+#include "Type.h"
+#include "Token.h"
+#include "Preprocessor.h"
+#include "VM.h"
+#include <functional>
+#include <memory>
+
+namespace DrTcc
+{
+    struct CompileOptions
+    {
+        std::string file;                       // 源文件路径，用于""形式的#include，可为空
+        std::vector<std::string> includes;      // 头文件搜索目录
+        bool tier{false};                       // 不在编译期优化，运行时分层优化热点函数
+        HeaderCache *headers{nullptr};          // 共用的头文件词流缓存，为空时只在本次编译内有效
+    };
+
+    // 编译好的程序，创建后不再改变，可被多个Execution(包括不同线程中的)共用
+    class Program
+    {
+            using TextType = BaseType<TokenType::Int>::type;
+            using DataType = BaseType<TokenType::Char>::type;
+        public:
+            // 编译源码，出错时输出错误并抛出异常
+            static std::shared_ptr<const Program> Compile(StringView source,
+                                                          const CompileOptions &options = CompileOptions());
+
+            // 由字节码映像(.dtc)创建，映像内容被拷贝
+            static std::shared_ptr<const Program> Load(StringView image);
+
+            const std::vector<TextType> &Text() const
+            { return text_; }
+
+            const std::vector<DataType> &Data() const
+            { return data_; }
+
+            // 函数入口 -> 函数名
+            const std::map<int, std::string> &Funcs() const
+            { return funcs_; }
+
+            int Entry() const
+            { return entry_; }
+
+            bool Tier() const
+            { return tier_; }
+
+            // 编译时包含的头文件
+            const std::vector<std::string> &Includes() const
+            { return includes_; }
+
+            // 把程序装入vm，为空时创建，否则复用；参数、输出和限制由调用者设置
+            void Install(std::unique_ptr<VM> &vm) const;
+
+        private:
+            Program() = default;
+
+            std::vector<TextType> text_;
+            std::vector<DataType> data_;
+            std::map<int, std::string> funcs_;
+            int entry_{-1};
+            bool tier_{false};
+            std::vector<std::string> includes_;
+    };
+
+    struct Limits
+    {
+        slong cycles{0};        // 执行的指令数上限，0为不限
+        uint32_t heap{0};       // 堆内存字节数上限，0为不限: 程序malloc申请的字节数之和，不含main的参数占用的内存
+    };
+
+    // 程序的一次执行环境: 参数、输出和限制各自独立，VM在第一次Run时创建，之后的Run复用
+    // 不同的Execution可在不同线程中同时运行
+    class Execution
+    {
+        public:
+            explicit Execution(std::shared_ptr<const Program> program);
+
+            ~Execution() = default;
+
+            // main的参数，args[0]为程序名
+            void Args(std::vector<std::string> args)
+            { args_ = std::move(args); }
+
+            // 程序的输出，为空时写到标准输出
+            void Output(std::function<void(const char *, size_t)> sink)
+            { output_ = std::move(sink); }
+
+            void Limit(const Limits &limits)
+            { limits_ = limits; }
+
+            // 从头执行一次，正常结束时返回VmExit，main的返回值见ExitCode
+            VmStatus Run();
+
+            int ExitCode() const
+            { return vm_ == nullptr ? -1 : vm_->ExitCode(); }
+
+            // 上一次Run出错(含超出限制)时的说明
+            std::string Message() const
+            { return vm_ == nullptr ? std::string() : vm_->Message(); }
+
+            // 上一次Run执行的指令数
+            slong Cycles() const
+            { return vm_ == nullptr ? 0 : vm_->Cycles(); }
+
+        private:
+            std::shared_ptr<const Program> program_;
+            std::vector<std::string> args_;
+            std::function<void(const char *, size_t)> output_;
+            Limits limits_;
+            std::unique_ptr<VM> vm_;
+    };
+}
+
+#endif //DRTCC_PROGRAM_H
@@ -0,0 +1,104 @@
+//
+// Created by yw.
+//
+
+#include "Runner.h"
+
+#define RUNNER_DEBUG 0
+
+namespace DrTcc
+{
+    Runner::Runner(uint threads)
+    {
+        if (threads == 0)
+        { threads = std::max(1u, std::thread::hardware_concurrency()); }
+        for (uint i = 0; i < threads; ++i)
+        { workers_.emplace_back(&Runner::Work, this); }
+    }
+
+    Runner::~Runner()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto &w : workers_)
+        { w.join(); }
+    }
+
+    std::vector<RunResult> Runner::Run(const std::vector<RunJob> &jobs)
+    {
+        std::vector<RunResult> results(jobs.size());
+        if (jobs.empty())
+        { return results; }
+
+        std::lock_guard<std::mutex> batch(run_);
+        std::unique_lock<std::mutex> lock(mutex_);
+        jobs_ = &jobs;
+        results_ = &results;
+        next_ = 0;
+        finished_ = 0;
+        wake_.notify_all();
+        done_.wait(lock, [&] { return finished_ == jobs.size(); });
+        jobs_ = nullptr;
+        results_ = nullptr;
+#if RUNNER_DEBUG
+        printf("[RUNNER] %d jobs on %d threads\n", (int) jobs.size(), (int) workers_.size());
+#endif
+        return results;
+    }
+
+    void Runner::Work()
+    {
+        std::unique_ptr<VM> vm;
+        while(true)
+        {
+            size_t i;
+            const RunJob *job;
+            RunResult *result;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [&] { return stop_ || (jobs_ != nullptr && next_ < jobs_->size()); });
+                if (stop_)
+                { return; }
+                i = next_++;
+                job = &(*jobs_)[i];
+                result = &(*results_)[i];
+            }
+
+            Execute(*job, *result, vm);     // 不抛出异常，保证计入finished_
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (++finished_ == jobs_->size())
+            { done_.notify_all(); }
+        }
+    }
+
+    void Runner::Execute(const RunJob &job, RunResult &result, std::unique_ptr<VM> &vm) noexcept
+    {
+        // 工作线程中的异常会结束整个进程，任何错误都记在结果中
+        auto fail = [&](const char *what) {
+            result.status = VmHostError;
+            result.exitCode = -1;
+            result.message = what;
+            vm.reset();     // 状态不明，下一个任务重新创建
+        };
+        try
+        {
+            job.program->Install(vm);
+            vm->Args(job.args);
+            vm->Output([&](const char *p, size_t n) { result.output.append(p, n); });
+            vm->Limit(job.limits.cycles, job.limits.heap);
+            result.status = vm->Exec(job.program->Entry());
+            result.exitCode = vm->ExitCode();
+            result.message = vm->Message();
+            result.cycles = vm->Cycles();
+            vm->Output(nullptr);
+        }
+        catch (const std::exception &e)
+        { fail(e.what()); }
+        catch (...)
+        { fail("unknown error"); }
+    }
+}
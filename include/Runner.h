@@ -0,0 +1,73 @@
+//
+// Created by yw.
+//
+
+#ifndef DRTCC_RUNNER_H
+#define DRTCC_RUNNER_H
+
+#include "Type.h"
+#include "Program.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace DrTcc
+{
+    // 一个独立的执行任务
+    struct RunJob
+    {
+        std::shared_ptr<const Program> program;
+        std::vector<std::string> args;          // main的参数，args[0]为程序名
+        Limits limits;
+    };
+
+    struct RunResult
+    {
+        VmStatus status{VmExit};
+        int exitCode{-1};
+        std::string output;                     // 程序的全部输出
+        std::string message;                    // 出错时的说明
+        slong cycles{0};
+    };
+
+    // 线程池: 每个工作线程持有一个VM，依次领取任务执行，VM在任务之间复用
+    // 任务之间不共享任何状态，吞吐量随线程数增长
+    class Runner
+    {
+        public:
+            // threads为0时取硬件线程数
+            explicit Runner(uint threads = 0);
+
+            ~Runner();
+
+            Runner(const Runner &) = delete;
+
+            Runner &operator=(const Runner &) = delete;
+
+            // 执行全部任务，结果与jobs一一对应；多个线程同时调用时依次进行
+            std::vector<RunResult> Run(const std::vector<RunJob> &jobs);
+
+            uint Threads() const
+            { return (uint) workers_.size(); }
+
+        private:
+            void Work();
+
+            // 出错时status为VmHostError，vm被释放
+            static void Execute(const RunJob &job, RunResult &result, std::unique_ptr<VM> &vm) noexcept;
+
+        private:
+            std::vector<std::thread> workers_;
+            std::mutex run_;                            // 一次只处理一批任务
+            std::mutex mutex_;
+            std::condition_variable wake_;
+            std::condition_variable done_;
+            const std::vector<RunJob> *jobs_{nullptr};
+            std::vector<RunResult> *results_{nullptr};
+            size_t next_{0};
+            size_t finished_{0};
+            bool stop_{false};
+    };
+}
+
+#endif //DRTCC_RUNNER_H
@@ -0,0 +1,113 @@
+//
+// Created by yw.
+//
+
+#include "Source.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace DrTcc
+{
+    Source::~Source()
+    {
+        Close();
+    }
+
+    void Source::Close()
+    {
+        if (map_ != nullptr)
+        {
+#ifdef _WIN32
+            UnmapViewOfFile(map_);
+#else
+            munmap(map_, mapSize_);
+#endif
+            map_ = nullptr;
+            mapSize_ = 0;
+        }
+        buffer_.clear();
+        view_ = StringView();
+    }
+
+#ifdef _WIN32
+    bool Source::Open(const std::string &path)
+    {
+        Close();
+
+        auto file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        { return false; }
+
+        LARGE_INTEGER size;
+        if (GetFileType(file) == FILE_TYPE_DISK && GetFileSizeEx(file, &size) && size.QuadPart > 0)
+        {
+            auto mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping != nullptr)
+            {
+                // 映射对象关闭后视图依然有效
+                map_ = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(mapping);
+                if (map_ != nullptr)
+                {
+                    mapSize_ = (size_t) size.QuadPart;
+                    view_ = StringView((const char *) map_, (uint) mapSize_);
+                    CloseHandle(file);
+                    return true;
+                }
+            }
+        }
+
+        // 无法映射，整块读入
+        char chunk[0x10000];
+        DWORD n;
+        while (ReadFile(file, chunk, sizeof(chunk), &n, nullptr) && n > 0)
+        { buffer_.append(chunk, n); }
+        CloseHandle(file);
+
+        view_ = StringView(buffer_);
+        return true;
+    }
+#else
+    bool Source::Open(const std::string &path)
+    {
+        Close();
+
+        auto fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        { return false; }
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        {
+            auto p = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED)
+            {
+                madvise(p, (size_t) st.st_size, MADV_SEQUENTIAL);
+                map_ = p;
+                mapSize_ = (size_t) st.st_size;
+                view_ = StringView((const char *) map_, (uint) mapSize_);
+                close(fd);
+                return true;
+            }
+        }
+
+        // 管道等无法映射，整块读入
+        char chunk[0x10000];
+        ssize_t n;
+        while ((n = read(fd, chunk, sizeof(chunk))) > 0)
+        { buffer_.append(chunk, (size_t) n); }
+        close(fd);
+
+        view_ = StringView(buffer_);
+        return true;
+    }
+#endif
+}
@@ -0,0 +1,42 @@
+//
+// Created by yw.
+//
+
+#ifndef DRTCC_SOURCE_H
+#define DRTCC_SOURCE_H
+
+#include "Type.h"
+
+namespace DrTcc
+{
+    // 源文件输入
+    // 普通文件只读映射到内存，词法分析直接在映射上进行；管道等无法映射的输入一次性整块读入
+    class Source
+    {
+        public:
+            Source() = default;
+
+            ~Source();
+
+            Source(const Source &) = delete;
+
+            Source &operator=(const Source &) = delete;
+
+            bool Open(const std::string &path);
+
+            // 源码视图，在Source析构前有效
+            StringView View() const
+            { return view_; }
+
+        private:
+            void Close();
+
+        private:
+            StringView view_;
+            std::string buffer_;        // 不能映射时的读入缓冲
+            void *map_{nullptr};        // 映射的起始地址
+            size_t mapSize_{0};
+    };
+}
+
+#endif //DRTCC_SOURCE_H
@@ -0,0 +1,180 @@
+//
+// Created by yw.
+//
+
+#include "Tier.h"
+#include "Optimizer.h"
+
+#define TIER_DEBUG 0
+
+namespace DrTcc
+{
+    Tier::Tier(const std::vector<TextType> &text, std::vector<int> entries) : text_(text), entries_(std::move(entries))
+    {
+        std::sort(entries_.begin(), entries_.end());
+        entries_.erase(std::unique(entries_.begin(), entries_.end()), entries_.end());
+        requested_.assign(entries_.size(), 0);
+    }
+
+    Tier::~Tier()
+    {
+        if (worker_.joinable())
+        { worker_.join(); }
+    }
+
+    int Tier::Find(int addr) const
+    {
+        auto f = std::upper_bound(entries_.begin(), entries_.end(), addr);
+        if (f == entries_.begin() || addr < 0 || addr >= (int) text_.size())
+        { return -1; }
+        return (int) (f - entries_.begin()) - 1;
+    }
+
+    int Tier::End(int func) const
+    {
+        return func + 1 < (int) entries_.size() ? entries_[func + 1] : (int) text_.size();
+    }
+
+    bool Tier::Request(int func)
+    {
+        if (func < 0 || requested_[func])
+        { return false; }
+        requested_[func] = 1;
+        if (busy_)
+        { pending_.push_back(func); }
+        else
+        { Start(func); }
+        return true;
+    }
+
+    void Tier::Start(int func)
+    {
+        busy_ = true;
+        worker_ = std::thread(&Tier::Compile, this, func);
+    }
+
+    bool Tier::Poll(Code &code)
+    {
+        if (!ready_)
+        { return false; }
+        worker_.join();
+        code = std::move(result_);
+        ready_ = false;
+        busy_ = false;
+        if (!pending_.empty())
+        {
+            Start(pending_.front());
+            pending_.pop_front();
+        }
+        return true;
+    }
+
+    void Tier::Compile(int func)
+    {
+        auto entry = Entry(func);
+        auto end = End(func);
+        Code code{func, {}, 0, 0, {}};
+
+        // 只优化这一个函数，它之前的代码原样保留，因此函数入口地址不变
+        std::vector<TextType> text(text_.begin(), text_.begin() + end);
+        std::unordered_map<int, int> depth;
+        if (text[entry] == ENT && Optimizer::StackDepth(text, entry, end, depth))
+        {
+            // 可做栈上替换的位置: 运行栈为空的循环头(回边跳转的目标)
+            std::vector<int> heads;
+            for (auto pc = entry; pc < end; pc += Optimizer::InsLength(text[pc]))
+            {
+                if (text[pc] != JMP)
+                { continue; }
+                auto target = text[pc + 1];
+                if (target >= entry && target <= pc && depth[target] == 0)
+                { heads.push_back(target); }
+            }
+
+            Optimizer opt(text);
+            opt.AddFunc(entry);
+            for (auto h : heads)
+            { opt.Track(h); }
+            opt.SetFuse(true);
+            opt.Optimize();
+
+            auto begin = opt.Relocate(entry);
+            code.frame = text_[entry + 1];
+            code.newFrame = text[begin + 1];
+            code.text.assign(text.begin() + begin, text.end());
+
+            // 函数内的跳转改为相对函数起点，CALL保持绝对地址
+            for (size_t pc = 0; pc < code.text.size(); pc += Optimizer::InsLength(code.text[pc]))
+            {
+                auto op = code.text[pc];
+                if (op == JMP || op == JZ || op == JNZ)
+                { code.text[pc + 1] -= begin; }
+            }
+
+            for (auto h : heads)
+            {
+                auto n = opt.Relocate(h);
+                if (n >= begin && !SlotLive(code.text, code.frame, code.newFrame, n - begin))
+                { code.osr[h] = n - begin; }
+            }
+#if TIER_DEBUG
+            printf("[TIER] func %d: %d -> %d words, %d osr entries\n", entry, end - entry, (int) code.text.size(),
+                   (int) code.osr.size());
+#endif
+        }
+
+        result_ = std::move(code);
+        ready_ = true;
+    }
+
+    bool Tier::SlotLive(const std::vector<TextType> &text, int frame, int newFrame, int addr)
+    {
+        // 从addr进入时，是否有备用槽(优化新增的栈帧空间)会在写入前被读取
+        // 这样的位置不能做栈上替换
+        std::vector<int> pc;
+        std::unordered_map<int, int> index;
+        for (auto i = 0; i < (int) text.size(); i += Optimizer::InsLength(text[i]))
+        {
+            index[i] = (int) pc.size();
+            pc.push_back(i);
+        }
+        auto slot = [&](int off) -> uint32_t {
+            if (off >= -frame || off < -newFrame)
+            { return 0; }
+            return 1u << (((-off - frame) / 4 - 1) & 31);
+        };
+
+        std::vector<uint32_t> live(pc.size() + 1, 0);
+        auto changed = true;
+        while(changed)
+        {
+            changed = false;
+            for (auto i = (int) pc.size() - 1; i >= 0; --i)
+            {
+                auto op = text[pc[i]];
+                uint32_t out = 0;
+                if (op != JMP && op != LEV)
+                { out |= live[i + 1]; }
+                if (op == JMP || op == JZ || op == JNZ)
+                {
+                    auto t = index.find(text[pc[i] + 1]);
+                    if (t != index.end())
+                    { out |= live[t->second]; }
+                }
+                auto in = out;
+                if (op == STL)
+                { in &= ~slot(text[pc[i] + 1]); }
+                else if (op == LDL || op == PSHL)
+                { in |= slot(text[pc[i] + 1]); }
+                if (in != live[i])
+                {
+                    live[i] = in;
+                    changed = true;
+                }
+            }
+        }
+
+        auto i = index.find(addr);
+        return i == index.end() || live[i->second] != 0;
+    }
+}
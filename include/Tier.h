@@ -0,0 +1,72 @@
+//
+// Created by yw.
+//
+
+#ifndef DRTCC_TIER_H
+#define DRTCC_TIER_H
+
+#include <thread>
+#include <atomic>
+#include "Type.h"
+#include "Token.h"
+
+namespace DrTcc
+{
+    // 分层执行
+    // 程序以未优化的字节码启动，VM统计函数调用和循环回边次数，
+    // 热点函数在后台线程中经优化器重新编译，由VM在安全点安装
+    class Tier
+    {
+            using TextType = BaseType<TokenType::Int>::type;
+        public:
+            // 一个函数的优化结果
+            struct Code
+            {
+                int func;                                   // 函数序号
+                std::vector<TextType> text;                 // 函数体，跳转地址相对函数起点
+                int frame;                                  // 优化前的栈帧大小
+                int newFrame;                               // 优化后的栈帧大小
+                std::unordered_map<int, int> osr;           // 栈上替换: 原循环头地址 -> 新代码中的偏移
+            };
+
+            Tier(const std::vector<TextType> &text, std::vector<int> entries);
+
+            ~Tier();
+
+            // 地址所在函数的序号, -1 表示不在任何函数内
+            int Find(int addr) const;
+
+            int Entry(int func) const
+            { return entries_[func]; }
+
+            int End(int func) const;
+
+            // 请求后台编译，已有编译任务时排队，已请求过时返回false
+            bool Request(int func);
+
+            bool Ready() const
+            { return ready_; }
+
+            // 取出已完成的编译结果
+            bool Poll(Code &code);
+
+        private:
+            void Start(int func);
+
+            void Compile(int func);
+
+            static bool SlotLive(const std::vector<TextType> &text, int frame, int newFrame, int addr);
+
+        private:
+            std::vector<TextType> text_;                    // 未优化的字节码
+            std::vector<int> entries_;
+            std::vector<char> requested_;
+            std::deque<int> pending_;                       // 等待编译的函数
+            std::thread worker_;
+            std::atomic<bool> busy_{false};
+            std::atomic<bool> ready_{false};
+            Code result_;
+    };
+}
+
+#endif //DRTCC_TIER_H
@@ -123,6 +123,8 @@ namespace DrTcc
             std::make_tuple(OperatorType::LeftShiftAssign, "<<=", "left_shift_assign", SHL, 1407),
             std::make_tuple(OperatorType::RightShiftAssign, ">>=", "right_shift_assign", SHR, 1408),
             std::make_tuple(OperatorType::Ellipsis, "...", "ellipsis", NOP, 9000),
+            std::make_tuple(OperatorType::Sharp, "#", "sharp", NOP, 9000),
+            std::make_tuple(OperatorType::SharpSharp, "##", "sharp_sharp", NOP, 9000),
             std::make_tuple(OperatorType::OpEnd, "@END", "@END", NOP, 9999),
     };
 
@@ -57,6 +57,7 @@ namespace DrTcc
             LeftShiftAssign,                    // <<=
             RightShiftAssign,                    // >>=
             Ellipsis,                           // ...
+            Sharp, SharpSharp,                  // #, ## 仅用于预处理
             OpEnd,                              // @END
     };
 
@@ -110,7 +111,7 @@ namespace DrTcc
     DEFINE_BASETYPE(TokenType::Double, double)
     DEFINE_BASETYPE(TokenType::Operator, OperatorType)
     DEFINE_BASETYPE(TokenType::Keyword, TokenType)
-    DEFINE_BASETYPE(TokenType::Identifier, std::string)
+    DEFINE_BASETYPE(TokenType::Identifier, int)    // 标识符ID, 见Lexer::Name
     DEFINE_BASETYPE(TokenType::String, std::string)
     DEFINE_BASETYPE(TokenType::Comment, std::string)
     DEFINE_BASETYPE(TokenType::Space, uint)
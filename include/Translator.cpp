@@ -0,0 +1,630 @@
+//
+// Created by yw.
+//
+
+#include "Translator.h"
+#include "Optimizer.h"
+#include "VM.h"
+
+namespace DrTcc
+{
+    // 生成文件的运行库: 与VM相同的段布局(text 0xc0000000, data 0xd0000000, stack 0xe0000000, heap 0xf0000000)，
+    // 每段为一块连续内存，访存时检查越界
+    // RT_NATIVE: 供本地目标文件链接，4GB地址空间整体预留，段映射在其中，内建函数对外可见
+    static const char *RuntimeSource = R"(#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#if RT_NATIVE
+#include <sys/mman.h>
+#endif
+
+#define RT_DATA 0xd0000000u
+#define RT_STACK 0xe0000000u
+#define RT_HEAP 0xf0000000u
+#define RT_PAGE 4096u
+#ifndef RT_STACK_SIZE
+#define RT_STACK_SIZE (256u * RT_PAGE)
+#endif
+#ifndef RT_HEAP_SIZE
+#define RT_HEAP_SIZE (1000u * RT_PAGE)
+#endif
+#define RT_FILES 64
+#if RT_NATIVE
+#define RT_FN
+#elif defined(__GNUC__)
+#define RT_FN static __attribute__((unused))
+#else
+#define RT_FN static
+#endif
+
+static unsigned char *rt_seg[16];
+static uint32_t rt_size[16];
+static uint32_t rt_brk = RT_HEAP;
+static FILE *rt_file[RT_FILES];
+static int rt_log;
+#if RT_NATIVE
+unsigned char *rt_base;
+#endif
+
+static void rt_fault(uint32_t va)
+{
+    fflush(stdout);
+    fprintf(stderr, "invalid address: %08X\n", va);
+    exit(-1);
+}
+
+RT_FN void rt_trap(const char *ins)
+{
+    fflush(stdout);
+    fprintf(stderr, "unknown instruction: %s\n", ins);
+    exit(-1);
+}
+
+static inline unsigned char *rt_ptr(uint32_t va, uint32_t n)
+{
+    uint32_t s = va >> 28, off = va & 0x0fffffffu;
+    if (off > rt_size[s] || n > rt_size[s] - off)
+    { rt_fault(va); }
+    return rt_seg[s] + off;
+}
+
+static inline int R32(uint32_t va)
+{
+    int v;
+    memcpy(&v, rt_ptr(va, 4), 4);
+    return v;
+}
+
+static inline void W32(uint32_t va, int v)
+{ memcpy(rt_ptr(va, 4), &v, 4); }
+
+static inline int R8(uint32_t va)
+{ return *rt_ptr(va, 1); }
+
+static inline void W8(uint32_t va, int v)
+{ *rt_ptr(va, 1) = (unsigned char) v; }
+
+#define PUSH(x) (sp -= 4, W32(sp, (x)))
+#define POP() (sp += 4, R32(sp - 4))
+
+static char *rt_str(uint32_t va)
+{
+    unsigned char *p = rt_ptr(va, 1);
+    if (memchr(p, 0, rt_size[va >> 28] - (va & 0x0fffffffu)) == NULL)
+    { rt_fault(va); }
+    return (char *) p;
+}
+
+/* 参数从左到右入栈，个数由调用后的ADJ给出 */
+static void rt_args(uint32_t sp, int n, int *a)
+{
+    int k;
+    for (k = 0; k < 6; ++k)
+    { a[k] = k < n ? R32(sp + (uint32_t) (n - 1 - k) * 4) : 0; }
+}
+
+static int rt_malloc(uint32_t size)
+{
+    uint32_t va = rt_brk, n = (size + 15u) & ~15u;
+    if (n < size || n > RT_HEAP_SIZE - (rt_brk - RT_HEAP))
+    {
+        printf("out of memory");
+        exit(-1);
+    }
+    rt_brk += n;
+    return (int) va;
+}
+
+RT_FN int rt_printf(uint32_t sp, int n)
+{
+    int a[6], i = 1, len = 0;
+    const char *f;
+    rt_args(sp, n, a);
+    f = rt_str((uint32_t) a[0]);
+    while (*f)
+    {
+        char spec[32], conv;
+        int k = 0, star = 0, w[2] = {0, 0}, v;
+        const char *p = f;
+        if (*f != '%')
+        {
+            while (*p && *p != '%')
+            { ++p; }
+            len += (int) fwrite(f, 1, (size_t) (p - f), stdout);
+            f = p;
+            continue;
+        }
+        spec[k++] = *p++;
+        while (*p && strchr("diouxXcspeEfgGn%", *p) == NULL && k < 30)
+        {
+            if (*p == '*')
+            { star++; }
+            if (strchr("hlLqjzt", *p) == NULL)
+            { spec[k++] = *p; }
+            ++p;
+        }
+        if (*p == 0 || star > 2)
+        {
+            len += (int) fwrite(f, 1, strlen(f), stdout);
+            break;
+        }
+        conv = *p++;
+        spec[k++] = conv;
+        spec[k] = 0;
+        f = p;
+        if (conv == '%')
+        {
+            putchar('%');
+            len++;
+            continue;
+        }
+        for (k = 0; k < star; ++k)
+        { w[k] = i < 6 ? a[i++] : 0; }
+        v = i < 6 ? a[i++] : 0;
+        if (conv == 'n')
+        { continue; }
+#define RT_PRINT(x) (star == 0 ? printf(spec, x) : star == 1 ? printf(spec, w[0], x) : printf(spec, w[0], w[1], x))
+        if (conv == 's')
+        { len += RT_PRINT(rt_str((uint32_t) v)); }
+        else if (strchr("eEfgG", conv) != NULL)
+        { len += RT_PRINT((double) v); }
+        else
+        { len += RT_PRINT(v); }
+#undef RT_PRINT
+    }
+    return len;
+}
+
+RT_FN int rt_open(uint32_t sp, int n)
+{
+    int a[6], i;
+    FILE *fp;
+    rt_args(sp, n, a);
+    fp = fopen(rt_str((uint32_t) a[0]), "rb");
+    if (fp == NULL)
+    { return 0; }
+    for (i = 1; i < RT_FILES; ++i)
+    {
+        if (rt_file[i] == NULL)
+        {
+            rt_file[i] = fp;
+            return i;
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+static FILE *rt_fp(int fd)
+{ return fd > 0 && fd < RT_FILES ? rt_file[fd] : NULL; }
+
+RT_FN int rt_read(uint32_t sp, int n)
+{
+    int a[6], ax;
+    FILE *fp;
+    char *buf;
+    rt_args(sp, n, a);
+    fp = rt_fp(a[0]);
+    if (fp == NULL)
+    { return -1; }
+    buf = (char *) rt_ptr((uint32_t) a[1], (uint32_t) a[2] + 1);
+    ax = (int) fread(buf, 1, (size_t) a[2], fp);
+    if (ax > 0)
+    {
+        rewind(fp);
+        ax = (int) fread(buf, 1, (size_t) ax, fp);
+        buf[ax] = 0;
+    }
+    return ax;
+}
+
+RT_FN int rt_close(uint32_t sp, int n)
+{
+    int a[6];
+    FILE *fp;
+    rt_args(sp, n, a);
+    fp = rt_fp(a[0]);
+    if (fp == NULL)
+    { return -1; }
+    rt_file[a[0]] = NULL;
+    return fclose(fp);
+}
+
+RT_FN int rt_malc(uint32_t sp, int n)
+{
+    int a[6];
+    rt_args(sp, n, a);
+    return rt_malloc((uint32_t) a[0]);
+}
+
+RT_FN int rt_mset(uint32_t sp, int n)
+{
+    int a[6];
+    rt_args(sp, n, a);
+    memset(rt_ptr((uint32_t) a[0], (uint32_t) a[2]), a[1], (size_t) (uint32_t) a[2]);
+    return 0;
+}
+
+RT_FN int rt_mcmp(uint32_t sp, int n)
+{
+    int a[6];
+    const unsigned char *x, *y;
+    uint32_t i;
+    rt_args(sp, n, a);
+    x = rt_ptr((uint32_t) a[0], (uint32_t) a[2]);
+    y = rt_ptr((uint32_t) a[1], (uint32_t) a[2]);
+    for (i = 0; i < (uint32_t) a[2]; ++i)
+    {
+        if (x[i] != y[i])
+        { return x[i] > y[i] ? 1 : -1; }
+    }
+    return 0;
+}
+
+RT_FN int rt_trac(uint32_t sp, int n)
+{
+    int a[6], ax = rt_log;
+    rt_args(sp, n, a);
+    rt_log = a[0] != 0;
+    return ax;
+}
+
+/* VM中返回宿主指针，这里地址即虚拟地址 */
+RT_FN int rt_tran(uint32_t sp, int n)
+{
+    int a[6];
+    rt_args(sp, n, a);
+    return a[0];
+}
+
+RT_FN void rt_exit(int ax)
+{
+    printf("exit(%d)\n", ax);
+    fflush(stdout);
+    exit(ax);
+}
+
+static unsigned char *rt_map(uint32_t base, uint32_t size)
+{
+    rt_size[base >> 28] = size;
+#if RT_NATIVE
+    /* 未映射的地址访问时触发SIGSEGV */
+    if (rt_base == NULL)
+    {
+        void *p = mmap(NULL, (1ull << 32) + (1u << 16), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED)
+        { return NULL; }
+        rt_base = (unsigned char *) p;
+    }
+    if (size != 0 && mprotect(rt_base + base, size, PROT_READ | PROT_WRITE) != 0)
+    { return NULL; }
+    return rt_seg[base >> 28] = rt_base + base;
+#else
+    return rt_seg[base >> 28] = (unsigned char *) calloc(size + 1, 1);
+#endif
+}
+
+static uint32_t rt_init(const unsigned char *data, uint32_t size, int argc, char **argv)
+{
+    uint32_t sp, argvs, tmp;
+    int i;
+    rt_map(RT_DATA, (size + RT_PAGE - 1) & ~(RT_PAGE - 1));
+    rt_map(RT_STACK, RT_STACK_SIZE);
+    rt_map(RT_HEAP, RT_HEAP_SIZE);
+    if (rt_seg[RT_DATA >> 28] == NULL || rt_seg[RT_STACK >> 28] == NULL || rt_seg[RT_HEAP >> 28] == NULL)
+    {
+        printf("out of memory");
+        exit(-1);
+    }
+    memcpy(rt_seg[RT_DATA >> 28], data, size);
+
+    argvs = (uint32_t) rt_malloc((uint32_t) argc * 4);
+    for (i = 0; i < argc; i++)
+    {
+        uint32_t len = (uint32_t) strlen(argv[i]) + 1;
+        uint32_t str = (uint32_t) rt_malloc(len > 256 ? len : 256);
+        memcpy(rt_ptr(str, len), argv[i], len);
+        W32(argvs + 4 * i, (int) str);
+    }
+
+    /* main返回到栈上的 PUSH; EXIT */
+    sp = RT_STACK + RT_STACK_SIZE;
+    PUSH(RT_OP_EXIT);
+    PUSH(RT_OP_PUSH);
+    tmp = sp;
+    PUSH(argc);
+    PUSH((int) argvs);
+    PUSH((int) tmp);
+    return sp;
+}
+)";
+
+    // 本地目标文件的入口，符号由Native生成
+    static const char *NativeMain = R"(
+extern const unsigned char drtcc_data[];
+extern const uint32_t drtcc_data_size;
+int drtcc_main(uint32_t sp, unsigned char *base);
+
+int main(int argc, char **argv)
+{
+    uint32_t sp = rt_init(drtcc_data, drtcc_data_size, argc, argv);
+    int ax = drtcc_main(sp, rt_base);
+    rt_exit(ax);
+    return ax;
+}
+)";
+
+    Translator::Translator(const std::vector<TextType> &text, const std::vector<DataType> &data,
+                           const std::map<int, std::string> &funcs, int entry)
+            : text_(text), data_(data), funcs_(funcs), entry_(entry)
+    {
+    }
+
+    static std::string Lit(int value)
+    {
+        // -2147483648 在C中不是int字面量
+        if (value == INT_MIN)
+        { return "(-2147483647 - 1)"; }
+        return std::to_string(value);
+    }
+
+    static std::string Name(const std::string &func)
+    {
+        return "f_" + func;
+    }
+
+    void Translator::Runtime(std::ostream &os, bool native)
+    {
+        os << "/* Generated by DrTcc */\n";
+        os << "#define RT_NATIVE " << (native ? 1 : 0) << "\n";
+        os << "#define RT_OP_PUSH " << PUSH << "\n";
+        os << "#define RT_OP_EXIT " << EXIT << "\n";
+        os << RuntimeSource << "\n";
+        if (native)
+        { os << NativeMain; }
+    }
+
+    void Translator::Write(std::ostream &os)
+    {
+        auto main = funcs_.find(entry_);
+        if (main == funcs_.end())
+        {
+            printf("main() not defined\n");
+            throw std::exception();
+        }
+
+        Runtime(os, false);
+
+        os << "static const unsigned char rt_data[" << std::max<size_t>(data_.size(), 1) << "] = {";
+        for (size_t i = 0; i < data_.size(); ++i)
+        { os << (i % 16 == 0 ? "\n    " : " ") << (int) (unsigned char) data_[i] << ","; }
+        os << (data_.empty() ? "0};\n\n" : "\n};\n\n");
+
+        for (const auto &f : funcs_)
+        { os << "static int " << Name(f.second) << "(uint32_t sp, int ax);\n"; }
+        os << "\n";
+        for (auto f = funcs_.begin(); f != funcs_.end(); ++f)
+        {
+            auto next = std::next(f);
+            Func(os, f->first, next != funcs_.end() ? next->first : (int) text_.size(), f->second);
+        }
+
+        os << "int main(int argc, char **argv)\n"
+              "{\n"
+              "    uint32_t sp = rt_init(rt_data, " << data_.size() << "u, argc, argv);\n"
+              "    int ax = " << Name(main->second) << "(sp, 0);\n"
+              "    rt_exit(ax);\n"
+              "    return ax;\n"
+              "}\n";
+    }
+
+    void Translator::Func(std::ostream &os, int begin, int end, const std::string &name)
+    {
+        // 跳转目标处放置标号，函数外的跳转无法翻译
+        std::vector<char> label(text_.size(), 0);
+        for (auto pc = begin; pc < end; pc += Optimizer::InsLength(text_[pc]))
+        {
+            auto op = text_[pc];
+            if (op == JMP || op == JZ || op == JNZ)
+            {
+                auto target = text_[pc + 1];
+                if (target < begin || target >= end)
+                {
+                    printf("translate: jump out of function %s at %d\n", name.c_str(), pc);
+                    throw std::exception();
+                }
+                label[target] = 1;
+            }
+            else if (op == CALL && funcs_.find(text_[pc + 1]) == funcs_.end())
+            {
+                printf("translate: call to non-function address %d in %s\n", text_[pc + 1], name.c_str());
+                throw std::exception();
+            }
+        }
+
+        os << "static int " << Name(name) << "(uint32_t sp, int ax)\n{\n";
+        os << "    uint32_t bp = 0;\n    int t = 0;\n    (void) bp;\n    (void) t;\n";
+        for (auto pc = begin; pc < end; pc += Optimizer::InsLength(text_[pc]))
+        {
+            auto op = text_[pc];
+            auto opr = Optimizer::InsLength(op) > 1 ? text_[pc + 1] : 0;
+            if (label[pc])
+            { os << "L" << pc << ":\n"; }
+            os << "    ";
+            switch (op)
+            {
+                case NOP:
+                    os << ";";
+                    break;
+                case LEA:
+                    os << "ax = (int) (bp + " << Lit(opr) << ");";
+                    break;
+                case IMM:
+                    os << "ax = " << Lit(opr) << ";";
+                    break;
+                case IMX:
+                    os << "rt_trap(\"IMX\");";
+                    break;
+                case JMP:
+                    os << "goto L" << opr << ";";
+                    break;
+                case JZ:
+                    os << "if (!ax) goto L" << opr << ";";
+                    break;
+                case JNZ:
+                    os << "if (ax) goto L" << opr << ";";
+                    break;
+                case CALL:
+                    // 栈上仍保留返回地址，参数位于 bp+8 之后
+                    os << "W32(sp - 4, (int) 0x" << std::hex << (USER_BASE + (pc + 2) * 4) << std::dec
+                       << "u); ax = " << Name(funcs_.at(opr)) << "(sp - 4, ax);";
+                    break;
+                case ENT:
+                    os << "PUSH(0); bp = sp; sp -= " << Lit(opr) << ";";
+                    break;
+                case ADJ:
+                    os << "sp += " << Lit(opr * 4) << ";";
+                    break;
+                case LDL:
+                    os << "ax = R32(bp + " << Lit(opr) << ");";
+                    break;
+                case STL:
+                    os << "W32(bp + " << Lit(opr) << ", ax);";
+                    break;
+                case PSHI:
+                    os << "PUSH(ax); ax = " << Lit(opr) << ";";
+                    break;
+                case PSHL:
+                    os << "PUSH(ax); ax = R32(bp + " << Lit(opr) << ");";
+                    break;
+                case LEV:
+                    os << "return ax;";
+                    break;
+                case LI:
+                    os << "ax = R32((uint32_t) ax);";
+                    break;
+                case SI:
+                    os << "t = POP(); W32((uint32_t) t, ax);";
+                    break;
+                case LC:
+                    os << "ax = R8((uint32_t) ax);";
+                    break;
+                case SC:
+                    os << "t = POP(); W8((uint32_t) t, ax & 0xff);";
+                    break;
+                case PUSH:
+                    os << "PUSH(ax);";
+                    break;
+                case LOAD:
+                    os << "ax = (int) (RT_DATA | ((uint32_t) ax & (RT_PAGE - 1)));";
+                    break;
+                case OR:
+                    os << "t = POP(); ax = t | ax;";
+                    break;
+                case XOR:
+                    os << "t = POP(); ax = t ^ ax;";
+                    break;
+                case AND:
+                    os << "t = POP(); ax = t & ax;";
+                    break;
+                case EQ:
+                    os << "t = POP(); ax = t == ax;";
+                    break;
+                case NE:
+                    os << "t = POP(); ax = t != ax;";
+                    break;
+                case LT:
+                    os << "t = POP(); ax = t < ax;";
+                    break;
+                case GT:
+                    os << "t = POP(); ax = t > ax;";
+                    break;
+                case LE:
+                    os << "t = POP(); ax = t <= ax;";
+                    break;
+                case GE:
+                    os << "t = POP(); ax = t >= ax;";
+                    break;
+                case SHL:
+                    os << "t = POP(); ax = (int) ((uint32_t) t << (ax & 31));";
+                    break;
+                case SHR:
+                    os << "t = POP(); ax = t >> (ax & 31);";
+                    break;
+                case ADD:
+                    os << "t = POP(); ax = (int) ((uint32_t) t + (uint32_t) ax);";
+                    break;
+                case SUB:
+                    os << "t = POP(); ax = (int) ((uint32_t) t - (uint32_t) ax);";
+                    break;
+                case MUL:
+                    os << "t = POP(); ax = (int) ((uint32_t) t * (uint32_t) ax);";
+                    break;
+                case DIV:
+                    os << "t = POP(); ax = t / ax;";
+                    break;
+                case MOD:
+                    os << "t = POP(); ax = t % ax;";
+                    break;
+                case EXIT:
+                    os << "rt_exit(ax);";
+                    break;
+                default:
+                {
+                    auto call = Builtin(op, pc);
+                    if (call.empty())
+                    {
+                        printf("translate: unknown instruction %d at %d\n", op, pc);
+                        throw std::exception();
+                    }
+                    os << "ax = " << call << ";";
+                }
+                    break;
+            }
+            os << "\n";
+        }
+        os << "    return ax;\n}\n\n";
+    }
+
+    std::string Translator::Builtin(int op, int pc) const
+    {
+        // 与VM一致，参数个数取自紧随其后的ADJ
+        auto next = pc + Optimizer::InsLength(op);
+        auto n = next + 1 < (int) text_.size() && text_[next] == ADJ ? text_[next + 1] : 0;
+        const char *name;
+        switch (op)
+        {
+            case PRTF:
+                name = "rt_printf";
+                break;
+            case OPEN:
+                name = "rt_open";
+                break;
+            case READ:
+                name = "rt_read";
+                break;
+            case CLOS:
+                name = "rt_close";
+                break;
+            case MALC:
+                name = "rt_malc";
+                break;
+            case MSET:
+                name = "rt_mset";
+                break;
+            case MCMP:
+                name = "rt_mcmp";
+                break;
+            case TRAC:
+                name = "rt_trac";
+                break;
+            case TRAN:
+                name = "rt_tran";
+                break;
+            default:
+                return "";
+        }
+        return std::string(name) + "(sp, " + std::to_string(n) + ")";
+    }
+}
@@ -0,0 +1,45 @@
+//
+// Created by yw.
+//
+
+#ifndef DRTCC_TRANSLATOR_H
+#define DRTCC_TRANSLATOR_H
+
+#include "Type.h"
+#include "Token.h"
+
+namespace DrTcc
+{
+    // 字节码 -> C 源码(AOT)
+    // 每个函数翻译成一个C函数，ax/bp/sp为C局部变量，访存仍按VM的虚拟地址在运行库的内存区间内进行，
+    // 内建函数由生成文件开头的运行库实现，生成的文件可由系统cc编译为独立的可执行文件
+    class Translator
+    {
+            using TextType = BaseType<TokenType::Int>::type;
+            using DataType = BaseType<TokenType::Char>::type;
+        public:
+            // funcs: 函数入口 -> 函数名, entry: main的入口
+            Translator(const std::vector<TextType> &text, const std::vector<DataType> &data,
+                       const std::map<int, std::string> &funcs, int entry);
+
+            ~Translator() = default;
+
+            void Write(std::ostream &os);
+
+            // 内建函数运行库, native为true时供Native生成的目标文件链接
+            static void Runtime(std::ostream &os, bool native);
+
+        private:
+            void Func(std::ostream &os, int begin, int end, const std::string &name);
+
+            std::string Builtin(int op, int pc) const;
+
+        private:
+            const std::vector<TextType> &text_;
+            const std::vector<DataType> &data_;
+            const std::map<int, std::string> &funcs_;
+            int entry_;
+    };
+}
+
+#endif //DRTCC_TRANSLATOR_H
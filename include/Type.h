@@ -20,6 +20,45 @@ namespace DrTcc
     using ulong = unsigned long long;
     using byte = uint8;
 
+    // 源码的非拥有视图(C++14没有std::string_view)，所指向的内存须比视图活得久
+    struct StringView
+    {
+        const char *data{nullptr};
+        uint size{0};
+
+        StringView() = default;
+
+        StringView(const char *d, uint n) : data(d), size(n)
+        {}
+
+        StringView(const std::string &s) : data(s.data()), size((uint) s.length())
+        {}
+
+        char operator[](uint i) const
+        { return data[i]; }
+
+        uint length() const
+        { return size; }
+
+        std::string substr(uint pos, uint n) const
+        { return pos < size ? std::string(data + pos, std::min(n, size - pos)) : std::string(); }
+
+        bool operator==(const StringView &other) const
+        { return size == other.size && memcmp(data, other.data, size) == 0; }
+    };
+
+    // FNV-1a
+    struct StringViewHash
+    {
+        size_t operator()(const StringView &s) const
+        {
+            uint h = 2166136261u;
+            for (uint i = 0; i < s.size; i++)
+            { h = (h ^ (uint8) s.data[i]) * 16777619u; }
+            return h;
+        }
+    };
+
 
     enum ErrorType
     {
@@ -27,10 +66,12 @@ namespace DrTcc
     };
 
     /*指令枚举类*/
+    // 增删或调整指令时，同时增加 Cache.h 中的 CACHE_VERSION
     enum Instrucitons
     {
-        NOP, LEA, IMM, IMX, JMP, CALL, JZ, JNZ, ENT, ADJ, LEV, LI, SI, LC, SC, PUSH, LOAD, OR, XOR, AND, EQ, NE, LT, GT,
-        LE, GE, SHL, SHR, ADD, SUB, MUL, DIV, MOD, OPEN, READ, CLOS, PRTF, MALC, MSET, MCMP, TRAC, TRAN, EXIT
+        NOP, LEA, IMM, IMX, JMP, CALL, JZ, JNZ, ENT, ADJ, LDL, STL, PSHI, PSHL, LEV, LI, SI, LC, SC, PUSH, LOAD, OR,
+        XOR, AND, EQ, NE, LT, GT, LE, GE, SHL, SHR, ADD, SUB, MUL, DIV, MOD, OPEN, READ, CLOS, PRTF, MALC, MSET, MCMP,
+        TRAC, TRAN, EXIT
     };
 }
 
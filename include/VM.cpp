@@ -4,11 +4,12 @@
 
 #include "VM.h"
 #include "GenCode.h"
+#include "Optimizer.h"
+#include <cstdarg>
 
-int globalArgc;
-char **globalArgv;
 #define VM_DEBUG 0
 #define INSTRUCTION_DEBUG  0
+#define CYCLE_DEBUG 0
 
 namespace DrTcc
 {
@@ -18,19 +19,47 @@ namespace DrTcc
 
 
     VM::VM(const std::vector<TextType> &text, const std::vector<DataType> &data)
+            : VM(text.data(), text.size(), data.data(), data.size())
+    {
+    }
+
+    VM::VM(const TextType *text, size_t textSize, const DataType *data, size_t dataSize)
     {
         VmmInit();
+        Load(text, textSize, data, dataSize);
+    }
+
+    void VM::Load(const TextType *text, size_t textSize, const DataType *data, size_t dataSize)
+    {
+        // 清掉上一个程序的用户空间: 页表和页框都来自内存池，整体回收
+        CloseFiles();
+        memory_.Clear();
+        heap_.Clear();
+        for (auto i = PDE_INDEX(USER_BASE); i < PTE_SIZE; i++)
+        { pgd_kern[i] = PTE_P | PTE_R | PTE_K; }
+        textSize_ = (uint32_t) textSize;
+        heapUsed_ = 0;
+        cycles_ = 0;
+        profiling_ = false;
+        counter_.clear();
+        pairs_.clear();
+        prev_ = NOP;
+        tier_.reset();
+        tierCalls_.clear();
+        tierLoops_.clear();
+        tiered_.clear();
+
         uint32_t pa;        // physical address
 
         // 映射 4KB的代码空间
         {
             auto size = PAGE_SIZE / sizeof(int);
-            for (uint32_t i = 0, start = 0; start < text.size(); ++i, start += size)
+            for (uint32_t i = 0, start = 0; start < textSize; ++i, start += size)
             {
                 VmmMap(USER_BASE + PAGE_SIZE * i, (uint32_t) PmmAlloc(), PTE_U | PTE_P | PTE_R); // 用户代码空间
                 if (VmmIsmap(USER_BASE + PAGE_SIZE * i, &pa))
                 {
-                    auto s = start + size > text.size() ? (text.size() & (size - 1)) : size;
+                    auto s = start + size > textSize ? (textSize & (size - 1)) : size;
                     for (uint32_t j = 0; j < s; ++j)
                     {
                         *((uint32_t *) pa + j) = (uint) text[start + j];
@@ -46,12 +75,12 @@ namespace DrTcc
         /* 映射4KB的数据空间 */
         {
             auto size = PAGE_SIZE;
-            for (uint32_t i = 0, start = 0; start < data.size(); ++i, start += size)
+            for (uint32_t i = 0, start = 0; start < dataSize; ++i, start += size)
             {
                 VmmMap(DATA_BASE + PAGE_SIZE * i, (uint32_t) PmmAlloc(), PTE_U | PTE_P | PTE_R); // 用户数据空间
                 if (VmmIsmap(DATA_BASE + PAGE_SIZE * i, &pa))
                 {
-                    auto s = start + size > data.size() ? ((sint) data.size() & (size - 1)) : size;
+                    auto s = start + size > dataSize ? ((sint) dataSize & (size - 1)) : size;
                     for (uint32_t j = 0; j < s; ++j)
                     {
                         *((char *) pa + j) = data[start + j];
@@ -89,6 +118,7 @@ namespace DrTcc
 
     VM::~VM()
     {
+        CloseFiles();
         free(pgd_kern);
         free(pte_kern);
     }
@@ -211,7 +241,7 @@ namespace DrTcc
 #if VM_DEBUG
         printf("VMMGET> Invalid VA: %08X\n", va);
 #endif
-        throw std::exception();
+        Fail(VmBadAddress, "invalid address: %08X", va);
         return VmmGet<T>(va);
     }
 
@@ -229,7 +259,7 @@ namespace DrTcc
 #if VM_DEBUG
         printf("VMMSET> Invalid VA: %08X\n", va);
 #endif
-        throw std::exception();
+        Fail(VmBadAddress, "invalid address: %08X", va);
         return VmmSet(va, value);
     }
 
@@ -244,7 +274,7 @@ namespace DrTcc
 #if VM_DEBUG
         printf("VMMSTR> Invalid VA: %08X\n", va);
 #endif
-        assert(0);
+        Fail(VmBadAddress, "invalid address: %08X", va);
         return VmmGetStr(va);
     }
 
@@ -265,11 +295,7 @@ namespace DrTcc
 #endif
         auto ptr = heap_.AllocArray<byte>(size);
         if (ptr == nullptr)
-        {
-            printf("111\n");
-            printf("out of memory");
-            exit(-1);
-        }
+        { Fail(VmOutOfMemory, "out of memory: %u bytes", size); }
 
         if (ptr < heapHead)
         {
@@ -282,11 +308,7 @@ namespace DrTcc
             return VmmMalloc(size);
         }
         if (ptr + size >= heapHead + HEAP_SIZE * PAGE_SIZE)
-        {
-            printf("000\n");
-            printf("out of memory");
-            exit(-1);
-        }
+        { Fail(VmOutOfMemory, "out of memory: %u bytes", size); }
         auto va = VmmPa2va(HEAP_BASE, HEAP_SIZE, ((uint32_t) ptr - (uint32_t) heapHead));
 
 #if VM_DEBUG
@@ -372,7 +394,212 @@ namespace DrTcc
         }
     }
 
-    int VM::Exec(int entry)
+    int VM::Print(const char *fmt, ...)
+    {
+        va_list ap;
+        va_start(ap, fmt);
+        if (!output_)
+        {
+            auto n = vprintf(fmt, ap);
+            va_end(ap);
+            return n;
+        }
+
+        char buf[256];
+        va_list copy;
+        va_copy(copy, ap);
+        auto n = vsnprintf(buf, sizeof(buf), fmt, ap);
+        va_end(ap);
+        if (n >= (int) sizeof(buf))
+        {
+            std::string big((size_t) n + 1, '\0');
+            vsnprintf(&big[0], big.size(), fmt, copy);
+            output_(big.data(), (size_t) n);
+        }
+        else if (n > 0)
+        { output_(buf, (size_t) n); }
+        va_end(copy);
+        return n;
+    }
+
+    void VM::Profiling(bool enable)
+    {
+        profiling_ = enable;
+        counter_.assign(enable ? textSize_ : 0, SiteCount{0, 0});
+        pairs_.assign(enable ? (EXIT + 1) * (EXIT + 1) : 0, 0);
+        prev_ = NOP;
+    }
+
+    slong VM::PairCount(int a, int b) const
+    {
+        if (pairs_.empty())
+        { return 0; }
+        return pairs_[a * (EXIT + 1) + b];
+    }
+
+    void VM::Count(int op, uint32_t pc, int ax)
+    {
+        // text段中每条指令的执行次数
+        if (pc >= USER_BASE && pc < USER_BASE + counter_.size() * INC_PTR)
+        {
+            auto &c = counter_[(pc - USER_BASE) / INC_PTR];
+            c.hits++;
+            if (ax == 0)
+            { c.zero++; }
+        }
+
+        // 相邻指令对，超级指令按拆开后的指令计数，剖析结果不受指令合并影响
+        auto pair = [&](int next) {
+            if (next < NOP || next > EXIT)
+            { next = NOP; }
+            pairs_[prev_ * (EXIT + 1) + next]++;
+            prev_ = next;
+        };
+        switch (op)
+        {
+            case LDL:
+                pair(LEA);
+                pair(LI);
+                break;
+            case PSHI:
+                pair(PUSH);
+                pair(IMM);
+                break;
+            case PSHL:
+                pair(PUSH);
+                pair(LEA);
+                pair(LI);
+                break;
+            default:
+                pair(op);
+                break;
+        }
+    }
+
+    void VM::Tiering(const std::vector<TextType> &text, const std::vector<int> &entries)
+    {
+        tier_.reset(new Tier(text, entries));
+        tierCalls_.assign(entries.size(), 0);
+        tierLoops_.assign(entries.size(), 0);
+        tiered_.clear();
+    }
+
+    void VM::TierEnter(uint32_t pc)
+    {
+        if (tier_->Ready())
+        { TierInstall(); }
+        auto f = tier_->Find((pc - USER_BASE) / INC_PTR);
+        // 计数到阈值为止；编译线程忙时请求在Tier中排队，不会丢失
+        if (f >= 0 && tierCalls_[f] < VM_TIER_CALLS && ++tierCalls_[f] == VM_TIER_CALLS)
+        { tier_->Request(f); }
+    }
+
+    uint32_t VM::TierLoop(uint32_t pc, uint32_t target, uint32_t bp, uint32_t &sp)
+    {
+        if (tier_->Ready())
+        { TierInstall(); }
+        auto f = tier_->Find((pc - USER_BASE) / INC_PTR);
+        if (f < 0)
+        { return target; }
+        if (tierLoops_[f] < VM_TIER_LOOPS && ++tierLoops_[f] == VM_TIER_LOOPS)
+        { tier_->Request(f); }
+
+        // 栈上替换: 正在旧代码中运行的循环从循环头转入优化后的代码
+        auto t = tiered_.find(f);
+        if (t == tiered_.end() || sp != bp - t->second.frame)
+        { return target; }
+        auto osr = t->second.osr.find((target - USER_BASE) / INC_PTR);
+        if (osr == t->second.osr.end())
+        { return target; }
+        sp = bp - t->second.newFrame;
+#if VM_DEBUG
+        printf("OSR> %08X -> %d\n", target, t->second.addr + osr->second);
+#endif
+        return USER_BASE + (t->second.addr + osr->second) * INC_PTR;
+    }
+
+    void VM::TierInstall()
+    {
+        Tier::Code code;
+        if (!tier_->Poll(code) || code.text.empty())
+        { return; }
+
+        // 优化后的函数追加到text段末尾
+        auto addr = (int) textSize_;
+        auto size = (int) code.text.size();
+        uint32_t pa;
+        for (auto va = PAGE_ALIGN_DOWN(USER_BASE + addr * INC_PTR); va < USER_BASE + (addr + size) * INC_PTR;
+             va += PAGE_SIZE)
+        {
+            if (!VmmIsmap(va, &pa))
+            { VmmMap(va, PmmAlloc(), PTE_U | PTE_P | PTE_R); }
+        }
+        for (auto i = 0; i < size; i += Optimizer::InsLength(code.text[i]))
+        {
+            auto op = code.text[i];
+            VmmSet(USER_BASE + (addr + i) * INC_PTR, op);
+            for (auto k = 1; k < Optimizer::InsLength(op); ++k)
+            {
+                auto opr = code.text[i + k];
+                if (k == 1 && (op == JMP || op == JZ || op == JNZ))
+                { opr += addr; }
+                VmmSet(USER_BASE + (addr + i + k) * INC_PTR, opr);
+            }
+        }
+        textSize_ += size;
+
+        // 调用点改为调用新代码，旧入口改为跳转到新代码
+        auto entry = tier_->Entry(code.func);
+        for (auto i = 0; i < addr; i += Optimizer::InsLength(VmmGet(USER_BASE + i * INC_PTR)))
+        {
+            auto va = USER_BASE + i * INC_PTR;
+            if (VmmGet(va) == CALL && VmmGet(va + INC_PTR) == entry)
+            { VmmSet(va + INC_PTR, addr); }
+        }
+        VmmSet(USER_BASE + (entry + 1) * INC_PTR, addr);
+        VmmSet(USER_BASE + entry * INC_PTR, (int) JMP);
+
+        tiered_[code.func] = TierFunc{addr, code.frame, code.newFrame, std::move(code.osr)};
+#if VM_DEBUG
+        printf("TIER> func %d: %d words at %d\n", entry, size, addr);
+#endif
+    }
+
+    VmStatus VM::Exec(int entry)
+    {
+        message_.clear();
+        exitCode_ = -1;
+        auto status = VmExit;
+        try
+        { exitCode_ = Run(entry); }
+        catch (const Fault &f)
+        {
+            message_ = f.message;
+            status = f.status;
+        }
+        // 出错中止时程序来不及关闭文件，复用的VM不能泄漏句柄
+        CloseFiles();
+        return status;
+    }
+
+    void VM::CloseFiles()
+    {
+        for (auto f : files_)
+        { fclose(f); }
+        files_.clear();
+    }
+
+    void VM::Fail(VmStatus status, const char *fmt, ...)
+    {
+        char buf[256];
+        va_list ap;
+        va_start(ap, fmt);
+        vsnprintf(buf, sizeof(buf), fmt, ap);
+        va_end(ap);
+        throw Fault{status, buf};
+    }
+
+    int VM::Run(int entry)
     {
         auto poolSize = PAGE_SIZE;
         auto stack = STACK_BASE;
@@ -382,18 +609,19 @@ namespace DrTcc
         auto sp = stack + poolSize; // 4KB / sizeof(int) = 1024
 
         {
-            auto argvs = VmmMalloc(globalArgc * INC_PTR);
-            for (auto i = 0; i < globalArgc; i++)
+            auto argc = (int) args_.size();
+            auto argvs = VmmMalloc(std::max(argc, 1) * INC_PTR);     // 内存池不分配0字节
+            for (auto i = 0; i < argc; i++)
             {
-                auto str = VmmMalloc(256);
-                VmmSetStr(str, globalArgv[i]);
+                auto str = VmmMalloc(std::max<uint32_t>(256, (uint32_t) args_[i].length() + 1));
+                VmmSetStr(str, args_[i].c_str());
                 VmmSet(argvs + INC_PTR * i, str);
             }
 
             VmmPushStack(sp, EXIT);
             VmmPushStack(sp, PUSH);
             auto tmp = sp;
-            VmmPushStack(sp, globalArgc);
+            VmmPushStack(sp, argc);
             VmmPushStack(sp, argvs);
             VmmPushStack(sp, tmp);
         }
@@ -406,13 +634,13 @@ namespace DrTcc
 #if 1
         if (log)
         {
-            printf("\n---------------- STACK BEGIN <<<< \n");
-            printf("AX: %08X BP: %08X SP: %08X\n", ax, bp, sp);
+            Print("\n---------------- STACK BEGIN <<<< \n");
+            Print("AX: %08X BP: %08X SP: %08X\n", ax, bp, sp);
             for (uint32_t i = sp; i < STACK_BASE + PAGE_SIZE; i += 4)
             {
-                printf("[%08X]> %08X\n", i, VmmGet<uint32_t>(i));
+                Print("[%08X]> %08X\n", i, VmmGet<uint32_t>(i));
             }
-            printf("---------------- STACK END >>>>\n\n");
+            Print("---------------- STACK END >>>>\n\n");
         }
 #endif
 
@@ -421,7 +649,11 @@ namespace DrTcc
         while(true)
         {
             cycle++;
+            if (cycleLimit_ > 0 && cycle > cycleLimit_)
+            { Fail(VmCycleLimit, "cycle limit exceeded: %lld", (long long) cycleLimit_); }
             auto op = VmmGet(pc); // get next operation code
+            if (profiling_)
+            { Count(op, pc, ax); }
             pc += INC_PTR;
 
 #if INSTRUCTION_DEBUG
@@ -430,14 +662,14 @@ namespace DrTcc
             if (true)
             {
                 printf("%04d> [%08X] %02d %.4s", cycle, pc, op,
-                       &"NOP, LEA ,IMM ,IMX ,JMP ,CALL,JZ  ,JNZ ,ENT ,ADJ ,LEV ,LI  ,SI  ,LC  ,SC  ,PUSH,LOAD,"
+                       &"NOP, LEA ,IMM ,IMX ,JMP ,CALL,JZ  ,JNZ ,ENT ,ADJ ,LDL ,STL ,PSHI,PSHL,LEV ,LI  ,SI  ,LC  ,SC  ,PUSH,LOAD,"
                         "OR  ,XOR ,AND ,EQ  ,NE  ,LT  ,GT  ,LE  ,GE  ,SHL ,SHR ,ADD ,SUB ,MUL ,DIV ,MOD ,"
                         "OPEN,READ,CLOS,PRTF,MALC,MSET,MCMP,TRAC,TRAN,EXIT"[op * 5]);
                 if (op == PUSH)
                 {
                     printf(" %08X\n", (uint32_t) ax);
                 }
-                else if (op <= ADJ)
+                else if (op <= PSHL)
                 {
                     printf(" %d\n", VmmGet(pc));
                 }
@@ -487,7 +719,10 @@ namespace DrTcc
                     break;
                 case JMP:
                 {
-                    pc = base + VmmGet(pc) * INC_PTR;
+                    auto target = base + VmmGet(pc) * INC_PTR;
+                    if (tier_ && target < pc)
+                    { target = TierLoop(pc - INC_PTR, target, bp, sp); }
+                    pc = target;
                 } /* jump to the address */
                     break;
                 case JZ:
@@ -512,9 +747,13 @@ namespace DrTcc
                     break;
                 case ENT:
                 {
+                    // 先取栈帧大小: TierEnter可能正好安装本函数，把入口的ENT改写为跳转
+                    auto frame = VmmGet(pc);
+                    if (tier_)
+                    { TierEnter(pc - INC_PTR); }
                     VmmPushStack(sp, bp);
                     bp = sp;
-                    sp = sp - VmmGet(pc);
+                    sp = sp - frame;
                     pc += INC_PTR;
                 } /* make new stack frame */
                     break;
@@ -540,6 +779,32 @@ namespace DrTcc
                     pc += INC_PTR;
                 } /* load address for arguments. */
                     break;
+                case LDL:
+                {
+                    ax = VmmGet(bp + VmmGet(pc));
+                    pc += INC_PTR;
+                } /* load integer from frame slot bp + <offset> */
+                    break;
+                case STL:
+                {
+                    VmmSet(bp + VmmGet(pc), ax);
+                    pc += INC_PTR;
+                } /* save ax to frame slot bp + <offset>, ax unchanged */
+                    break;
+                case PSHI:
+                {
+                    VmmPushStack(sp, ax);
+                    ax = VmmGet(pc);
+                    pc += INC_PTR;
+                } /* PUSH; IMM <value> */
+                    break;
+                case PSHL:
+                {
+                    VmmPushStack(sp, ax);
+                    ax = VmmGet(bp + VmmGet(pc));
+                    pc += INC_PTR;
+                } /* PUSH; LDL <offset> */
+                    break;
                 case OR:
                     ax = VmmPopStack(sp) | ax;
                     break;
@@ -592,19 +857,26 @@ namespace DrTcc
                 case PRTF:
                 {
                     InitArgs(args, sp, pc);
-                    ax = printf(VmmGetStr(args[0]), args[1], args[2], args[3], args[4], args[5]);
+                    ax = Print(VmmGetStr(args[0]), args[1], args[2], args[3], args[4], args[5]);
                 }
                     break;
                 case EXIT:
                 {
-                    printf("exit(%d)\n", ax);
+#if CYCLE_DEBUG
+                    printf("cycle(%d)\n", cycle);
+#endif
+                    cycles_ = cycle;
+                    Print("exit(%d)\n", ax);
                     return ax;
                 }
                     break;
                 case OPEN:
                 {
                     InitArgs(args, sp, pc);
-                    ax = (int) fopen(VmmGetStr(args[0]), "rb");
+                    auto f = fopen(VmmGetStr(args[0]), "rb");
+                    if (f != nullptr)
+                    { files_.push_back(f); }
+                    ax = (int) f;
 #if VM_DEBUG
                     printf("OPEN> name=%s fd=%08X\n", VmmSetStr(args[0]), ax);
 #endif
@@ -631,13 +903,26 @@ namespace DrTcc
                 case CLOS:
                 {
                     InitArgs(args, sp, pc);
-                    ax = (int) fclose((FILE *) args[0]);
+                    // 只关闭本程序打开且未关闭的文件
+                    auto f = std::find(files_.begin(), files_.end(), (FILE *) args[0]);
+                    if (f == files_.end())
+                    { ax = EOF; }
+                    else
+                    {
+                        ax = fclose(*f);
+                        files_.erase(f);
+                    }
                 }
                     break;
                 case MALC:
                 {
                     InitArgs(args, sp, pc);
-                    ax = (int) VmmMalloc((uint32_t) args[0]);
+                    // 只有程序的malloc计入堆内存上限，VM为main的参数分配的内存不计
+                    auto size = (uint32_t) args[0];
+                    if (heapLimit_ > 0 && (uint64_t) heapUsed_ + size > heapLimit_)
+                    { Fail(VmHeapLimit, "heap limit exceeded: %u bytes", heapLimit_); }
+                    ax = (int) VmmMalloc(size);
+                    heapUsed_ += size;
                 }
                     break;
                 case MSET:
@@ -670,27 +955,27 @@ namespace DrTcc
                     break;
                 default:
                 {
+#if VM_DEBUG
                     printf("AX: %08X BP: %08X SP: %08X PC: %08X\n", ax, bp, sp, pc);
                     for (uint32_t i = sp; i < STACK_BASE + PAGE_SIZE; i += 4)
                     {
                         printf("[%08X]> %08X\n", i, VmmGet<uint32_t>(i));
                     }
-                    printf("unknown instruction:%d\n", op);
-                    throw std::exception();
-                    exit(-1);
+#endif
+                    Fail(VmBadInstruction, "unknown instruction: %d at %08X", op, pc - INC_PTR);
                 }
             }
 
 #if 1
             if (log)
             {
-                printf("\n---------------- STACK BEGIN <<<< \n");
-                printf("AX: %08X BP: %08X SP: %08X PC: %08X\n", ax, bp, sp, pc);
+                Print("\n---------------- STACK BEGIN <<<< \n");
+                Print("AX: %08X BP: %08X SP: %08X PC: %08X\n", ax, bp, sp, pc);
                 for (uint32_t i = sp; i < STACK_BASE + PAGE_SIZE; i += 4)
                 {
-                    printf("[%08X]> %08X\n", i, VmmGet<uint32_t>(i));
+                    Print("[%08X]> %08X\n", i, VmmGet<uint32_t>(i));
                 }
-                printf("---------------- STACK END >>>>\n\n");
+                Print("---------------- STACK END >>>>\n\n");
             }
 #endif
         }
@@ -7,6 +7,9 @@
 
 #include "Type.h"
 #include "MemoryPool.h"
+#include "Profile.h"
+#include "Tier.h"
+#include <functional>
 // 对于一个32位虚拟地址（virtual address）
 // 32-22: 页目录号 | 21-12: 页表号 | 11-0: 页内偏移
 
@@ -59,6 +62,10 @@ using pte_t = uint32_t;
 #define SEGMENT_MASK 0x0fffffff    //   +--------------------+  --> 0x00000000
 
 
+/* 分层执行: 函数调用次数/循环回边次数达到阈值后优化该函数 */
+#define VM_TIER_CALLS 1000
+#define VM_TIER_LOOPS 10000
+
 /* 物理内存(单位：16B) */
 #define PHY_MEM (16 * 1024)
 /* 堆内存(单位：16B) */
@@ -66,6 +73,19 @@ using pte_t = uint32_t;
 
 namespace DrTcc
 {
+    // 执行结果，出错时不再结束进程，由调用者处理
+    enum VmStatus
+    {
+        VmExit,             // 正常结束(exit或main返回)，返回值见ExitCode
+        VmBadAddress,       // 访问未映射的地址
+        VmOutOfMemory,      // 堆内存耗尽
+        VmBadInstruction,   // 未知指令
+        VmCycleLimit,       // 超出指令数上限
+        VmHeapLimit,        // 超出堆内存上限
+        VmHostError,        // 宿主一侧出错(装入程序失败、宿主内存不足)，程序未执行或中途放弃
+    };
+
+    // 所有状态(内存、参数、输出、分层执行)都属于实例，不同线程中的VM互不影响
     class VM
     {
             using TextType = BaseType<TokenType::Int>::type;
@@ -73,9 +93,53 @@ namespace DrTcc
         public:
             explicit VM(const std::vector<TextType> &text, const std::vector<DataType> &data);
 
+            // 直接引用映射的字节码映像，不经过vector拷贝
+            VM(const TextType *text, size_t textSize, const DataType *data, size_t dataSize);
+
             ~VM();
 
-            int Exec(int entry = -1);
+            // 装入另一个程序，复用已建好的页表和内存池，省去重新构造VM
+            void Load(const TextType *text, size_t textSize, const DataType *data, size_t dataSize);
+
+            VmStatus Exec(int entry = -1);
+
+            // 上一次Exec的返回值，出错时为-1
+            int ExitCode() const
+            { return exitCode_; }
+
+            // 上一次Exec出错时的说明
+            const std::string &Message() const
+            { return message_; }
+
+            // main的参数，args[0]为程序名
+            void Args(std::vector<std::string> args)
+            { args_ = std::move(args); }
+
+            // 程序的输出(printf等)交给sink，为空时写到标准输出
+            void Output(std::function<void(const char *, size_t)> sink)
+            { output_ = std::move(sink); }
+
+            // 执行的指令数和堆内存的字节数上限，0为不限，超出时Exec返回VmCycleLimit/VmHeapLimit
+            // 堆内存按程序malloc申请的字节数累计(没有free)，不含VM为main的参数分配的内存
+            void Limit(slong cycles, uint32_t heap)
+            {
+                cycleLimit_ = cycles;
+                heapLimit_ = heap;
+            }
+
+            // 剖析模式: 统计每条指令的执行次数和相邻指令对
+            void Profiling(bool enable);
+
+            const std::vector<SiteCount> &Counters() const
+            { return counter_; }
+
+            slong PairCount(int a, int b) const;
+
+            slong Cycles() const
+            { return cycles_; }
+
+            // 分层执行: 热点函数在后台优化后替换
+            void Tiering(const std::vector<TextType> &text, const std::vector<int> &entries);
 
         private:
             // 初始化页表
@@ -122,6 +186,28 @@ namespace DrTcc
 
             void InitArgs(uint32_t *args, uint32_t sp, uint32_t pc, bool converted = false);
 
+            int Print(const char *fmt, ...);
+
+            int Run(int entry);
+
+            // 运行时错误，由Exec捕获后转为状态码
+            struct Fault
+            {
+                VmStatus status;
+                std::string message;
+            };
+
+            [[noreturn]] static void Fail(VmStatus status, const char *fmt, ...);
+
+            void Count(int op, uint32_t pc, int ax);
+
+            void TierEnter(uint32_t pc);
+
+            uint32_t TierLoop(uint32_t pc, uint32_t target, uint32_t bp, uint32_t &sp);
+
+            void TierInstall();
+
+            void CloseFiles();
 
         private:
             /* 内核页表 = PTE_SIZE * PAGE_SIZE */
@@ -137,6 +223,32 @@ namespace DrTcc
             MemoryPool<HEAP_MEM> heap_;
             byte *heapHead;
 
+            uint32_t textSize_;
+            std::vector<std::string> args_;
+            std::function<void(const char *, size_t)> output_;
+            int exitCode_{0};
+            std::string message_;
+            std::vector<FILE *> files_;         // 程序打开的文件，Exec结束(含出错)时关闭
+            slong cycleLimit_{0};
+            uint32_t heapLimit_{0};
+            uint32_t heapUsed_{0};
+            slong cycles_{0};
+            bool profiling_{false};
+            std::vector<SiteCount> counter_;
+            std::vector<slong> pairs_;
+            int prev_{NOP};
+
+            // 已安装的优化代码
+            struct TierFunc
+            {
+                int addr;
+                int frame, newFrame;
+                std::unordered_map<int, int> osr;
+            };
+            std::unique_ptr<Tier> tier_;
+            std::vector<int> tierCalls_, tierLoops_;
+            std::unordered_map<int, TierFunc> tiered_;
+
     };
 }
 
@@ -1,12 +1,58 @@
 #include <iostream>
+#include <functional>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 #include "GenCode.h"
 #include "Parser.h"
+#include "Translator.h"
+#include "Native.h"
+#include "Source.h"
+#include "Image.h"
+#include "Cache.h"
+#include "Linker.h"
+#include "Preprocessor.h"
+#include "Program.h"
 
 #define Test 0
-extern int globalArgc;
-extern char **globalArgv;
+// 命令行参数，解析选项时逐个消耗
+static int globalArgc;
+static char **globalArgv;
+
+struct Options
+{
+    std::string profileGen;     // --profile-gen <file>: 剖析运行，保存执行计数
+    std::string profileUse;     // --profile-use <file>: 使用执行计数指导优化
+    bool tier{false};           // --tier: 以未优化的字节码启动，运行时优化热点函数
+    std::string emit;           // --emit c|exe|obj|native|image|object: 不运行，输出C源码/经C编译的可执行文件/x86-64目标文件/链接后的可执行文件/字节码映像/可重定位字节码
+    bool link{false};           // --link: 其余参数都是目标文件(.dto)或源文件，链接为字节码映像
+    std::string output;         // -o <file>: 输出文件
+    std::string cache;          // --cache <dir>: 编译缓存目录，源码和选项不变时直接运行缓存的字节码映像，否则复用未改动函数的字节码
+    uint64_t cacheLimit{CACHE_LIMIT};   // --cache-limit <bytes>: 缓存目录大小上限
+    bool cacheStats{false};     // --cache-stats: 结束时输出缓存命中/未命中次数
+    std::string input;          // 源文件路径，函数级缓存和""形式的#include按它区分
+    std::vector<std::string> args;  // 程序main的参数，args[0]为程序名
+    std::vector<std::string> includes;  // -I <dir>: 头文件搜索目录，可多次指定
+    bool serve{false};          // --serve: 服务模式，逐行读取任务，编译结果和VM在任务间复用
+    std::string socket;         // --socket <path>: 服务模式从Unix域套接字而不是标准输入读取任务
+};
+
+// 分好词的头文件，进程内各翻译单元共用
+static DrTcc::HeaderCache headers;
 
-void CompileAndRun(const std::string &sourceCode);
+void CompileAndRun(DrTcc::StringView sourceCode, const Options &options = Options());
+
+void RunImage(DrTcc::StringView image, const Options &options = Options());
+
+void Link(int argc, char **argv, const Options &options);
+
+void Serve(const Options &options);
 
 int main(int argc, char **argv)
 {
@@ -38,24 +84,123 @@ int main()
     globalArgc--;
     globalArgv++;
 
+    Options options;
+    while(globalArgc > 0 && **globalArgv == '-')
+    {
+        std::string opt = *globalArgv;
+        if (opt == "--tier" || opt == "--cache-stats" || opt == "--link" || opt == "--serve")
+        {
+            (opt == "--tier" ? options.tier : opt == "--link" ? options.link :
+                                              opt == "--serve" ? options.serve : options.cacheStats) = true;
+            globalArgc--;
+            globalArgv++;
+            continue;
+        }
+        if (globalArgc < 2)
+        {
+            std::cout << "Missing value for option: " << opt << "\n";
+            return -1;
+        }
+        if (opt == "--profile-gen")
+        { options.profileGen = globalArgv[1]; }
+        else if (opt == "--profile-use")
+        { options.profileUse = globalArgv[1]; }
+        else if (opt == "--emit")
+        {
+            options.emit = globalArgv[1];
+            if (options.emit != "c" && options.emit != "exe" && options.emit != "obj" && options.emit != "native" &&
+                options.emit != "image" && options.emit != "object")
+            {
+                std::cout << "Unknown emit kind: " << options.emit << "\n";
+                return -1;
+            }
+        }
+        else if (opt == "-o")
+        { options.output = globalArgv[1]; }
+        else if (opt == "-I")
+        { options.includes.emplace_back(globalArgv[1]); }
+        else if (opt == "--cache")
+        { options.cache = globalArgv[1]; }
+        else if (opt == "--cache-limit")
+        { options.cacheLimit = strtoull(globalArgv[1], nullptr, 10); }
+        else if (opt == "--socket")
+        { options.socket = globalArgv[1]; }
+        else
+        {
+            std::cout << "Unknown option: " << opt << "\n";
+            return -1;
+        }
+        globalArgc -= 2;
+        globalArgv += 2;
+    }
+
+    if (options.serve)
+    {
+        try
+        { Serve(options); }
+        catch (const std::exception &e)
+        {
+            std::cout << e.what() << '\n';
+            return -1;
+        }
+        return 0;
+    }
+
     if (globalArgc < 1)
     {
-        std::cout << "Usage: DrTcc file..\n";
+        std::cout << "Usage: DrTcc [--tier] [--profile-gen file | --profile-use file] [--emit c|exe|obj|native|image|object [-o file]] [--cache dir [--cache-limit bytes] [--cache-stats]] [-I dir].. file..\n"
+                  << "       DrTcc --link [--tier] [-I dir].. [-o file] file.dto|file..\n"
+                  << "       DrTcc --serve [--socket path] [--tier] [-I dir]..\n";
         return -1;
     }
 
-    std::ifstream sourceFile(*globalArgv);
-    std::istreambuf_iterator<char> begin_(sourceFile);
-    std::istreambuf_iterator<char> end_;
+    if ((!options.emit.empty() || options.link) && options.output.empty())
+    {
+        // 默认输出: xc.txt -> xc.txt.c / xc.o / xc.dtc / xc.dto / xc
+        std::string source = *globalArgv;
+        auto dot = source.find_last_of('.');
+        auto slash = source.find_last_of("/\\");
+        auto stem = source + ".out";
+        if (dot != std::string::npos && (slash == std::string::npos || dot > slash))
+        { stem = source.substr(0, dot); }
+        if (options.emit == "c")
+        { options.output = source + ".c"; }
+        else if (options.emit == "obj")
+        { options.output = stem + ".o"; }
+        else if (options.emit == "image" || options.link)
+        { options.output = stem + ".dtc"; }
+        else if (options.emit == "object")
+        { options.output = stem + ".dto"; }
+        else
+        { options.output = stem; }
+    }
 
-    std::string sourceCode_(begin_, end_);
+    if (options.link)
+    {
+        try
+        { Link(globalArgc, globalArgv, options); }
+        catch (const std::exception &e)
+        {
+            std::cout << e.what() << '\n';
+            return -1;
+        }
+        return 0;
+    }
 
-    if (sourceCode_.empty())
+    // 普通文件直接映射，不再拷贝
+    DrTcc::Source source;
+    if (!source.Open(*globalArgv) || source.View().length() == 0)
     { exit(-1); }
 
+    options.input = *globalArgv;
+    options.args.assign(globalArgv, globalArgv + globalArgc);
     try
     {
-        CompileAndRun(sourceCode_);
+        // 字节码映像跳过前端直接运行
+        if (DrTcc::Image::Is(source.View()))
+        { RunImage(source.View(), options); }
+        else
+        { CompileAndRun(source.View(), options); }
     }
     catch (const std::exception &e)
     {
@@ -67,10 +212,436 @@ int main()
     return 0;
 }
 
-void CompileAndRun(const std::string &sourceCode)
+static void WriteFile(const std::string &path, const std::function<void(std::ostream &)> &write)
+{
+    std::ofstream file(path, std::ios::binary);
+    write(file);
+    file.close();
+    if (!file)
+    {
+        printf("cannot write: %s\n", path.c_str());
+        throw std::exception();
+    }
+}
+
+static void Cc(const std::string &args)
+{
+    // 系统cc，可用环境变量CC指定
+    auto cc = getenv("CC");
+    auto cmd = std::string(cc != nullptr ? cc : "cc") + " -O2 " + args;
+    if (system(cmd.c_str()) != 0)
+    {
+        printf("cc failed: %s\n", cmd.c_str());
+        throw std::exception();
+    }
+}
+
+// AOT: c/exe 经C源码, obj/native 直接生成x86-64 ELF目标文件，运行库以C源码输出到 <目标文件>.rt.c
+static void Emit(const DrTcc::GenCode &genCode, const Options &options)
+{
+    const auto &out = options.output;
+    auto funcs = genCode.Funcs();
+    if (options.emit == "object")
+    {
+        WriteFile(out, [&](std::ostream &os) { DrTcc::Object(genCode).Write(os); });
+        return;
+    }
+    if (options.emit == "image")
+    {
+        WriteFile(out, [&](std::ostream &os) {
+            DrTcc::Image::Write(os, genCode.Text(), genCode.Data(), funcs, genCode.Entry(),
+                                options.tier ? IMAGE_TIER : 0);
+        });
+        return;
+    }
+    if (options.emit == "c" || options.emit == "exe")
+    {
+        auto path = options.emit == "c" ? out : out + ".c";
+        WriteFile(path, [&](std::ostream &os) {
+            DrTcc::Translator(genCode.Text(), genCode.Data(), funcs, genCode.Entry()).Write(os);
+        });
+        if (options.emit == "exe")
+        { Cc("-o \"" + out + "\" \"" + path + "\""); }
+        return;
+    }
+
+    auto obj = options.emit == "obj" ? out : out + ".o";
+    WriteFile(obj, [&](std::ostream &os) {
+        DrTcc::Native(genCode.Text(), genCode.Data(), funcs, genCode.Entry()).Write(os);
+    });
+    WriteFile(obj + ".rt.c", [&](std::ostream &os) { DrTcc::Translator::Runtime(os, true); });
+    if (options.emit == "native")
+    { Cc("-o \"" + out + "\" \"" + obj + "\" \"" + obj + ".rt.c\""); }
+}
+
+// 影响生成代码的选项，和源码一起构成缓存的键
+static std::string CacheOptions(const Options &options)
+{
+    std::string key = options.tier ? "tier;" : "opt;";
+
+    // ""形式的#include相对源文件查找，其余在-I目录中查找，头文件的位置由它们决定
+    key.append(options.input).append(";");
+    for (const auto &dir : options.includes)
+    { key.append(dir).append(";"); }
+    if (!options.profileUse.empty())
+    {
+        DrTcc::Source profile;
+        if (profile.Open(options.profileUse))
+        { key.append(profile.View().data, profile.View().size); }
+    }
+    return key;
+}
+
+static void CacheStats(const DrTcc::Cache &cache, const Options &options, const DrTcc::FuncCache *funcs = nullptr)
+{
+    if (options.cacheStats)
+    {
+        fprintf(stderr, "cache: %llu hits, %llu misses\n", (unsigned long long) cache.Hits(),
+                (unsigned long long) cache.Misses());
+        if (funcs != nullptr)
+        {
+            fprintf(stderr, "cache: %llu functions reused, %llu generated\n", (unsigned long long) funcs->Hits(),
+                    (unsigned long long) funcs->Misses());
+        }
+    }
+}
+
+static void Exec(const DrTcc::Image &img, const Options &options);
+
+void CompileAndRun(DrTcc::StringView sourceCode, const Options &options)
+{
+    DrTcc::Profile use, gen;
+    if (!options.profileUse.empty() && !use.Load(options.profileUse))
+    {
+        printf("cannot load profile: %s\n", options.profileUse.c_str());
+        throw std::exception();
+    }
+
+    // 映像缓存只用于直接运行，剖析运行需要GenCode的跳转点编号
+    // 包含的头文件由预处理器记下，其内容计入映像的键，头文件改动后重新编译
+    std::unique_ptr<DrTcc::Cache> cache;
+    std::string key;
+    if (!options.cache.empty())
+    { cache.reset(new DrTcc::Cache(options.cache, options.cacheLimit)); }
+    auto image = cache && options.emit.empty() && options.profileGen.empty();
+    if (image)
+    {
+        key = DrTcc::Cache::Key(sourceCode, CacheOptions(options));
+        auto path = cache->FindImage(key);
+        DrTcc::Source image;
+        DrTcc::Image img;
+        if (!path.empty() && image.Open(path) && img.Load(image.View()))
+        {
+            CacheStats(*cache, options);
+            Exec(img, options);
+            return;
+        }
+    }
+
+    DrTcc::Preprocessor pp(options.input, headers, options.includes);
+    DrTcc::Parser parser(sourceCode, &pp);
+    parser.Parse();
+    DrTcc::AstTree tree = parser.Compact();
+
+    // 源码有改动时按函数复用字节码，函数的字节码与优化选项无关
+    DrTcc::FuncCache funcs;
+    std::string funcKey;
+    if (cache && !options.input.empty())
+    {
+        funcKey = DrTcc::Cache::FuncKey(options.input);
+        DrTcc::Source file;
+        if (file.Open(cache->Path(funcKey, CACHE_FUNCS)))
+        { funcs.Load(file.View()); }
+    }
+    DrTcc::GenCode genCode(tree, options.profileUse.empty() ? nullptr : &use, options.tier, options.emit == "object",
+                           funcKey.empty() ? nullptr : &funcs);
+
+    if (!funcKey.empty())
+    { cache->Store(funcKey, [&](std::ostream &os) { funcs.Write(os); }, CACHE_FUNCS); }
+    if (image)
+    {
+        cache->StoreImage(key, pp.Includes(), [&](std::ostream &os) {
+            DrTcc::Image::Write(os, genCode.Text(), genCode.Data(), genCode.Funcs(), genCode.Entry(),
+                                options.tier ? IMAGE_TIER : 0);
+        });
+    }
+    if (cache)
+    { CacheStats(*cache, options, funcKey.empty() ? nullptr : &funcs); }
+
+    if (!options.emit.empty())
+    {
+        Emit(genCode, options);
+        return;
+    }
+
+    genCode.Eval(options.profileGen.empty() ? nullptr : &gen, options.args);
+
+    if (!options.profileGen.empty() && !gen.Save(options.profileGen))
+    { printf("cannot save profile: %s\n", options.profileGen.c_str()); }
+}
+
+void RunImage(DrTcc::StringView image, const Options &options)
+{
+    if (!options.profileGen.empty() || !options.profileUse.empty() || !options.emit.empty())
+    {
+        printf("bytecode image can only be run\n");
+        throw std::exception();
+    }
+
+    DrTcc::Image img;
+    if (!img.Load(image))
+    { throw std::exception(); }
+
+    Exec(img, options);
+}
+
+static void Exec(const DrTcc::Image &img, const Options &options)
+{
+    DrTcc::VM vm(img.Text(), img.TextSize(), img.Data(), img.DataSize());
+    vm.Args(options.args);
+    if (img.Flags() & IMAGE_TIER)
+    {
+        std::vector<int> entries;
+        for (const auto &f : img.Funcs())
+        { entries.push_back(f.first); }
+        vm.Tiering(std::vector<int>(img.Text(), img.Text() + img.TextSize()), entries);
+    }
+    if (vm.Exec(img.Entry()) != DrTcc::VmExit)
+    {
+        printf("%s\n", vm.Message().c_str());
+        throw std::exception();
+    }
+}
+
+// 分别编译的目标文件合并为一个字节码映像，源文件在此按object模式编译
+void Link(int argc, char **argv, const Options &options)
+{
+    DrTcc::Linker linker;
+    for (auto i = 0; i < argc; ++i)
+    {
+        DrTcc::Source source;
+        if (!source.Open(argv[i]) || source.View().length() == 0)
+        {
+            printf("cannot open: %s\n", argv[i]);
+            throw std::exception();
+        }
+
+        DrTcc::Object object;
+        if (DrTcc::Object::Is(source.View()))
+        {
+            if (!object.Load(source.View()))
+            { throw std::exception(); }
+        }
+        else
+        {
+            DrTcc::Preprocessor pp(argv[i], headers, options.includes);
+            DrTcc::Parser parser(source.View(), &pp);
+            parser.Parse();
+            DrTcc::AstTree tree = parser.Compact();
+            object = DrTcc::Object(DrTcc::GenCode(tree, nullptr, true, true));
+        }
+        linker.Add(std::move(object));
+    }
+
+    linker.Link(options.tier);
+    WriteFile(options.output, [&](std::ostream &os) {
+        DrTcc::Image::Write(os, linker.Text(), linker.Data(), linker.Funcs(), linker.Entry(),
+                            options.tier ? IMAGE_TIER : 0);
+    });
+}
+
+// 服务模式中编译好的程序，源文件和它包含的头文件都未改动时直接复用
+struct Served
+{
+    std::vector<std::pair<std::string, std::pair<int64_t, uint64_t>>> files;   // 路径 -> <修改时间, 大小>
+    std::shared_ptr<const DrTcc::Program> program;
+};
+
+// 服务进程在任务间复用的状态
+struct ServeState
+{
+    std::unordered_map<std::string, std::shared_ptr<Served>> programs;      // 程序路径 -> 编译结果
+    std::unique_ptr<DrTcc::VM> vm;
+};
+
+static bool Stat(const std::string &path, std::pair<int64_t, uint64_t> &st)
+{
+    struct stat s;
+    if (stat(path.c_str(), &s) != 0)
+    { return false; }
+    st = std::make_pair((int64_t) s.st_mtime, (uint64_t) s.st_size);
+    return true;
+}
+
+static std::shared_ptr<Served> ServeCompile(const std::string &path, const Options &options, ServeState &state)
 {
-    DrTcc::Parser parser(sourceCode);
-    DrTcc::AstNode *root = parser.Parse();
-    DrTcc::GenCode genCode(root);
-    genCode.Eval();
-}
\ No newline at end of file
+    auto &programs = state.programs;
+    auto f = programs.find(path);
+    if (f != programs.end())
+    {
+        auto fresh = true;
+        std::pair<int64_t, uint64_t> st;
+        for (const auto &file : f->second->files)
+        { fresh = fresh && Stat(file.first, st) && st == file.second; }
+        if (fresh)
+        { return f->second; }
+    }
+
+    DrTcc::Source source;
+    if (!source.Open(path) || source.View().length() == 0)
+    {
+        printf("cannot open: %s\n", path.c_str());
+        throw std::exception();
+    }
+
+    auto prog = std::make_shared<Served>();
+    if (DrTcc::Image::Is(source.View()))
+    { prog->program = DrTcc::Program::Load(source.View()); }
+    else
+    {
+        DrTcc::CompileOptions compile;
+        compile.file = path;
+        compile.includes = options.includes;
+        compile.tier = options.tier;
+        compile.headers = &headers;
+        prog->program = DrTcc::Program::Compile(source.View(), compile);
+    }
+
+    std::vector<std::string> files{path};
+    files.insert(files.end(), prog->program->Includes().begin(), prog->program->Includes().end());
+
+    for (const auto &file : files)
+    {
+        std::pair<int64_t, uint64_t> st;
+        if (Stat(file, st))
+        { prog->files.emplace_back(file, st); }
+    }
+    programs[path] = prog;
+    return prog;
+}
+
+// 执行一个任务: args[0]为程序(源文件或字节码映像)，其余为程序参数
+// 程序的输出经VM的输出回调收集，返回退出码，出错时为-1
+static int ServeJob(const std::vector<std::string> &args, const Options &options, ServeState &state,
+                    std::string &output)
+{
+    output.clear();
+    auto code = -1;
+    try
+    {
+        const auto &p = *ServeCompile(args[0], options, state)->program;
+        p.Install(state.vm);
+        state.vm->Args(args);
+        state.vm->Output([&](const char *s, size_t n) { output.append(s, n); });
+        if (state.vm->Exec(p.Entry()) == DrTcc::VmExit)
+        { code = state.vm->ExitCode(); }
+        else
+        { output.append(state.vm->Message()).append("\n"); }
+        state.vm->Output(nullptr);
+    }
+    catch (const std::exception &e)
+    {
+        // 编译器的诊断信息输出在服务进程一侧
+        output.append("cannot run: ").append(args[0]).append("\n");
+        if (state.vm != nullptr)
+        { state.vm->Output(nullptr); }
+    }
+    return code;
+}
+
+// 逐行读取任务: 程序 [参数..]，以空白分隔
+// 每个任务回复 "status <退出码> <输出字节数>\n"，后接程序的全部输出
+static void ServeStream(FILE *in, int out, const Options &options, ServeState &state)
+{
+    std::string line;
+    int c;
+    while(true)
+    {
+        line.clear();
+        while((c = fgetc(in)) != EOF && c != '\n')
+        { line += (char) c; }
+        if (c == EOF && line.empty())
+        { break; }
+
+        std::vector<std::string> args;
+        size_t i = 0;
+        while(i < line.size())
+        {
+            while(i < line.size() && isspace((unsigned char) line[i]))
+            { i++; }
+            auto start = i;
+            while(i < line.size() && !isspace((unsigned char) line[i]))
+            { i++; }
+            if (i > start)
+            { args.push_back(line.substr(start, i - start)); }
+        }
+        if (args.empty())
+        { continue; }
+
+        std::string output;
+        auto code = ServeJob(args, options, state, output);
+        auto header = "status " + std::to_string(code) + " " + std::to_string(output.size()) + "\n";
+        output.insert(0, header);
+        for (size_t sent = 0; sent < output.size();)
+        {
+            auto w = write(out, output.data() + sent, (unsigned) (output.size() - sent));
+            if (w <= 0)
+            { return; }
+            sent += (size_t) w;
+        }
+    }
+}
+
+// 常驻进程: 头文件词流、编译结果和VM在任务间复用，省去进程启动和前端的开销
+void Serve(const Options &options)
+{
+    ServeState state;
+    if (options.socket.empty())
+    {
+        // 应答写到原来的标准输出，编译器的诊断信息改到标准错误，不混入应答
+        fflush(stdout);
+        auto reply = dup(1);
+        dup2(2, 1);
+        ServeStream(stdin, reply, options, state);
+        close(reply);
+        return;
+    }
+
+#ifdef _WIN32
+    printf("--socket is not supported on this platform\n");
+    throw std::exception();
+#else
+    signal(SIGPIPE, SIG_IGN);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (options.socket.size() >= sizeof(addr.sun_path))
+    {
+        printf("socket path too long: %s\n", options.socket.c_str());
+        throw std::exception();
+    }
+    strcpy(addr.sun_path, options.socket.c_str());
+    auto server = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(addr.sun_path);
+    if (server < 0 || bind(server, (sockaddr *) &addr, sizeof(addr)) != 0 || listen(server, 16) != 0)
+    {
+        printf("cannot listen on: %s\n", options.socket.c_str());
+        throw std::exception();
+    }
+
+    // 连接依次处理，一个连接可以提交多个任务
+    while(true)
+    {
+        auto conn = accept(server, nullptr, nullptr);
+        if (conn < 0)
+        { continue; }
+        auto in = fdopen(conn, "r");
+        if (in == nullptr)
+        {
+            close(conn);
+            continue;
+        }
+        ServeStream(in, conn, options, state);
+        fclose(in);
+    }
+#endif
+}